@@ -0,0 +1,81 @@
+# Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+LOCAL_PATH:= $(call my-dir)
+
+BOOTTRACE_FP1_CFLAGS :=
+
+ifneq ($(FP1_BOOT_TRACE),)
+    BOOTTRACE_FP1_CFLAGS += -DFP1_BOOT_TRACE
+endif
+
+
+
+# Library to record the boot trace; see include/boottrace_fp1.h. It only uses
+# libc, so it can be linked in the static executables of the boot image too.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := boottrace.c
+
+LOCAL_MODULE := libboottrace_fp1
+
+include $(BUILD_STATIC_LIBRARY)
+
+
+
+# Host build of the library, for the host builds of the instrumented binaries.
+# The trace file can be set with the BOOTTRACE_FP1_PATH environment variable.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := boottrace.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+
+LOCAL_MODULE := libboottrace_fp1
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += -DBOOTTRACE_FP1_HOST_BUILD
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+
+
+# Command to trace proprietary binaries run from the init.*.rc files.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := boottrace_exec.c
+
+LOCAL_STATIC_LIBRARIES := libboottrace_fp1
+
+LOCAL_MODULE := boottrace-fp1
+
+LOCAL_CFLAGS += $(BOOTTRACE_FP1_CFLAGS)
+
+include $(BUILD_EXECUTABLE)
+
+
+
+# Host command to convert a trace pulled from the device into a timeline with
+# the critical path and into a Chrome trace.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := boottrace_analyze.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+
+LOCAL_MODULE := boottrace-fp1-analyze
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
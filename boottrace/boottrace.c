@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <boottrace_fp1.h>
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static BootTraceFp1Header* trace_header = 0;
+static BootTraceFp1Event* trace_events = 0;
+
+static const char* get_trace_path() {
+#ifdef BOOTTRACE_FP1_HOST_BUILD
+    const char* path = getenv("BOOTTRACE_FP1_PATH");
+    if (path) {
+        return path;
+    }
+#endif
+
+    return BOOTTRACE_FP1_PATH;
+}
+
+/**
+ * Opens the trace file, creating it if needed, and maps it. Several processes
+ * may be doing this at the same time; growing the file to its size is
+ * idempotent, and a zeroed file is already a valid empty trace.
+ */
+static void trace_map() {
+    int fd = open(get_trace_path(), O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        return;
+    }
+
+    // Processes of other users trace to the file too, through the shared group
+    // (the mode given to open is affected by the umask); ignore the errors if
+    // it was created by another process.
+    fchown(fd, -1, BOOTTRACE_FP1_GID);
+    fchmod(fd, 0660);
+
+    struct stat stat;
+    if (fstat(fd, &stat) < 0 || (stat.st_size < (off_t) BOOTTRACE_FP1_FILE_SIZE && ftruncate(fd, BOOTTRACE_FP1_FILE_SIZE) < 0)) {
+        close(fd);
+
+        return;
+    }
+
+    void* trace = mmap(NULL, BOOTTRACE_FP1_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (trace == MAP_FAILED) {
+        return;
+    }
+
+    BootTraceFp1Header* header = trace;
+
+    __sync_val_compare_and_swap(&header->magic, 0, BOOTTRACE_FP1_MAGIC);
+    __sync_val_compare_and_swap(&header->version, 0, BOOTTRACE_FP1_VERSION);
+
+    if (header->magic != BOOTTRACE_FP1_MAGIC || header->version != BOOTTRACE_FP1_VERSION) {
+        munmap(trace, BOOTTRACE_FP1_FILE_SIZE);
+
+        return;
+    }
+
+    trace_events = (BootTraceFp1Event*) (header + 1);
+    trace_header = header;
+}
+
+void boottrace_fp1_event(uint32_t type, const char* name) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_once(&trace_once, trace_map);
+
+    if (!trace_header) {
+        return;
+    }
+
+    uint32_t index = __sync_fetch_and_add(&trace_header->next_event, 1);
+    if (index >= BOOTTRACE_FP1_MAX_EVENTS) {
+        __sync_fetch_and_add(&trace_header->dropped_events, 1);
+
+        return;
+    }
+
+    BootTraceFp1Event* event = &trace_events[index];
+
+    event->type = type;
+    event->pid = getpid();
+    event->tid = syscall(__NR_gettid);
+    event->timestamp_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    strncpy(event->name, name, sizeof(event->name) - 1);
+    event->name[sizeof(event->name) - 1] = '\0';
+
+    // The event must be fully written before it is marked as complete.
+    __sync_synchronize();
+
+    event->sequence = index + 1;
+}
@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host command to analyze a boot trace pulled from the device:
+ *
+ *   boottrace-fp1-analyze <trace file> [<Chrome trace file>]
+ *
+ * It prints the timeline of the traced steps, nested by thread, and the
+ * critical path of the boot: the chain of innermost steps (those without other
+ * steps of the same process inside them), each one ending before the next one
+ * began, that ends with the last step that ended, which is what the end of the
+ * boot was waiting for. Steps that did not end (like those of the daemons that
+ * keep running) are not part of the critical path, as they would be stretched
+ * to the end of the trace. The gaps between the steps of the critical path are
+ * time not covered by the trace.
+ *
+ * If a Chrome trace file is given the steps are written to it too, in the
+ * Trace Event Format (JSON) loaded by chrome://tracing.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <boottrace_fp1.h>
+
+#define MAX_THREADS 256
+#define MAX_DEPTH 32
+
+struct span {
+    char name[BOOTTRACE_FP1_NAME_MAX];
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    int depth;
+    int instant;
+
+    // Whether other steps of the same process happened inside this one.
+    int has_inner_steps;
+
+    // Whether the step did not end before the trace was pulled.
+    int open;
+};
+
+struct thread {
+    uint32_t pid;
+    uint32_t tid;
+    int stack[MAX_DEPTH];
+    int depth;
+};
+
+static BootTraceFp1Event events[BOOTTRACE_FP1_MAX_EVENTS];
+static int num_events;
+
+static struct span spans[BOOTTRACE_FP1_MAX_EVENTS];
+static int num_spans;
+
+static struct thread threads[MAX_THREADS];
+static int num_threads;
+
+static uint64_t first_ns;
+static uint64_t last_ns;
+
+static double to_ms(uint64_t ns) {
+    return ns / 1000000.0;
+}
+
+static int compare_events(const void* a, const void* b) {
+    const BootTraceFp1Event* event_a = a;
+    const BootTraceFp1Event* event_b = b;
+
+    if (event_a->timestamp_ns != event_b->timestamp_ns) {
+        return event_a->timestamp_ns < event_b->timestamp_ns ? -1 : 1;
+    }
+
+    // Keep the order in which they were appended.
+    return event_a->sequence < event_b->sequence ? -1 : 1;
+}
+
+static int compare_spans(const void* a, const void* b) {
+    const struct span* span_a = a;
+    const struct span* span_b = b;
+
+    if (span_a->begin_ns != span_b->begin_ns) {
+        return span_a->begin_ns < span_b->begin_ns ? -1 : 1;
+    }
+
+    return span_a->depth - span_b->depth;
+}
+
+/**
+ * Reads the complete events of the trace file. Returns 0 on success, or -1 if
+ * it is not a valid trace file.
+ */
+static int read_trace(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    BootTraceFp1Header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != BOOTTRACE_FP1_MAGIC) {
+        fprintf(stderr, "%s is not a boot trace\n", path);
+        fclose(file);
+
+        return -1;
+    }
+
+    if (header.version != BOOTTRACE_FP1_VERSION) {
+        fprintf(stderr, "Unsupported boot trace version %u\n", header.version);
+        fclose(file);
+
+        return -1;
+    }
+
+    uint32_t count = header.next_event < BOOTTRACE_FP1_MAX_EVENTS ? header.next_event : BOOTTRACE_FP1_MAX_EVENTS;
+    int incomplete = 0;
+
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        BootTraceFp1Event event;
+        if (fread(&event, sizeof(event), 1, file) != 1) {
+            break;
+        }
+
+        if (event.sequence != i + 1) {
+            incomplete++;
+
+            continue;
+        }
+
+        event.name[sizeof(event.name) - 1] = '\0';
+        events[num_events++] = event;
+    }
+
+    fclose(file);
+
+    if (header.dropped_events) {
+        printf("Warning: %u events dropped, as the trace file was full\n", header.dropped_events);
+    }
+    if (incomplete) {
+        printf("Warning: %d incomplete events ignored\n", incomplete);
+    }
+
+    return 0;
+}
+
+static struct thread* get_thread(uint32_t pid, uint32_t tid) {
+    int i;
+    for (i = 0; i < num_threads; i++) {
+        if (threads[i].pid == pid && threads[i].tid == tid) {
+            return &threads[i];
+        }
+    }
+
+    if (num_threads == MAX_THREADS) {
+        return NULL;
+    }
+
+    struct thread* thread = &threads[num_threads++];
+    thread->pid = pid;
+    thread->tid = tid;
+    thread->depth = 0;
+
+    return thread;
+}
+
+static struct span* add_span(const BootTraceFp1Event* event, int depth) {
+    struct span* span = &spans[num_spans++];
+
+    strcpy(span->name, event->name);
+    span->pid = event->pid;
+    span->tid = event->tid;
+    span->begin_ns = event->timestamp_ns;
+    span->end_ns = event->timestamp_ns;
+    span->depth = depth;
+    span->instant = 0;
+    span->has_inner_steps = 0;
+    span->open = 0;
+
+    return span;
+}
+
+/**
+ * Pairs the begin and end events of each thread into steps.
+ */
+static void build_spans() {
+    int unmatched_ends = 0;
+    int too_deep = 0;
+
+    qsort(events, num_events, sizeof(events[0]), compare_events);
+
+    if (num_events) {
+        first_ns = events[0].timestamp_ns;
+        last_ns = events[num_events - 1].timestamp_ns;
+    }
+
+    int i;
+    for (i = 0; i < num_events; i++) {
+        const BootTraceFp1Event* event = &events[i];
+
+        struct thread* thread = get_thread(event->pid, event->tid);
+        if (!thread) {
+            continue;
+        }
+
+        if (event->type == BOOTTRACE_FP1_EVENT_BEGIN) {
+            if (thread->depth == MAX_DEPTH) {
+                too_deep++;
+
+                continue;
+            }
+
+            add_span(event, thread->depth);
+            thread->stack[thread->depth++] = num_spans - 1;
+        } else if (event->type == BOOTTRACE_FP1_EVENT_END) {
+            if (thread->depth == 0) {
+                unmatched_ends++;
+
+                continue;
+            }
+
+            spans[thread->stack[--thread->depth]].end_ns = event->timestamp_ns;
+        } else if (event->type == BOOTTRACE_FP1_EVENT_INSTANT) {
+            add_span(event, thread->depth)->instant = 1;
+        }
+    }
+
+    // Steps still running when the trace was pulled (or whose process died)
+    // are extended to the end of the trace.
+    for (i = 0; i < num_threads; i++) {
+        while (threads[i].depth > 0) {
+            struct span* span = &spans[threads[i].stack[--threads[i].depth]];
+
+            span->end_ns = last_ns;
+            span->open = 1;
+        }
+    }
+
+    if (unmatched_ends) {
+        printf("Warning: %d end events without a begin event ignored\n", unmatched_ends);
+    }
+    if (too_deep) {
+        printf("Warning: %d steps nested too deeply ignored\n", too_deep);
+    }
+
+    qsort(spans, num_spans, sizeof(spans[0]), compare_spans);
+
+    for (i = 0; i < num_spans; i++) {
+        struct span* span = &spans[i];
+
+        int j;
+        for (j = 0; j < num_spans && !span->has_inner_steps; j++) {
+            const struct span* other = &spans[j];
+
+            if (j != i && !other->instant && other->pid == span->pid &&
+                    other->begin_ns >= span->begin_ns && other->end_ns <= span->end_ns &&
+                    (other->depth > span->depth || other->tid != span->tid)) {
+                span->has_inner_steps = 1;
+            }
+        }
+    }
+}
+
+static void print_timeline() {
+    printf("Timeline (ms since the first event):\n");
+
+    int i;
+    for (i = 0; i < num_spans; i++) {
+        const struct span* span = &spans[i];
+
+        if (span->instant) {
+            printf("  %10.3f %10s  %*s* %s [%u/%u]\n", to_ms(span->begin_ns - first_ns), "",
+                   span->depth * 2, "", span->name, span->pid, span->tid);
+        } else {
+            printf("  %10.3f %10.3f  %*s%s [%u/%u]%s\n", to_ms(span->begin_ns - first_ns),
+                   to_ms(span->end_ns - span->begin_ns), span->depth * 2, "", span->name,
+                   span->pid, span->tid, span->open ? " (not ended)" : "");
+        }
+    }
+}
+
+/**
+ * Returns the index of the innermost ended step that ends last no later than
+ * the given time, or -1 if there is none.
+ */
+static int find_last_ending_before(uint64_t time_ns) {
+    int found = -1;
+
+    int i;
+    for (i = 0; i < num_spans; i++) {
+        const struct span* span = &spans[i];
+
+        if (span->has_inner_steps || span->instant || span->open || span->end_ns > time_ns) {
+            continue;
+        }
+
+        if (found < 0 || span->end_ns > spans[found].end_ns) {
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+static void print_critical_path() {
+    int path[BOOTTRACE_FP1_MAX_EVENTS];
+    int length = 0;
+
+    int current = find_last_ending_before(UINT64_MAX);
+    while (current >= 0) {
+        path[length++] = current;
+
+        // A step that takes no time would be found again.
+        uint64_t begin_ns = spans[current].begin_ns;
+        current = find_last_ending_before(begin_ns);
+        if (current >= 0 && spans[current].begin_ns == begin_ns && spans[current].end_ns == begin_ns) {
+            current = -1;
+        }
+    }
+
+    if (length == 0) {
+        printf("\nNo steps traced\n");
+
+        return;
+    }
+
+    printf("\nCritical path:\n");
+
+    uint64_t traced_ns = 0;
+    uint64_t previous_end_ns = first_ns;
+
+    int i;
+    for (i = length - 1; i >= 0; i--) {
+        const struct span* span = &spans[path[i]];
+
+        if (span->begin_ns > previous_end_ns) {
+            printf("  %10.3f %10.3f  (not traced)\n", to_ms(previous_end_ns - first_ns), to_ms(span->begin_ns - previous_end_ns));
+        }
+
+        printf("  %10.3f %10.3f  %s [%u/%u]\n", to_ms(span->begin_ns - first_ns), to_ms(span->end_ns - span->begin_ns),
+               span->name, span->pid, span->tid);
+
+        traced_ns += span->end_ns - span->begin_ns;
+        previous_end_ns = span->end_ns;
+    }
+
+    uint64_t total_ns = previous_end_ns - first_ns;
+
+    printf("Total %.3f ms; %.3f ms in traced steps, %.3f ms not traced\n", to_ms(total_ns), to_ms(traced_ns),
+           to_ms(total_ns - traced_ns));
+}
+
+static void write_json_string(FILE* file, const char* string) {
+    fputc('"', file);
+
+    for (; *string; string++) {
+        unsigned char c = *string;
+
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+static int write_chrome_trace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    int i;
+    for (i = 0; i < num_spans; i++) {
+        const struct span* span = &spans[i];
+
+        fprintf(file, "%s\n{\"name\":", i ? "," : "");
+        write_json_string(file, span->name);
+
+        // Timestamps in microseconds.
+        if (span->instant) {
+            fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", (span->begin_ns - first_ns) / 1000.0);
+        } else {
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", (span->begin_ns - first_ns) / 1000.0,
+                    (span->end_ns - span->begin_ns) / 1000.0);
+
+            if (span->open) {
+                fprintf(file, ",\"args\":{\"ended\":false}");
+            }
+        }
+
+        fprintf(file, ",\"pid\":%u,\"tid\":%u}", span->pid, span->tid);
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "boottrace-fp1-analyze <trace file> [<Chrome trace file>]\n");
+
+        return EXIT_FAILURE;
+    }
+
+    if (read_trace(argv[1]) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    build_spans();
+
+    print_timeline();
+    print_critical_path();
+
+    if (argc == 3 && write_chrome_trace(argv[2]) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs a command as a step of the boot trace, so the time spent by proprietary
+ * binaries that can not be instrumented (like pvrsrvctl or nvram_daemon) shows
+ * in the trace too:
+ *
+ *   boottrace-fp1 <step name> <program> [<argument>...]
+ *
+ * If the boot trace is not enabled the program is just executed in place of
+ * this command. Otherwise it is executed in a child process, and the step ends
+ * when the child exits; the exit status of the child is returned.
+ *
+ * The child stays in the process group of this command, so it is killed too
+ * when init stops the service (init kills the whole group), and the signals
+ * that can be caught are forwarded to it. Even so, it is meant for oneshot
+ * services; a daemon that keeps running would leave its step open.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <boottrace_fp1.h>
+
+#ifdef FP1_BOOT_TRACE
+static const int forwarded_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2 };
+
+static pid_t child_pid;
+
+static void forward_signal(int signal_number) {
+    kill(child_pid, signal_number);
+}
+
+static void forwarded_signals_mask(sigset_t* mask) {
+    sigemptyset(mask);
+
+    size_t i;
+    for (i = 0; i < sizeof(forwarded_signals) / sizeof(forwarded_signals[0]); i++) {
+        sigaddset(mask, forwarded_signals[i]);
+    }
+}
+
+static void forward_signals() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &forward_signal;
+    sigemptyset(&action.sa_mask);
+
+    size_t i;
+    for (i = 0; i < sizeof(forwarded_signals) / sizeof(forwarded_signals[0]); i++) {
+        sigaction(forwarded_signals[i], &action, NULL);
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "boottrace-fp1 <step name> <program> [<argument>...]\n");
+
+        return EXIT_FAILURE;
+    }
+
+#ifdef FP1_BOOT_TRACE
+    BOOTTRACE_BEGIN(argv[1]);
+
+    // The signals are blocked until the parent knows the pid of the child and
+    // forwards them, so none is lost in between.
+    sigset_t mask;
+    sigset_t old_mask;
+    forwarded_signals_mask(&mask);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Could not fork: %s\n", strerror(errno));
+
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+        BOOTTRACE_END(argv[1]);
+
+        return EXIT_FAILURE;
+    }
+
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    } else {
+        child_pid = pid;
+        forward_signals();
+
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = EXIT_FAILURE << 8;
+
+                break;
+            }
+        }
+
+        BOOTTRACE_END(argv[1]);
+
+        return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+    }
+#endif
+
+    execv(argv[2], &argv[2]);
+
+    fprintf(stderr, "Could not execute %s: %s\n", argv[2], strerror(errno));
+
+    return EXIT_FAILURE;
+}
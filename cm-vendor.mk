@@ -24,12 +24,24 @@ else
 $(call inherit-product, vendor/fairphone/fp1/proprietary/blobs.mk)
 
 PRODUCT_COPY_FILES += \
-	vendor/fairphone/fp1/rootdir/init.mt6589.proprietary.rc:root/init.mt6589.proprietary.rc
+	vendor/fairphone/fp1/rootdir/init.mt6589.proprietary.rc:root/init.mt6589.proprietary.rc \
+	vendor/fairphone/fp1/rootdir/modload-fp1.conf:root/modload-fp1.conf
 
-# Add "mknod-fp1" command, as it is needed by the init.mt6589.proprietary.rc
+# Add "modload-fp1" command, as it is needed by the init.mt6589.proprietary.rc
 # file of the boot image.
 PRODUCT_PACKAGES += \
-	mknod-fp1
+	modload-fp1
+
+# Command used by the init.mt6589.proprietary.rc file to run the proprietary
+# services, so they can be traced.
+PRODUCT_PACKAGES += \
+	boottrace-fp1
+
+# Record the boot trace of the vendor binaries and the proprietary services in
+# /dev/boottrace-fp1, to be analyzed with the host command
+# boottrace-fp1-analyze (see include/boottrace_fp1.h). It is disabled by
+# default, as the trace file takes 256 KiB of memory.
+#FP1_BOOT_TRACE := true
 
 # Set the include directory for device-specific headers used to override or
 # extend the standard headers.
@@ -66,6 +78,10 @@ MTK_GPS_WRAPPER_GPS_HAL_USES_UINT32_AIDING_DATA := true
 PRODUCT_PACKAGES += \
 	gps.fp1
 
+# Keep the last fix and the last injected time across reboots and inject them
+# again when the GPS is started, to speed up the first fix after a reboot.
+MTK_GPS_WRAPPER_ASSISTANCE_CACHE := true
+
 # Helper command to add and remove the wlan0 and p2p0 net interfaces (as the
 # wlan kernel module does not add them automatically when loaded, so the module
 # is kept always loaded and the interfaces are added and removed when needed).
@@ -78,6 +94,10 @@ WIFI_DRIVER_STATE_CTRL_PROP_NAME := wlan_iface_ctrl
 WIFI_DRIVER_STATE_ON := add
 WIFI_DRIVER_STATE_OFF := remove
 
+# Init socket of the daemon mode of that service; if it is running the requests
+# are sent directly to it instead of launching the service.
+WIFI_DRIVER_STATE_CTRL_SOCKET := wlan_iface_ctrl
+
 WPA_SUPPLICANT_VERSION := VER_0_8_X
 BOARD_WPA_SUPPLICANT_DRIVER := NL80211
 BOARD_WPA_SUPPLICANT_PRIVATE_LIB := wpa_supplicant_8_private_lib_fp1
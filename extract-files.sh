@@ -24,6 +24,27 @@
 # If a parameter is given, this script copies the proprietary blobs from the
 # subdirectories of the given parameter (it is assumed that the parameter is the
 # path to the root directory of an uncompressed ROM).
+#
+# If the parameter is "--list" the blobs to be extracted are just listed. The
+# list can be checked against the blobs actually needed with the host command
+# blobdeps-fp1 (see tools/blobdeps), which resolves the dependencies of the
+# blobs from the ROM instead of from the *_DEPENDENCIES variables below:
+#   blobdeps-fp1 -b out/target/product/fp1 -f tools/blobdeps/blob-roots.txt \
+#       -l <(./extract-files.sh --list) <ROM root directory>
+#
+# The SHA-1 of each extracted blob and a fingerprint of its source (the SHA-1 of
+# the source file when copying from a ROM, or its MD5, computed on the device
+# with the "md5" command of toolbox, when pulling from the device) are recorded
+# in proprietary/blobs.sha1. Blobs whose source did not change and whose
+# extracted file still matches its SHA-1 are not extracted again; remove
+# proprietary/blobs.sha1 to force the extraction of all of them. If the device
+# has no "md5" command the blobs are always pulled.
+#
+# The blobs are extracted in parallel, in as many jobs as processors unless set
+# in the EXTRACT_FILES_JOBS environment variable.
+#
+# proprietary/blobs.mk is only written if its contents changed, so running the
+# extraction again does not cause the files depending on it to be rebuilt.
 
 VENDOR_DIR="."
 
@@ -291,28 +312,167 @@ ALL_FILES=" \
 
 
 
-# Remove duplicated files
+# Remove duplicated files, keeping the order in which they were listed
+
+declare -A LISTED_FILES
 
 FILES=""
 for FILE in $ALL_FILES; do
-    if [ -z "$(echo "$FILES" | grep --word-regexp "$FILE")" ]; then
+    if [ -z "${LISTED_FILES[$FILE]}" ]; then
+        LISTED_FILES[$FILE]=1
         FILES="$FILES $FILE"
     fi
 done
 
+if [ "$1" = "--list" ]; then
+    for FILE in $FILES; do
+        echo "$FILE"
+    done
+
+    exit 0
+fi
+
 
 
 # Perform the extraction and create a blobs.mk file to install them
 
-MK_FILE="$VENDOR_DIR/proprietary/blobs.mk"
+PROPRIETARY_DIR="$VENDOR_DIR/proprietary"
+MK_FILE="$PROPRIETARY_DIR/blobs.mk"
+MANIFEST_FILE="$PROPRIETARY_DIR/blobs.sha1"
+
+ROM_DIR=""
+if [ "$#" -eq "1" ]; then
+    ROM_DIR="$1"
+fi
 
-mkdir --parents "$(dirname $MK_FILE)"
-rm -f $MK_FILE
-echo -n "PRODUCT_COPY_FILES +=" >> $MK_FILE
+JOBS=${EXTRACT_FILES_JOBS:-$(nproc 2>/dev/null || echo 4)}
 
-for FILE in $FILES; do
-    mkdir --parents "$(dirname $VENDOR_DIR/proprietary/$FILE)"
+mkdir --parents "$PROPRIETARY_DIR"
+
+# SHA-1 and source fingerprint of each file in the previous extraction
+declare -A OLD_SHA1S
+declare -A OLD_FINGERPRINTS
+
+if [ -f "$MANIFEST_FILE" ]; then
+    while read -r SHA1 FILE_DST FINGERPRINT; do
+        if [[ $SHA1 = "#"* ]]; then
+            continue
+        fi
+
+        OLD_SHA1S[$FILE_DST]=$SHA1
+        OLD_FINGERPRINTS[$FILE_DST]=$FINGERPRINT
+    done < "$MANIFEST_FILE"
+fi
+
+get_sha1() {
+    sha1sum < "$1" | cut --delimiter=" " --fields=1
+}
+
+get_md5() {
+    md5sum < "$1" | cut --delimiter=" " --fields=1
+}
+
+# Fingerprint of the files pulled from a device without the "md5" command; it
+# never matches, so those files are always pulled.
+UNHASHED_FINGERPRINT="unhashed"
+
+# Returns the MD5 of the file in the device, or nothing if it could not be
+# computed ("adb shell" does not return the exit status of the command, so the
+# output is checked instead).
+get_device_md5() {
+    local MD5
+    MD5="$(adb shell md5 "$1" | tr --delete '\r' | cut --delimiter=" " --fields=1)"
+
+    if [[ $MD5 =~ ^[0-9a-f]{32}$ ]]; then
+        echo "$MD5"
+    fi
+}
+
+DEVICE_HAS_MD5=""
+if [ -z "$ROM_DIR" ] && [ -n "$(get_device_md5 /system/build.prop)" ]; then
+    DEVICE_HAS_MD5="true"
+fi
+
+# Returns the fingerprint of the source file, which changes if the source file
+# changes.
+get_source_fingerprint() {
+    local FILE_SRC="$1"
+
+    if [ -n "$ROM_DIR" ]; then
+        [ -f "$ROM_DIR/$FILE_SRC" ] && get_sha1 "$ROM_DIR/$FILE_SRC"
+    elif [ -n "$DEVICE_HAS_MD5" ]; then
+        get_device_md5 "$FILE_SRC"
+    else
+        echo "$UNHASHED_FINGERPRINT"
+    fi
+}
+
+# Extracts the file, unless it did not change since the previous extraction,
+# and writes "<SHA-1> <extracted|unchanged> <source fingerprint>" to the given
+# result file. Nothing is written if the extraction failed.
+extract_file() {
+    local FILE_SRC="$1"
+    local FILE_DST="$2"
+    local RESULT_FILE="$3"
+
+    local DST="$PROPRIETARY_DIR/$FILE_DST"
+
+    local FINGERPRINT
+    FINGERPRINT="$(get_source_fingerprint "$FILE_SRC")"
+    if [ -z "$FINGERPRINT" ]; then
+        echo "$FILE_SRC: could not read the source file" >&2
+        return 1
+    fi
+
+    if [ -f "$DST" ] && [ "$FINGERPRINT" != "$UNHASHED_FINGERPRINT" ] &&
+            [ "$FINGERPRINT" = "${OLD_FINGERPRINTS[$FILE_DST]}" ]; then
+        local SHA1="$(get_sha1 "$DST")"
+        if [ "$SHA1" = "${OLD_SHA1S[$FILE_DST]}" ]; then
+            echo "$SHA1 unchanged $FINGERPRINT" > "$RESULT_FILE"
+            return 0
+        fi
+    fi
+
+    mkdir --parents "$(dirname "$DST")"
+
+    # If a parameter is given it is assumed to be a root directory to copy the
+    # files from; otherwise, the files are pulled from the device using ADB.
+    if [ -n "$ROM_DIR" ]; then
+        cp "$ROM_DIR/$FILE_SRC" "$DST" || return 1
+    else
+        adb pull "$FILE_SRC" "$DST" || return 1
+    fi
+
+    local SHA1="$(get_sha1 "$DST")"
+
+    # When copying from a ROM the fingerprint is the SHA-1 of the source file.
+    if [ -n "$ROM_DIR" ] && [ "$SHA1" != "$FINGERPRINT" ]; then
+        echo "$FILE_SRC: the copied file does not match the source file" >&2
+        rm -f "$DST"
+        return 1
+    fi
+
+    # When pulling from the device it is the MD5 of the source file, if the
+    # device could compute it.
+    if [ -z "$ROM_DIR" ] && [ -n "$DEVICE_HAS_MD5" ] && [ "$(get_md5 "$DST")" != "$FINGERPRINT" ]; then
+        echo "$FILE_SRC: the pulled file does not match the source file" >&2
+        rm -f "$DST"
+        return 1
+    fi
+
+    echo "$SHA1 extracted $FINGERPRINT" > "$RESULT_FILE"
+}
+
+RESULTS_DIR="$(mktemp --directory)"
+trap 'rm -rf "$RESULTS_DIR"' EXIT
+
+MK_FILE_NEW="$RESULTS_DIR/blobs.mk"
+echo -n "PRODUCT_COPY_FILES +=" >> $MK_FILE_NEW
 
+INDEX=0
+RUNNING_JOBS=0
+
+for FILE in $FILES; do
     # Possibility to rename files ("SRCFILE:DSTFILE")
     if [[ $FILE = *":"* ]]; then
         FILEARR=(${FILE//:/ })
@@ -323,15 +483,68 @@ for FILE in $FILES; do
         FILE_DST=$FILE
     fi
 
-    # If a parameter is given it is assumed to be a root directory to copy the
-    # files from; otherwise, the files are pulled from the device using ADB.
-    if [ "$#" -eq "1" ]; then
-        cp "$1/$FILE_SRC" "$VENDOR_DIR/proprietary/$FILE_DST"
+    if [ "$RUNNING_JOBS" -ge "$JOBS" ]; then
+        wait -n
+        RUNNING_JOBS=$((RUNNING_JOBS - 1))
+    fi
+
+    extract_file "$FILE_SRC" "$FILE_DST" "$RESULTS_DIR/$INDEX" &
+    RUNNING_JOBS=$((RUNNING_JOBS + 1))
+    INDEX=$((INDEX + 1))
+
+    echo -n " \\"$'\n'"	vendor/fairphone/fp1/proprietary/$FILE_DST:$FILE_DST" >> $MK_FILE_NEW
+done
+
+wait
+
+echo "" >> $MK_FILE_NEW
+
+
+
+# Record the manifest of the extracted files, in the order in which they were
+# listed
+
+MANIFEST_FILE_NEW="$RESULTS_DIR/blobs.sha1"
+echo "# <SHA-1> <file> <source fingerprint>" > "$MANIFEST_FILE_NEW"
+
+INDEX=0
+EXTRACTED=0
+UNCHANGED=0
+FAILED=0
+
+for FILE in $FILES; do
+    FILE_DST=${FILE#*:}
+
+    if [ -f "$RESULTS_DIR/$INDEX" ]; then
+        read -r SHA1 STATUS FINGERPRINT < "$RESULTS_DIR/$INDEX"
+
+        echo "$SHA1 $FILE_DST $FINGERPRINT" >> "$MANIFEST_FILE_NEW"
+
+        if [ "$STATUS" = "unchanged" ]; then
+            UNCHANGED=$((UNCHANGED + 1))
+        else
+            EXTRACTED=$((EXTRACTED + 1))
+        fi
     else
-        adb pull "$FILE_SRC" "$VENDOR_DIR/proprietary/$FILE_DST"
+        echo "Failed to extract $FILE_DST" >&2
+        FAILED=$((FAILED + 1))
     fi
 
-    echo -n " \\"$'\n'"	vendor/fairphone/fp1/proprietary/$FILE_DST:$FILE_DST" >> $MK_FILE
+    INDEX=$((INDEX + 1))
 done
 
-echo "" >> $MK_FILE
+# Only replace the files if they changed, to keep their modification time
+if ! cmp --silent "$MANIFEST_FILE_NEW" "$MANIFEST_FILE"; then
+    mv "$MANIFEST_FILE_NEW" "$MANIFEST_FILE"
+fi
+
+if ! cmp --silent "$MK_FILE_NEW" "$MK_FILE"; then
+    mv "$MK_FILE_NEW" "$MK_FILE"
+    echo "$MK_FILE updated"
+fi
+
+echo "$EXTRACTED files extracted, $UNCHANGED unchanged, $FAILED failed"
+
+if [ "$FAILED" -ne "0" ]; then
+    exit 1
+fi
@@ -15,23 +15,118 @@
 
 LOCAL_PATH:= $(call my-dir)
 
+GPS_FP1_CFLAGS :=
+
+ifneq ($(MTK_GPS_WRAPPER_GPS_HAL_USES_UINT32_AIDING_DATA),)
+    GPS_FP1_CFLAGS += -DGPS_HAL_USES_UINT32_AIDING_DATA
+endif
+
+ifneq ($(MTK_GPS_WRAPPER_ASYNC_SV_STATUS),)
+    GPS_FP1_CFLAGS += -DGPS_WRAPPER_ASYNC_SV_STATUS
+endif
+
+ifneq ($(MTK_GPS_WRAPPER_NMEA_COALESCING),)
+    GPS_FP1_CFLAGS += -DGPS_WRAPPER_NMEA_COALESCING
+endif
+
+ifneq ($(MTK_GPS_WRAPPER_PRELOAD),)
+    GPS_FP1_CFLAGS += -DGPS_WRAPPER_PRELOAD
+endif
+
+ifneq ($(MTK_GPS_WRAPPER_ASSISTANCE_CACHE),)
+    GPS_FP1_CFLAGS += -DGPS_WRAPPER_ASSISTANCE_CACHE
+endif
+
+ifneq ($(FP1_BOOT_TRACE),)
+    GPS_FP1_CFLAGS += -DFP1_BOOT_TRACE
+endif
+
+
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := gps.c
 
 LOCAL_SHARED_LIBRARIES := libcutils libdl liblog
 
+LOCAL_STATIC_LIBRARIES := libboottrace_fp1
+
 LOCAL_MODULE := gps.fp1
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
+LOCAL_CFLAGS += $(GPS_FP1_CFLAGS)
+
 ifneq ($(MTK_GPS_WRAPPER_WRAPPED_MODULE_PATH),)
     LOCAL_CFLAGS += -DWRAPPED_MODULE_PATH=\"$(MTK_GPS_WRAPPER_WRAPPED_MODULE_PATH)\"
 else
     LOCAL_CFLAGS += -DWRAPPED_MODULE_PATH=\"/system/lib/hw/gps.default.so\"
 endif
 
-ifneq ($(MTK_GPS_WRAPPER_GPS_HAL_USES_UINT32_AIDING_DATA),)
-    LOCAL_CFLAGS += -DGPS_HAL_USES_UINT32_AIDING_DATA
-endif
-
 include $(BUILD_SHARED_LIBRARY)
+
+
+
+# Host build of the wrapper, so it can be loaded and exercised off-device. The
+# module to be wrapped is looked for in the library search path, although a
+# different one can be set at runtime with the GPS_FP1_WRAPPED_MODULE_PATH
+# environment variable (for example, a module that replays recorded data).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := gps.c
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/../../include \
+    hardware/libhardware/include
+
+LOCAL_STATIC_LIBRARIES := libboottrace_fp1 libcutils liblog
+
+LOCAL_LDLIBS := -ldl -lpthread
+
+LOCAL_MODULE := gps.fp1
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += $(GPS_FP1_CFLAGS)
+LOCAL_CFLAGS += -DGPS_WRAPPER_HOST_BUILD
+LOCAL_CFLAGS += -DWRAPPED_MODULE_PATH=\"gps.default.so\"
+LOCAL_CFLAGS += -DASSISTANCE_CACHE_PATH=\"gps_fp1_assistance\"
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+
+
+# Stand-in for the proprietary MediaTek GPS HAL module in host builds, which
+# replays recorded location, SV status and NMEA through the MediaTek
+# GpsCallbacks (see replay.c). It is built as gps.default, so it is the module
+# wrapped by default by the host build of the wrapper.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := replay.c
+
+LOCAL_C_INCLUDES := hardware/libhardware/include
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE := gps.default
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += $(GPS_FP1_CFLAGS)
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+
+
+# Latency benchmark of the host build of the wrapper (see bench.c).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := bench.c
+
+LOCAL_C_INCLUDES := hardware/libhardware/include
+
+LOCAL_LDLIBS := -ldl -lpthread
+
+LOCAL_MODULE := gps.fp1-bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/gps.h>
+
+#include "gps_replay.h"
+#include "mediatek_gps.h"
+
+/**
+ * Benchmark of the gps.fp1 wrapper.
+ *
+ * Loads the host build of the wrapper, which in turn loads the replay module
+ * (see replay.c) as the wrapped module, and measures the latency of
+ * gps_interface_init, gps_interface_delete_aiding_data and, through the replay
+ * extension, sv_status_callback. The SV status are replayed from a synthetic
+ * recording with the given number of SVs, as fast as possible.
+ *
+ * The latency includes the time spent in the callbacks of this client, which
+ * do nothing, so it is just the overhead of the wrapper (and of the replay
+ * module, for gps_interface_init and gps_interface_delete_aiding_data). For
+ * each call the p50, p99 and max latency are reported, together with the
+ * throughput, computed from the total time spent in the call.
+ *
+ * The selection of the SVs and the conversion of the SV status, which the host
+ * build of the wrapper exports, are also timed alone with the number of SVs
+ * given with "-c". They take less than a microsecond, so each latency is the
+ * average of a batch of SV_STATUS_BATCH calls, which spreads the cost of
+ * reading the clock; the calls of a batch cycle through SV_STATUS_VARIANTS SV
+ * status with different SNRs.
+ *
+ * Finally, it checks that the wrapper does not inject its cached assistance
+ * data over the data injected by the framework (see check_assistance_cache);
+ * the bench fails if it does.
+ *
+ * Usage: gps.fp1-bench [-w WRAPPER] [-n ITERATIONS] [-s SVS]... [-c SVS]...
+ */
+#define DEFAULT_WRAPPER_PATH "gps.fp1.so"
+#define DEFAULT_ITERATIONS 10000
+
+#define SV_STATUS_BATCH 16
+#define SV_STATUS_VARIANTS 16
+
+static const int default_svs[] = { 24, 48, 256 };
+static const int default_conversion_svs[] = { 33, 64, 256 };
+
+typedef void (*sv_status_select_function)(const struct mediatek_gps_sv_status* mediatek_sv_status, int num_svs, uint8_t* selected_indexes, int num_selected);
+typedef void (*convert_sv_status_function)(const struct mediatek_gps_sv_status* mediatek_sv_status, GpsSvStatus* standard_sv_status);
+
+static int64_t get_monotonic_time_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static GpsUtcTime get_utc_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (GpsUtcTime) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int64_t get_elapsed_realtime_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void location_callback(GpsLocation* location) {
+}
+
+static void status_callback(GpsStatus* status) {
+}
+
+static void sv_status_callback(GpsSvStatus* sv_status) {
+}
+
+static void nmea_callback(GpsUtcTime timestamp, const char* nmea, int length) {
+}
+
+static void set_capabilities_callback(uint32_t capabilities) {
+}
+
+static void acquire_wakelock_callback() {
+}
+
+static void release_wakelock_callback() {
+}
+
+static void request_utc_time_callback() {
+}
+
+struct thread_start {
+    void (*start)(void*);
+    void* arg;
+};
+
+static void* thread_main(void* arg) {
+    struct thread_start thread_start = *(struct thread_start*) arg;
+    free(arg);
+
+    thread_start.start(thread_start.arg);
+
+    return NULL;
+}
+
+static pthread_t create_thread_callback(const char* name, void (*start)(void*), void* arg) {
+    struct thread_start* thread_start = malloc(sizeof(struct thread_start));
+    if (!thread_start) {
+        return 0;
+    }
+
+    thread_start->start = start;
+    thread_start->arg = arg;
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    int result = pthread_create(&thread, &attributes, &thread_main, thread_start);
+
+    pthread_attr_destroy(&attributes);
+
+    if (result != 0) {
+        free(thread_start);
+
+        return 0;
+    }
+
+    return thread;
+}
+
+static GpsCallbacks callbacks = {
+    .size = sizeof(GpsCallbacks),
+    .location_cb = &location_callback,
+    .status_cb = &status_callback,
+    .sv_status_cb = &sv_status_callback,
+    .nmea_cb = &nmea_callback,
+    .set_capabilities_cb = &set_capabilities_callback,
+    .acquire_wakelock_cb = &acquire_wakelock_callback,
+    .release_wakelock_cb = &release_wakelock_callback,
+    .create_thread_cb = &create_thread_callback,
+    .request_utc_time_cb = &request_utc_time_callback,
+};
+
+static int compare_latencies(const void* a, const void* b) {
+    uint32_t latency_a = *(const uint32_t*) a;
+    uint32_t latency_b = *(const uint32_t*) b;
+
+    return latency_a < latency_b ? -1 : latency_a > latency_b;
+}
+
+/**
+ * Prints the p50, p99 and max of the given latencies (which are sorted in
+ * place) and the throughput, that is, the calls per second that could be done
+ * if the calls were done one after the other.
+ */
+static void print_results(const char* name, uint32_t* latencies_ns, int count) {
+    if (!count) {
+        printf("%-40s no calls\n", name);
+
+        return;
+    }
+
+    int64_t total_ns = 0;
+
+    int i;
+    for (i = 0; i < count; i++) {
+        total_ns += latencies_ns[i];
+    }
+
+    qsort(latencies_ns, count, sizeof(uint32_t), &compare_latencies);
+
+    printf("%-40s %8d %10u %10u %10u %12.0f\n", name, count,
+           latencies_ns[(count - 1) * 50 / 100], latencies_ns[(count - 1) * 99 / 100],
+           latencies_ns[count - 1], count * 1e9 / (total_ns ? total_ns : 1));
+}
+
+static int bench_init(const GpsInterface* gps_interface, uint32_t* latencies_ns, int iterations) {
+    int i;
+    for (i = 0; i < iterations; i++) {
+        int64_t call_start_time_ns = get_monotonic_time_ns();
+        int result = gps_interface->init(&callbacks);
+        latencies_ns[i] = (uint32_t) (get_monotonic_time_ns() - call_start_time_ns);
+
+        if (result != 0) {
+            fprintf(stderr, "init failed: %d\n", result);
+
+            return -1;
+        }
+
+        gps_interface->cleanup();
+    }
+
+    print_results("gps_interface_init", latencies_ns, iterations);
+
+    return 0;
+}
+
+static void bench_delete_aiding_data(const GpsInterface* gps_interface, uint32_t* latencies_ns, int iterations) {
+    int i;
+    for (i = 0; i < iterations; i++) {
+        int64_t call_start_time_ns = get_monotonic_time_ns();
+        gps_interface->delete_aiding_data(GPS_DELETE_ALL);
+        latencies_ns[i] = (uint32_t) (get_monotonic_time_ns() - call_start_time_ns);
+    }
+
+    print_results("gps_interface_delete_aiding_data", latencies_ns, iterations);
+}
+
+/**
+ * Writes a recording with the given number of SV status, each one with the
+ * given number of SVs; a third of the SVs are used in the fix, and the SNRs
+ * are spread so the selection of the SVs has to look at all of them.
+ */
+static int write_sv_status_recording(const char* path, int num_svs, int count) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        fprintf(file, "S %d", i);
+
+        int j;
+        for (j = 0; j < num_svs; j++) {
+            int prn = j + 1;
+            fprintf(file, " %d,%d.5,%d,%d,%s", prn, (prn * 37 + i) % 50, (prn * 13) % 90, (prn * 71) % 360,
+                    prn % 3 == 0 ? "eau" : "ea");
+        }
+
+        fprintf(file, "\n");
+    }
+
+    return fclose(file);
+}
+
+static int bench_sv_status(const GpsReplayInterface* replay_interface, uint32_t* latencies_ns, int iterations, int num_svs) {
+    char path[] = "/tmp/gps.fp1-bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create recording: %s\n", strerror(errno));
+
+        return -1;
+    }
+    close(fd);
+
+    if (write_sv_status_recording(path, num_svs, iterations) != 0) {
+        fprintf(stderr, "Could not write recording: %s\n", strerror(errno));
+
+        unlink(path);
+
+        return -1;
+    }
+
+    int replayed = replay_interface->replay(path, 0);
+
+    unlink(path);
+
+    if (replayed < 0) {
+        fprintf(stderr, "Could not replay recording: %d\n", replayed);
+
+        return -1;
+    }
+
+    int count = replay_interface->get_latencies(GPS_REPLAY_CALLBACK_SV_STATUS, latencies_ns, iterations);
+
+    char name[64];
+    snprintf(name, sizeof(name), "sv_status_callback (%d SVs)", num_svs);
+    print_results(name, latencies_ns, count);
+
+    return 0;
+}
+
+/**
+ * Fills the given MediaTek SV status with the given number of SVs, like the
+ * SV status with the given index in the recording written by
+ * write_sv_status_recording.
+ */
+static void fill_mediatek_sv_status(struct mediatek_gps_sv_status* sv_status, int num_svs, int index) {
+    memset(sv_status, 0, sizeof(*sv_status));
+
+    sv_status->size = sizeof(*sv_status);
+    sv_status->num_svs = num_svs;
+
+    int i;
+    for (i = 0; i < num_svs; i++) {
+        int prn = i + 1;
+        uint32_t bit = 1U << (i % 32);
+
+        GpsSvInfo* sv = &sv_status->sv_list[i];
+        sv->size = sizeof(GpsSvInfo);
+        sv->prn = prn;
+        sv->snr = (prn * 37 + index) % 50 + 0.5f;
+        sv->elevation = (prn * 13) % 90;
+        sv->azimuth = (prn * 71) % 360;
+
+        sv_status->ephemeris_mask[i / 32] |= bit;
+        sv_status->almanac_mask[i / 32] |= bit;
+        if (prn % 3 == 0) {
+            sv_status->used_in_fix_mask[i / 32] |= bit;
+        }
+    }
+}
+
+static int bench_sv_status_conversion(void* handle, uint32_t* latencies_ns, int iterations, int num_svs) {
+    sv_status_select_function sv_status_select = (sv_status_select_function) dlsym(handle, "gps_fp1_sv_status_select");
+    convert_sv_status_function convert_sv_status = (convert_sv_status_function) dlsym(handle, "gps_fp1_convert_sv_status");
+    if (!sv_status_select || !convert_sv_status) {
+        fprintf(stderr, "The wrapper does not export the SV status conversion (only host builds do)\n");
+
+        return -1;
+    }
+
+    struct mediatek_gps_sv_status* sv_statuses = malloc(SV_STATUS_VARIANTS * sizeof(struct mediatek_gps_sv_status));
+    if (!sv_statuses) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < SV_STATUS_VARIANTS; i++) {
+        fill_mediatek_sv_status(&sv_statuses[i], num_svs, i);
+    }
+
+    GpsSvStatus standard_sv_status;
+    char name[64];
+
+    for (i = 0; i < iterations; i++) {
+        int64_t batch_start_time_ns = get_monotonic_time_ns();
+
+        int j;
+        for (j = 0; j < SV_STATUS_BATCH; j++) {
+            convert_sv_status(&sv_statuses[j % SV_STATUS_VARIANTS], &standard_sv_status);
+        }
+
+        latencies_ns[i] = (uint32_t) ((get_monotonic_time_ns() - batch_start_time_ns) / SV_STATUS_BATCH);
+    }
+
+    snprintf(name, sizeof(name), "convert_sv_status (%d SVs)", num_svs);
+    print_results(name, latencies_ns, iterations);
+
+    // The SVs are selected only when there are more than fit in GpsSvStatus.
+    if (num_svs > GPS_MAX_SVS) {
+        uint8_t selected_indexes[GPS_MAX_SVS + 1];
+
+        for (i = 0; i < iterations; i++) {
+            int64_t batch_start_time_ns = get_monotonic_time_ns();
+
+            int j;
+            for (j = 0; j < SV_STATUS_BATCH; j++) {
+                sv_status_select(&sv_statuses[j % SV_STATUS_VARIANTS], num_svs, selected_indexes, GPS_MAX_SVS);
+            }
+
+            latencies_ns[i] = (uint32_t) ((get_monotonic_time_ns() - batch_start_time_ns) / SV_STATUS_BATCH);
+        }
+
+        snprintf(name, sizeof(name), "sv_status_select (%d SVs)", num_svs);
+        print_results(name, latencies_ns, iterations);
+    }
+
+    free(sv_statuses);
+
+    return 0;
+}
+
+/**
+ * Writes a recording with a single fix accurate enough to be stored in the
+ * assistance cache of the wrapper.
+ */
+static int write_location_recording(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+
+    fprintf(file, "L 0 43.3623 -8.4115 50 0 0 10\n");
+
+    return fclose(file);
+}
+
+/**
+ * Stores a fix and a time in the assistance cache of the wrapper, from a
+ * session of its own.
+ */
+static int seed_assistance_cache(const GpsInterface* gps_interface) {
+    char path[] = "/tmp/gps.fp1-bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create recording: %s\n", strerror(errno));
+
+        return -1;
+    }
+    close(fd);
+
+    if (write_location_recording(path) != 0) {
+        fprintf(stderr, "Could not write recording: %s\n", strerror(errno));
+
+        unlink(path);
+
+        return -1;
+    }
+
+    if (gps_interface->init(&callbacks) != 0) {
+        unlink(path);
+
+        return -1;
+    }
+
+    const GpsReplayInterface* replay_interface = gps_interface->get_extension(GPS_REPLAY_INTERFACE);
+    int replayed = replay_interface->replay(path, 0);
+
+    unlink(path);
+
+    if (replayed < 0) {
+        fprintf(stderr, "Could not replay recording: %d\n", replayed);
+
+        gps_interface->cleanup();
+
+        return -1;
+    }
+
+    gps_interface->inject_time(get_utc_time_ms(), get_elapsed_realtime_ms(), 100);
+
+    gps_interface->cleanup();
+
+    return 0;
+}
+
+/**
+ * Checks that, once the framework injected the time and the location, the
+ * wrapper does not inject its cached ones when started, even if the position
+ * or the time aiding data was deleted in between. If the wrapper was built
+ * without the assistance cache there is nothing cached to inject, so the check
+ * always passes.
+ *
+ * Returns 0 if the check passed, or -1 otherwise.
+ */
+static int check_assistance_cache(const GpsInterface* gps_interface, GpsAidingData deleted, const char* deleted_name) {
+    if (seed_assistance_cache(gps_interface) < 0) {
+        return -1;
+    }
+
+    if (gps_interface->init(&callbacks) != 0) {
+        return -1;
+    }
+
+    const GpsReplayInterface* replay_interface = gps_interface->get_extension(GPS_REPLAY_INTERFACE);
+
+    gps_interface->inject_time(get_utc_time_ms(), get_elapsed_realtime_ms(), 100);
+    gps_interface->inject_location(43.3623, -8.4115, 20);
+    gps_interface->delete_aiding_data(deleted);
+    gps_interface->start();
+    gps_interface->stop();
+
+    int injected_times = replay_interface->get_injected_count(GPS_REPLAY_INJECTED_TIME);
+    int injected_locations = replay_interface->get_injected_count(GPS_REPLAY_INJECTED_LOCATION);
+
+    gps_interface->cleanup();
+
+    int passed = injected_times == 1 && injected_locations == 1;
+
+    printf("inject, delete_aiding_data(%s), start: %s (%d times and %d locations injected)\n",
+           deleted_name, passed ? "ok" : "FAILED", injected_times, injected_locations);
+
+    return passed ? 0 : -1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-w WRAPPER] [-n ITERATIONS] [-s SVS]... [-c SVS]...\n", name);
+}
+
+int main(int argc, char** argv) {
+    const char* wrapper_path = DEFAULT_WRAPPER_PATH;
+    int iterations = DEFAULT_ITERATIONS;
+    int svs[sizeof(default_svs) / sizeof(default_svs[0]) + 8];
+    int svs_count = 0;
+    int conversion_svs[sizeof(default_conversion_svs) / sizeof(default_conversion_svs[0]) + 8];
+    int conversion_svs_count = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "w:n:s:c:")) != -1) {
+        switch (option) {
+        case 'w':
+            wrapper_path = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 's':
+            if (svs_count == (int) (sizeof(svs) / sizeof(svs[0]))) {
+                usage(argv[0]);
+
+                return 1;
+            }
+            svs[svs_count++] = atoi(optarg);
+            break;
+        case 'c':
+            if (conversion_svs_count == (int) (sizeof(conversion_svs) / sizeof(conversion_svs[0]))) {
+                usage(argv[0]);
+
+                return 1;
+            }
+            conversion_svs[conversion_svs_count] = atoi(optarg);
+            if (conversion_svs[conversion_svs_count] < 1 || conversion_svs[conversion_svs_count] > MEDIATEK_GPS_MAX_SVS) {
+                fprintf(stderr, "The SVs to convert must be between 1 and %d\n", MEDIATEK_GPS_MAX_SVS);
+
+                return 1;
+            }
+            conversion_svs_count++;
+            break;
+        default:
+            usage(argv[0]);
+
+            return 1;
+        }
+    }
+
+    if (iterations < 1 || iterations > GPS_REPLAY_MAX_LATENCIES) {
+        fprintf(stderr, "The iterations must be between 1 and %d\n", GPS_REPLAY_MAX_LATENCIES);
+
+        return 1;
+    }
+
+    if (!svs_count) {
+        memcpy(svs, default_svs, sizeof(default_svs));
+        svs_count = sizeof(default_svs) / sizeof(default_svs[0]);
+    }
+
+    if (!conversion_svs_count) {
+        memcpy(conversion_svs, default_conversion_svs, sizeof(default_conversion_svs));
+        conversion_svs_count = sizeof(default_conversion_svs) / sizeof(default_conversion_svs[0]);
+    }
+
+    void* handle = dlopen(wrapper_path, RTLD_NOW);
+    if (!handle) {
+        fprintf(stderr, "Could not dlopen the wrapper: %s\n", dlerror());
+
+        return 1;
+    }
+
+    struct hw_module_t* module = (struct hw_module_t*) dlsym(handle, HAL_MODULE_INFO_SYM_AS_STR);
+    if (!module) {
+        fprintf(stderr, "Could not find the HAL module symbol in the wrapper: %s\n", dlerror());
+
+        return 1;
+    }
+
+    struct gps_device_t* device;
+    int result = module->methods->open(module, GPS_HARDWARE_MODULE_ID, (struct hw_device_t**) &device);
+    if (result != 0) {
+        fprintf(stderr, "Could not open the wrapper: %d\n", result);
+
+        return 1;
+    }
+
+    const GpsInterface* gps_interface = device->get_gps_interface(device);
+
+    uint32_t* latencies_ns = malloc(iterations * sizeof(uint32_t));
+    if (!latencies_ns) {
+        return 1;
+    }
+
+    printf("%-40s %8s %10s %10s %10s %12s\n", "call", "count", "p50 (ns)", "p99 (ns)", "max (ns)", "calls/s");
+
+    if (bench_init(gps_interface, latencies_ns, iterations) < 0) {
+        return 1;
+    }
+
+    if (gps_interface->init(&callbacks) != 0) {
+        return 1;
+    }
+
+    bench_delete_aiding_data(gps_interface, latencies_ns, iterations);
+
+    const GpsReplayInterface* replay_interface = gps_interface->get_extension(GPS_REPLAY_INTERFACE);
+    if (!replay_interface) {
+        fprintf(stderr, "The wrapped module is not the replay module\n");
+
+        return 1;
+    }
+
+    gps_interface->start();
+
+    int i;
+    for (i = 0; i < svs_count; i++) {
+        if (bench_sv_status(replay_interface, latencies_ns, iterations, svs[i]) < 0) {
+            return 1;
+        }
+    }
+
+    gps_interface->stop();
+    gps_interface->cleanup();
+
+    for (i = 0; i < conversion_svs_count; i++) {
+        if (bench_sv_status_conversion(handle, latencies_ns, iterations, conversion_svs[i]) < 0) {
+            return 1;
+        }
+    }
+
+    if (check_assistance_cache(gps_interface, GPS_DELETE_POSITION, "GPS_DELETE_POSITION") < 0 ||
+            check_assistance_cache(gps_interface, GPS_DELETE_TIME, "GPS_DELETE_TIME") < 0) {
+        return 1;
+    }
+
+    device->common.close(&device->common);
+
+    free(latencies_ns);
+
+    return 0;
+}
@@ -19,10 +19,25 @@
 
 #include <dlfcn.h>
 #include <errno.h>
-
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
 #include <cutils/log.h>
 
 #include <hardware/gps.h>
+#include <hardware/gps_fp1.h>
+
+#include <boottrace_fp1.h>
+
+#include "mediatek_gps.h"
 
 /**
  * Wrapper for proprietary MediaTek GPS HAL module.
@@ -53,14 +68,13 @@
  * as a parameter) or in a variable internal to this module (when the functions
  * do not receive the data structure that they belong to as a parameter).
  *
- * Due to that later case, it is a must that just a single GpsInterface and a
- * single set of GpsCallbacks are used at a time. If several GpsInterfaces were
- * got or a GpsInterface was inited with different GpsCallbacks and the old ones
- * were used along with the latest ones this GPS HAL module wrapper would fail.
- * However, as the GPS HAL module API does not make possible to know from which
- * GPS device is a GpsInterface got or in which GpsInterface are the callbacks
- * inited, it is assumed that a single GpsInterface and a single set of
- * GpsCallbacks will be used at a time.
+ * Due to that later case, just a single GpsInterface is used at a time; if the
+ * GpsInterface is got again the same one is returned. On the other hand, as the
+ * GPS HAL module API does not make possible to know in which GpsInterface are
+ * the callbacks inited, the GpsCallbacks passed to the init function of the
+ * GpsInterface are always those of the primary client. Other clients can set
+ * their own GpsCallbacks through the GPS_FP1_CLIENTS_INTERFACE extension, and
+ * all of them share the same session of the wrapped module.
  *
  * In any case, all the definitions are based on
  * "hardware/libhardware/include/hardware/gps.h" from AOSP 4.2, commit
@@ -72,301 +86,2558 @@
  * as it was changed from uint16_t to uint32_t in CyanogenMod 11.0).
  */
 
-#define MEDIATEK_GPS_MAX_SVS 256
-#define MEDIATEK_GPS_MASK_COUNT (MEDIATEK_GPS_MAX_SVS / 32)
+static int64_t get_monotonic_time_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t get_monotonic_time_ms() {
+    return get_monotonic_time_us() / 1000;
+}
 
 /**
- * MediaTek SV status.
+ * Clients of the wrapper.
  *
- * The standard GpsSvStatus supports up to GPS_MAX_SVS (32) SVs, while the
- * MediaTek GpsSvStatus version seems to support up to 256.
+ * The parameters passed to the GpsCallbacks functions do not include the
+ * GpsCallbacks structure that they belong to. Therefore, when the callbacks are
+ * set it is necessary to keep a pointer to the wrapped GpsCallbacks in order to
+ * call them from the wrappers.
  *
- * As the standard GpsSvStatus has 32 SVs, all the SVs fit in uint32 masks.
- * However, with the increased amount of SVs in the MediaTek version, each mask
- * needs now 256 bits, so arrays of eight uint32 are used instead.
+ * The GpsCallbacks set through the init function of the GpsInterface belong to
+ * the primary client, while additional clients are added through the
+ * GPS_FP1_CLIENTS_INTERFACE extension. The location, status, SV status and NMEA
+ * reported by the wrapped module are dispatched to every client interested in
+ * them (provided that, if the client limited their rate, enough time has passed
+ * since the last one passed to it). The rest of callbacks are passed only to
+ * the primary client.
  *
- * Note, however, that nothing guarantees that this layout is indeed the layout
- * used in the proprietary MediaTek GPS HAL module. It is just hypothetical
- * (although it seems to work).
+ * The callbacks are called with the read lock held, so the clients can not be
+ * modified from them. The rate limit fields are modified with just the read lock
+ * held, but each kind of event is reported always from the same thread of the
+ * wrapped module, so there are no concurrent modifications of the same field.
  */
-struct mediatek_gps_sv_status {
-    size_t      size;
-    int         num_svs;
-    GpsSvInfo   sv_list[MEDIATEK_GPS_MAX_SVS];
-    uint32_t    ephemeris_mask[MEDIATEK_GPS_MASK_COUNT];
-    uint32_t    almanac_mask[MEDIATEK_GPS_MASK_COUNT];
-    uint32_t    used_in_fix_mask[MEDIATEK_GPS_MASK_COUNT];
+#define CLIENT_RATE_LIMIT_SLACK_MS 100
+
+struct gps_client {
+    GpsCallbacks* callbacks;
+    GpsFp1ClientOptions options;
+    int started;
+
+    int64_t last_location_time_ms;
+    int64_t last_sv_status_time_ms;
 };
 
+static pthread_rwlock_t clients_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct gps_client clients[GPS_FP1_MAX_CLIENTS];
+
+static int client_wants_event(const struct gps_client* client, uint32_t event) {
+    return client->callbacks && client->started && (client->options.events & event);
+}
+
+static int client_rate_limit_passed(int64_t* last_time_ms, uint32_t min_interval_ms, int64_t now_ms) {
+    if (min_interval_ms && now_ms - *last_time_ms + CLIENT_RATE_LIMIT_SLACK_MS < min_interval_ms) {
+        return 0;
+    }
+
+    *last_time_ms = now_ms;
+
+    return 1;
+}
+
 /**
- * The parameters passed to the GpsCallbacks functions do not include the
- * GpsCallbacks structure that they belong to. Therefore, when the callbacks are
- * set it is necessary to keep a pointer to the wrapped GpsCallbacks in order to
- * call them from the wrappers.
+ * Adds the given location to the batch of the given client, if batching (see
+ * "Location batching extension" below).
  *
- * Note that, due to this, if several different callbacks were set this GPS HAL
- * module wrapper would fail if the old callbacks were used again.
+ * Returns 1 if the location was batched, or 0 if it should be passed to the
+ * client.
  */
-static GpsCallbacks* current_wrapped_gps_callbacks = 0;
+static int location_batch_add(int client_id, const GpsLocation* location);
 
-static void sv_status_callback(struct mediatek_gps_sv_status* mediatek_sv_status) {
-    ALOGV("Calling sv_status_callback wrapper");
+static void clients_report_location(GpsLocation* location) {
+    int64_t now_ms = get_monotonic_time_ms();
 
-    // The GpsSvStatus is not expected to be used outside the wrapped callback,
-    // so just create it in the stack.
-    GpsSvStatus standard_sv_status;
-    standard_sv_status.size = sizeof(GpsSvStatus);
-    standard_sv_status.num_svs = mediatek_sv_status->num_svs;
-    memcpy(standard_sv_status.sv_list, mediatek_sv_status->sv_list, sizeof(standard_sv_status.sv_list));
-    standard_sv_status.ephemeris_mask = mediatek_sv_status->ephemeris_mask[0];
-    standard_sv_status.almanac_mask = mediatek_sv_status->almanac_mask[0];
-    standard_sv_status.used_in_fix_mask = mediatek_sv_status->used_in_fix_mask[0];
+    pthread_rwlock_rdlock(&clients_lock);
+
+    int i;
+    for (i = 0; i < GPS_FP1_MAX_CLIENTS; i++) {
+        struct gps_client* client = &clients[i];
+        if (client_wants_event(client, GPS_FP1_CLIENT_EVENT_LOCATION) &&
+                client_rate_limit_passed(&client->last_location_time_ms, client->options.location_min_interval_ms, now_ms) &&
+                !location_batch_add(i, location)) {
+            client->callbacks->location_cb(location);
+        }
+    }
 
-    current_wrapped_gps_callbacks->sv_status_cb(&standard_sv_status);
+    pthread_rwlock_unlock(&clients_lock);
 }
 
-static void unknown_padding_callback_stub(uint32_t capabilities) {
-    ALOGW("TODO: stub for unknown_padding_callback; ensure that this is the expected callback and disable it in gps_interface_init or fix the mediatek_gps_callbacks");
+static void clients_report_status(GpsStatus* status) {
+    pthread_rwlock_rdlock(&clients_lock);
+
+    int i;
+    for (i = 0; i < GPS_FP1_MAX_CLIENTS; i++) {
+        struct gps_client* client = &clients[i];
+        if (client->callbacks && (client->options.events & GPS_FP1_CLIENT_EVENT_STATUS)) {
+            client->callbacks->status_cb(status);
+        }
+    }
+
+    pthread_rwlock_unlock(&clients_lock);
 }
 
-static void set_capabilities_callback_stub(uint32_t capabilities) {
-    ALOGW("TODO: stub for set_capabilities_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+static void clients_report_sv_status(GpsSvStatus* sv_status) {
+    int64_t now_ms = get_monotonic_time_ms();
+
+    pthread_rwlock_rdlock(&clients_lock);
+
+    int i;
+    for (i = 0; i < GPS_FP1_MAX_CLIENTS; i++) {
+        struct gps_client* client = &clients[i];
+        if (client_wants_event(client, GPS_FP1_CLIENT_EVENT_SV_STATUS) &&
+                client_rate_limit_passed(&client->last_sv_status_time_ms, client->options.sv_status_min_interval_ms, now_ms)) {
+            client->callbacks->sv_status_cb(sv_status);
+        }
+    }
+
+    pthread_rwlock_unlock(&clients_lock);
 }
 
-static void acquire_wakelock_callback_stub() {
-    ALOGW("TODO: stub for acquire_wakelock_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+/**
+ * Passes the NMEA to the clients from first_client (included) to end_client
+ * (excluded) interested in it.
+ */
+static void clients_report_nmea(int first_client, int end_client, GpsUtcTime timestamp, const char* nmea, int length) {
+    pthread_rwlock_rdlock(&clients_lock);
+
+    int i;
+    for (i = first_client; i < end_client; i++) {
+        struct gps_client* client = &clients[i];
+        if (client_wants_event(client, GPS_FP1_CLIENT_EVENT_NMEA)) {
+            client->callbacks->nmea_cb(timestamp, nmea, length);
+        }
+    }
+
+    pthread_rwlock_unlock(&clients_lock);
 }
 
-static void release_wakelock_callback_stub() {
-    ALOGW("TODO: stub for release_wakelock_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+static GpsCallbacks* get_primary_client_callbacks() {
+    pthread_rwlock_rdlock(&clients_lock);
+    GpsCallbacks* callbacks = clients[GPS_FP1_PRIMARY_CLIENT].callbacks;
+    pthread_rwlock_unlock(&clients_lock);
+
+    return callbacks;
+}
+
+static void status_callback(GpsStatus* status) {
+    ALOGV("Calling status_callback wrapper");
+
+    clients_report_status(status);
 }
 
 /**
- * MediaTek GPS callback.
- *
- * The create_thread callback in the MediaTek GpsCallback version is at the
- * same location as the request_utc_time callback in the standard version. The
- * nmea callback and those preceding it are at the same location in both
- * versions. Therefore, there is an unknown callback between them. However, the
- * exact location is also unknown, as the set_capabilities, acquire_wakelock and
- * release_wakelock do not seem to be ever called, so they can not be used as a
- * reference.
+ * Threads must be created with the create_thread callback of the primary
+ * client, as it is expected to be the Android framework and the threads need to
+ * be attached to the Java VM to be able to call the primary client callbacks.
  */
-static struct mediatek_gps_callbacks {
-    size_t      size;
-    gps_location_callback location_cb;
-    gps_status_callback status_cb;
-    void (*sv_status_cb)(struct mediatek_gps_sv_status* mediatek_sv_status);
-    gps_nmea_callback nmea_cb;
-    void (*unknown_padding_cb)();
-    gps_set_capabilities set_capabilities_cb;
-    gps_acquire_wakelock acquire_wakelock_cb;
-    gps_release_wakelock release_wakelock_cb;
-    gps_create_thread create_thread_cb;
-    gps_request_utc_time request_utc_time_cb;
-} current_mediatek_gps_callbacks;
-
-struct mediatek_gps_interface {
-    size_t size;
-    int (*init)(struct mediatek_gps_callbacks* callbacks);
-    int (*start)(void);
-    int (*stop)(void);
-    void (*cleanup)(void);
-    int (*inject_time)(GpsUtcTime time, int64_t timeReference, int uncertainty);
-    int (*inject_location)(double latitude, double longitude, float accuracy);
-#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
-    void (*delete_aiding_data)(uint16_t flags);
-#else
-    void (*delete_aiding_data)(GpsAidingData flags);
-#endif
-    int (*set_position_mode)(GpsPositionMode mode, GpsPositionRecurrence recurrence,
-         uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time);
-    const void* (*get_extension)(const char* name);
-};
+static pthread_t create_thread_callback(const char* name, void (*start)(void*), void* arg) {
+    GpsCallbacks* callbacks = get_primary_client_callbacks();
+    if (!callbacks || !callbacks->create_thread_cb) {
+        ALOGE("Can not create thread '%s'; no create_thread callback", name);
 
-struct gps_interface_wrapper {
-    GpsInterface gps_interface;
+        return 0;
+    }
 
-    const struct mediatek_gps_interface* wrapped_gps_interface;
-};
+    return callbacks->create_thread_cb(name, start, arg);
+}
+
+static void request_utc_time_callback() {
+    ALOGV("Calling request_utc_time_callback wrapper");
+
+    GpsCallbacks* callbacks = get_primary_client_callbacks();
+    if (callbacks && callbacks->request_utc_time_cb) {
+        callbacks->request_utc_time_cb();
+    }
+}
 
 /**
- * The parameters passed to the GpsInterface functions do not include the
- * GpsInterface structure that they belong to. Therefore, when the interface is
- * got it is necessary to keep a pointer to the wrapped GpsInterface in order to
- * call the functions in the wrapped one from the wrappers.
+ * SV selection.
+ *
+ * The MediaTek SV status can have up to 256 SVs, but the standard one only 32,
+ * so when more SVs are reported the most relevant ones are selected: first
+ * those used in the fix and then those with the highest SNR (in 1 dB steps;
+ * SVs with the same SNR are selected in the order that they were reported).
+ * The selected SVs keep the order that they were reported in.
+ *
+ * The selection is done without sorting. In a single pass the rank of each SV
+ * (the used flag and the integer part of the SNR) is computed and counted in a
+ * histogram of the ranks. Then the lowest rank that has to be selected is
+ * found walking down the histogram from the highest rank, which stops as soon
+ * as enough SVs were counted (typically after a few ranks, as the SVs used in
+ * the fix have the highest ones). Finally, the indexes of the selected SVs are
+ * compacted. Except for the walk, there are no data dependent branches.
+ *
+ * The ranks and the histogram take less than 1 KiB of stack. The cost is
+ * linear in the number of SVs, and it is dominated by the pass that computes
+ * the ranks, as each SV has to be looked up in the used in fix mask. In the
+ * benchmark of the wrapper (see bench.c), which times the selection alone, its
+ * p50 (p99) on the build host is about 0.3 (0.5) microseconds with 33 SVs,
+ * 0.5 (0.8) with 64 SVs and 1.5 (2.3) with 256 SVs; the whole conversion
+ * takes less than 0.1 microseconds more.
  *
- * Note that, due to this, if several different GpsInterfaces were got this GPS
- * HAL module wrapper would fail if the old GpsInterfaces were used again.
+ * Like in the standard masks, the bit N-1 in the MediaTek masks corresponds to
+ * the SV with PRN N. Therefore, the standard masks are the first word of the
+ * MediaTek masks, but only with the bits of the selected SVs, as SVs with a
+ * PRN higher than 32 can not be represented in them.
  */
-static struct gps_interface_wrapper* current_gps_interface_wrapper = 0;
+#define SV_RANK_USED_IN_FIX 0x80
+#define SV_RANK_MAX_SNR 0x7E
+#define SV_RANK_COUNT 0x100
 
-static int gps_interface_init(GpsCallbacks* callbacks) {
-    ALOGV("Initing wrapped GPS interface");
+static int sv_status_get_used_in_fix(const struct mediatek_gps_sv_status* mediatek_sv_status, int prn) {
+    uint32_t index = (uint32_t) (prn - 1);
+    uint32_t valid = index < MEDIATEK_GPS_MAX_SVS;
+    index &= MEDIATEK_GPS_MAX_SVS - 1;
 
-    if (current_wrapped_gps_callbacks) {
-        ALOGW("gps_interface_init called again; old current_wrapped_gps_callbacks is now invalid!");
-    }
-    current_wrapped_gps_callbacks = callbacks;
+    return valid & (mediatek_sv_status->used_in_fix_mask[index >> 5] >> (index & 31));
+}
 
-    current_mediatek_gps_callbacks.size = sizeof(current_mediatek_gps_callbacks);
-    current_mediatek_gps_callbacks.location_cb = callbacks->location_cb;
-    current_mediatek_gps_callbacks.status_cb = callbacks->status_cb;
+static int sv_status_get_rank(const struct mediatek_gps_sv_status* mediatek_sv_status, const GpsSvInfo* sv) {
+    int snr = (int) sv->snr;
+    snr = snr < 0 ? 0 : snr;
+    snr = snr > SV_RANK_MAX_SNR ? SV_RANK_MAX_SNR : snr;
 
-    current_mediatek_gps_callbacks.sv_status_cb = &sv_status_callback;
+    // The lowest rank of a valid SV is 1.
+    return (sv_status_get_used_in_fix(mediatek_sv_status, sv->prn) ? SV_RANK_USED_IN_FIX : 0) | (snr + 1);
+}
 
-    current_mediatek_gps_callbacks.nmea_cb = callbacks->nmea_cb;
+/**
+ * Stores in selected_indexes the indexes of the num_selected SVs to be passed in
+ * the standard SV status; num_selected must be less than num_svs, and
+ * selected_indexes must have room for num_selected + 1 indexes.
+ */
+static void sv_status_select(const struct mediatek_gps_sv_status* mediatek_sv_status, int num_svs, uint8_t* selected_indexes, int num_selected) {
+    uint8_t ranks[MEDIATEK_GPS_MAX_SVS];
+    uint16_t histogram[SV_RANK_COUNT];
 
-    // These callbacks are not guaranteed to be in the right order in the
-    // MediaTek GpsCallbacks, so for the time being just log that they were
-    // called to try to figure that right order.
-    current_mediatek_gps_callbacks.unknown_padding_cb = &unknown_padding_callback_stub;
-    current_mediatek_gps_callbacks.set_capabilities_cb = &set_capabilities_callback_stub;
-    current_mediatek_gps_callbacks.acquire_wakelock_cb = &acquire_wakelock_callback_stub;
-    current_mediatek_gps_callbacks.release_wakelock_cb = &release_wakelock_callback_stub;
+    memset(histogram, 0, sizeof(histogram));
+
+    int i;
+    for (i = 0; i < num_svs; i++) {
+        int rank = sv_status_get_rank(mediatek_sv_status, &mediatek_sv_status->sv_list[i]);
+
+        ranks[i] = (uint8_t) rank;
+        histogram[rank]++;
+    }
 
-    current_mediatek_gps_callbacks.create_thread_cb = callbacks->create_thread_cb;
-    current_mediatek_gps_callbacks.request_utc_time_cb = callbacks->request_utc_time_cb;
+    // Find the highest rank with at least num_selected SVs at or above it,
+    // which is the lowest rank that has to be selected. As num_selected is
+    // less than num_svs, and the lowest rank of a valid SV is 1, the walk
+    // always stops before reaching rank 0.
+    int lowest_rank = SV_RANK_COUNT - 1;
+    int count_above = 0;
+    while (count_above + histogram[lowest_rank] < num_selected) {
+        count_above += histogram[lowest_rank];
+        lowest_rank--;
+    }
+
+    // All the SVs above the lowest rank are selected, but only some of those
+    // with the lowest rank may be.
+    int remaining = num_selected - count_above;
 
-    return current_gps_interface_wrapper->wrapped_gps_interface->init(&current_mediatek_gps_callbacks);
+    int count = 0;
+    for (i = 0; i < num_svs; i++) {
+        int selected_tied = (ranks[i] == lowest_rank) & (remaining > 0);
+        remaining -= selected_tied;
+
+        // The index is always written, but only kept if selected; once
+        // num_selected SVs were selected the rest are written in the extra
+        // room at the end.
+        selected_indexes[count] = (uint8_t) i;
+        count += (ranks[i] > lowest_rank) | selected_tied;
+    }
 }
 
-#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
-static void gps_interface_delete_aiding_data(GpsAidingData flags) {
-    ALOGV("Deleting wrapped aiding data");
+static void convert_sv_status(const struct mediatek_gps_sv_status* mediatek_sv_status, GpsSvStatus* standard_sv_status) {
+    int num_svs = mediatek_sv_status->num_svs;
+    num_svs = num_svs < 0 ? 0 : num_svs;
+    num_svs = num_svs > MEDIATEK_GPS_MAX_SVS ? MEDIATEK_GPS_MAX_SVS : num_svs;
 
-    // GpsAidingData was changed from uint16_t to uint32_t in CyanogenMod 11.0
-    // to add room for extra flags. All the original flags in the lower bits
-    // have the same values, except for GPS_DELETE_CELLDB_INFO, which changed
-    // from 0x8000 to 0x0800.
-    uint16_t flags_uint16 = (uint16_t) (flags & 0x000007FF);
-    if (flags & 0x00000800) {
-        flags_uint16 |= 0x8000;
+    standard_sv_status->size = sizeof(GpsSvStatus);
+
+    if (num_svs <= GPS_MAX_SVS) {
+        standard_sv_status->num_svs = num_svs;
+        memcpy(standard_sv_status->sv_list, mediatek_sv_status->sv_list, num_svs * sizeof(GpsSvInfo));
+    } else {
+        uint8_t selected_indexes[GPS_MAX_SVS + 1];
+        sv_status_select(mediatek_sv_status, num_svs, selected_indexes, GPS_MAX_SVS);
+
+        int i;
+        for (i = 0; i < GPS_MAX_SVS; i++) {
+            standard_sv_status->sv_list[i] = mediatek_sv_status->sv_list[selected_indexes[i]];
+        }
+
+        standard_sv_status->num_svs = GPS_MAX_SVS;
     }
-    if (flags == 0xFFFFFFFF) {
-        flags_uint16 = 0xFFFF;
+
+    uint32_t selected_mask = 0;
+
+    int i;
+    for (i = 0; i < standard_sv_status->num_svs; i++) {
+        uint32_t index = (uint32_t) (standard_sv_status->sv_list[i].prn - 1);
+        selected_mask |= (index < 32 ? 1U : 0U) << (index & 31);
     }
 
-    current_gps_interface_wrapper->wrapped_gps_interface->delete_aiding_data(flags_uint16);
+    standard_sv_status->ephemeris_mask = mediatek_sv_status->ephemeris_mask[0] & selected_mask;
+    standard_sv_status->almanac_mask = mediatek_sv_status->almanac_mask[0] & selected_mask;
+    standard_sv_status->used_in_fix_mask = mediatek_sv_status->used_in_fix_mask[0] & selected_mask;
+}
+
+#ifdef GPS_WRAPPER_HOST_BUILD
+/**
+ * The selection and the conversion of the SVs are exported in host builds, so
+ * the benchmark (see bench.c) can time them without the rest of
+ * sv_status_callback.
+ */
+void gps_fp1_sv_status_select(const struct mediatek_gps_sv_status* mediatek_sv_status, int num_svs, uint8_t* selected_indexes, int num_selected) {
+    sv_status_select(mediatek_sv_status, num_svs, selected_indexes, num_selected);
+}
+
+void gps_fp1_convert_sv_status(const struct mediatek_gps_sv_status* mediatek_sv_status, GpsSvStatus* standard_sv_status) {
+    convert_sv_status(mediatek_sv_status, standard_sv_status);
 }
 #endif
 
-struct mediatek_gps_device_t {
-    struct hw_device_t common;
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+/**
+ * Asynchronous SV status delivery.
+ *
+ * By default the SV status is converted and passed to the client in the same
+ * thread in which the wrapped module called sv_status_callback, so a client
+ * that takes a long time to handle it stalls the MediaTek GPS engine.
+ *
+ * When GPS_WRAPPER_ASYNC_SV_STATUS is defined the converted SV status is
+ * instead stored in a ring buffer and passed to the client from a dispatcher
+ * thread created with the create_thread callback of the client. The ring buffer
+ * has a single producer (the thread of the wrapped module that calls
+ * sv_status_callback) and a single consumer (the dispatcher thread), so no
+ * locks are needed.
+ *
+ * The producer never waits for the consumer; if the consumer does not keep up
+ * the oldest SV status are overwritten. The consumer notices it and counts
+ * them as overruns; as SV status are just snapshots only the latest ones are
+ * interesting anyway.
+ *
+ * To detect if a slot was overwritten while it was being read each slot has a
+ * sequence number, which is odd while the producer is writing to the slot and
+ * 2 * (index + 1) once written, being index the position of the SV status in
+ * the whole stream of SV status written to the ring.
+ */
+#define SV_STATUS_RING_SIZE 8
+#define SV_STATUS_RING_MASK (SV_STATUS_RING_SIZE - 1)
 
-    const struct mediatek_gps_interface* (*get_gps_interface)(struct mediatek_gps_device_t* dev);
+struct sv_status_ring_slot {
+    volatile int32_t sequence;
+    GpsSvStatus sv_status;
 };
 
-struct gps_device_wrapper {
-    struct gps_device_t device;
+static struct sv_status_ring {
+    struct sv_status_ring_slot slots[SV_STATUS_RING_SIZE];
 
-    struct mediatek_gps_device_t* wrapped_device;
-};
+    // Number of SV status written to the ring; only modified by the producer.
+    volatile int32_t head;
+    // Number of SV status read from the ring; only used by the consumer.
+    uint32_t tail;
 
-static const GpsInterface* gps_device_get_gps_interface(struct gps_device_t* device) {
-    ALOGV("Getting GPS interface wrapper");
+    volatile int32_t dispatched;
+    volatile int32_t overruns;
 
-    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*) device;
+    volatile int32_t running;
+    sem_t pending;
+    sem_t stopped;
+} sv_status_ring;
 
-    const struct mediatek_gps_interface* wrapped_gps_interface = wrapper->wrapped_device->get_gps_interface(wrapper->wrapped_device);
+static void sv_status_ring_push(const struct mediatek_gps_sv_status* mediatek_sv_status) {
+    uint32_t head = (uint32_t) sv_status_ring.head;
+    struct sv_status_ring_slot* slot = &sv_status_ring.slots[head & SV_STATUS_RING_MASK];
 
-    struct gps_interface_wrapper* interface_wrapper = malloc(sizeof(struct gps_interface_wrapper));
-    memset(interface_wrapper, 0, sizeof(struct gps_interface_wrapper));
+    slot->sequence = (int32_t) (2 * head + 1);
+    android_memory_barrier();
 
-    // Only the init and (optionally) the delete_aiding_data functions have to
-    // be overriden in the GPS interface.
-    interface_wrapper->gps_interface.size = sizeof(struct mediatek_gps_interface);
-    interface_wrapper->gps_interface.init = &gps_interface_init;
-    interface_wrapper->gps_interface.start = wrapped_gps_interface->start;
-    interface_wrapper->gps_interface.stop = wrapped_gps_interface->stop;
-    interface_wrapper->gps_interface.cleanup = wrapped_gps_interface->cleanup;
-    interface_wrapper->gps_interface.inject_time = wrapped_gps_interface->inject_time;
-    interface_wrapper->gps_interface.inject_location = wrapped_gps_interface->inject_location;
-#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
-    interface_wrapper->gps_interface.delete_aiding_data = &gps_interface_delete_aiding_data;
-#else
-    interface_wrapper->gps_interface.delete_aiding_data = wrapped_gps_interface->delete_aiding_data;
-#endif
-    interface_wrapper->gps_interface.set_position_mode = wrapped_gps_interface->set_position_mode;
-    interface_wrapper->gps_interface.get_extension = wrapped_gps_interface->get_extension;
-    interface_wrapper->wrapped_gps_interface = wrapped_gps_interface;
+    convert_sv_status(mediatek_sv_status, &slot->sv_status);
+
+    android_atomic_release_store((int32_t) (2 * head + 2), &slot->sequence);
+    android_atomic_release_store((int32_t) (head + 1), &sv_status_ring.head);
+
+    sem_post(&sv_status_ring.pending);
+}
+
+/**
+ * Copies the next SV status in the ring to the given GpsSvStatus.
+ *
+ * Returns 1 if the SV status was copied, or 0 if it was overwritten by the
+ * producer before it could be copied.
+ */
+static int sv_status_ring_pop(GpsSvStatus* sv_status) {
+    uint32_t tail = sv_status_ring.tail;
+    struct sv_status_ring_slot* slot = &sv_status_ring.slots[tail & SV_STATUS_RING_MASK];
+    int32_t expected_sequence = (int32_t) (2 * tail + 2);
 
-    if (current_gps_interface_wrapper) {
-        ALOGW("get_gps_interface called again; old current_gps_interface_wrapper is now invalid!");
+    sv_status_ring.tail++;
 
-        free(current_gps_interface_wrapper);
+    if (android_atomic_acquire_load(&slot->sequence) != expected_sequence) {
+        return 0;
     }
-    current_gps_interface_wrapper = interface_wrapper;
 
-    return (GpsInterface*) current_gps_interface_wrapper;
+    memcpy(sv_status, &slot->sv_status, sizeof(GpsSvStatus));
+    android_memory_barrier();
+
+    return slot->sequence == expected_sequence;
 }
 
-static int gps_device_close(struct hw_device_t* device) {
-    ALOGV("Closing GPS device wrapper");
+static void sv_status_dispatcher_thread(void* arg) {
+    ALOGV("SV status dispatcher thread started");
 
-    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*)device;
+    GpsSvStatus sv_status;
 
-    int result = wrapper->wrapped_device->common.close(&wrapper->wrapped_device->common);
+    while (1) {
+        if (sem_wait(&sv_status_ring.pending) < 0) {
+            continue;
+        }
 
-    free(device);
+        if (!android_atomic_acquire_load(&sv_status_ring.running)) {
+            break;
+        }
 
-    return result;
+        uint32_t head = (uint32_t) android_atomic_acquire_load(&sv_status_ring.head);
+
+        // Skip directly the SV status that have been overwritten already.
+        if (head - sv_status_ring.tail > SV_STATUS_RING_SIZE) {
+            android_atomic_add((int32_t) (head - sv_status_ring.tail - SV_STATUS_RING_SIZE), &sv_status_ring.overruns);
+            sv_status_ring.tail = head - SV_STATUS_RING_SIZE;
+        }
+
+        while (sv_status_ring.tail != head) {
+            if (!sv_status_ring_pop(&sv_status)) {
+                android_atomic_inc(&sv_status_ring.overruns);
+
+                continue;
+            }
+
+            clients_report_sv_status(&sv_status);
+
+            android_atomic_inc(&sv_status_ring.dispatched);
+        }
+    }
+
+    ALOGV("SV status dispatcher thread finished");
+
+    sem_post(&sv_status_ring.stopped);
 }
 
-static int gps_module_open(const struct hw_module_t* module, const char* name, struct hw_device_t** device) {
-    ALOGI("Opening MediaTek GPS wrapper HAL module for '%s'", WRAPPED_MODULE_PATH);
+static void sv_status_dispatcher_start() {
+    if (sv_status_ring.running) {
+        return;
+    }
 
-    void* wrapped_module_handle = dlopen(WRAPPED_MODULE_PATH, RTLD_NOW);
-    if (!wrapped_module_handle) {
-        ALOGE("Could not dlopen the wrapped MediaTek GPS module: %s", dlerror());
+    memset(sv_status_ring.slots, 0, sizeof(sv_status_ring.slots));
+    sv_status_ring.head = 0;
+    sv_status_ring.tail = 0;
+    sv_status_ring.dispatched = 0;
+    sv_status_ring.overruns = 0;
+    sem_init(&sv_status_ring.pending, 0, 0);
+    sem_init(&sv_status_ring.stopped, 0, 0);
 
-        return -EINVAL;
+    android_atomic_release_store(1, &sv_status_ring.running);
+
+    if (!create_thread_callback("gps.fp1 sv_status", &sv_status_dispatcher_thread, NULL)) {
+        ALOGE("Could not create SV status dispatcher thread; SV status will be delivered synchronously");
+
+        android_atomic_release_store(0, &sv_status_ring.running);
+
+        sem_destroy(&sv_status_ring.pending);
+        sem_destroy(&sv_status_ring.stopped);
     }
+}
 
-    // Reset errors before calling dlsym for proper error checking.
-    dlerror();
+static void sv_status_dispatcher_stop() {
+    if (!sv_status_ring.running) {
+        return;
+    }
 
-    struct hw_module_t* wrapped_module = (struct hw_module_t*) dlsym(wrapped_module_handle, HAL_MODULE_INFO_SYM_AS_STR);
+    android_atomic_release_store(0, &sv_status_ring.running);
+    sem_post(&sv_status_ring.pending);
 
-    const char* dlsym_error = dlerror();
-    if (dlsym_error) {
-        ALOGE("Could not find the HAL module symbol in the wrapped MediaTek GPS module: %s", dlsym_error);
+    // The thread created by the client may not be joinable, so just wait for
+    // it to notify that it finished.
+    while (sem_wait(&sv_status_ring.stopped) < 0 && errno == EINTR) {
+    }
 
-        return -EINVAL;
+    sem_destroy(&sv_status_ring.pending);
+    sem_destroy(&sv_status_ring.stopped);
+
+    ALOGI("SV status dispatcher stopped; %d SV status dispatched, %d overruns", sv_status_ring.dispatched, sv_status_ring.overruns);
+}
+#endif
+
+/**
+ * Full SV status extension.
+ *
+ * The standard GpsSvStatus can only hold the first 32 SVs reported by the
+ * MediaTek GPS engine. The GPS_FP1_SV_STATUS_INTERFACE extension provides
+ * clients with all of them, without having to copy them again for each client,
+ * through a double buffer (see GpsFp1SvStatusBuffer) in shared memory.
+ *
+ * The buffer is created the first time that it is requested by a client, and
+ * from then on it is updated each time that sv_status_callback is called.
+ */
+static pthread_mutex_t sv_status_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sv_status_buffer_fd = -1;
+static GpsFp1SvStatusBuffer* volatile sv_status_buffer = 0;
+
+static int sv_status_buffer_create() {
+    int fd = ashmem_create_region("gps.fp1 sv status", sizeof(GpsFp1SvStatusBuffer));
+    if (fd < 0) {
+        ALOGE("Could not create shared memory for the full SV status: %s", strerror(errno));
+
+        return -1;
     }
 
-    if (strcmp(wrapped_module->id, GPS_HARDWARE_MODULE_ID) != 0) {
-        ALOGE("Invalid wrapped MediaTek GPS module; expected id is '%s', but '%s' was found", GPS_HARDWARE_MODULE_ID, wrapped_module->id);
+    GpsFp1SvStatusBuffer* buffer = mmap(NULL, sizeof(GpsFp1SvStatusBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        ALOGE("Could not map shared memory for the full SV status: %s", strerror(errno));
 
-        dlclose(wrapped_module_handle);
+        close(fd);
 
-        return -EINVAL;
+        return -1;
     }
 
-    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*) malloc(sizeof(struct gps_device_wrapper));
-    memset(wrapper, 0, sizeof(struct gps_device_wrapper));
+    // Further mappings, like those done by other processes, are read only.
+    if (ashmem_set_prot_region(fd, PROT_READ) < 0) {
+        ALOGW("Could not make shared memory for the full SV status read only: %s", strerror(errno));
+    }
 
-    wrapper->device.common.tag = HARDWARE_DEVICE_TAG;
-    wrapper->device.common.version = HARDWARE_DEVICE_API_VERSION(1, 0);
-    wrapper->device.common.module = (struct hw_module_t*) module;
-    wrapper->device.common.close = &gps_device_close;
-    wrapper->device.get_gps_interface = &gps_device_get_gps_interface;
+    memset(buffer, 0, sizeof(GpsFp1SvStatusBuffer));
+    buffer->size = sizeof(GpsFp1SvStatusBuffer);
 
-    struct mediatek_gps_device_t* wrapped_device;
-    int wrapped_status = wrapped_module->methods->open(wrapped_module, name, (struct hw_device_t**) &wrapped_device);
-    if (wrapped_status != 0) {
-        ALOGE("Failed to open wrapped device: %d", wrapped_status);
+    sv_status_buffer_fd = fd;
 
-        free(wrapper);
+    // Ensure that the buffer is fully initialized before it is seen by
+    // sv_status_callback.
+    android_memory_barrier();
+    sv_status_buffer = buffer;
 
-        dlclose(wrapped_module_handle);
+    return 0;
+}
 
-        return wrapped_status;
+static const GpsFp1SvStatusBuffer* sv_status_interface_get_buffer() {
+    pthread_mutex_lock(&sv_status_buffer_mutex);
+
+    if (!sv_status_buffer) {
+        sv_status_buffer_create();
     }
 
-    wrapper->wrapped_device = wrapped_device;
+    pthread_mutex_unlock(&sv_status_buffer_mutex);
 
-    *device = (struct hw_device_t*) wrapper;
+    return sv_status_buffer;
+}
+
+static int sv_status_interface_get_buffer_fd() {
+    if (!sv_status_interface_get_buffer()) {
+        return -1;
+    }
+
+    return sv_status_buffer_fd;
+}
+
+static const GpsFp1SvStatusInterface sv_status_interface = {
+    .size = sizeof(GpsFp1SvStatusInterface),
+    .get_buffer = &sv_status_interface_get_buffer,
+    .get_buffer_fd = &sv_status_interface_get_buffer_fd,
+};
+
+static void sv_status_buffer_write(GpsFp1SvStatusBuffer* buffer, const struct mediatek_gps_sv_status* mediatek_sv_status) {
+    int32_t sequence = buffer->sequence + 1;
+    if (sequence == 0) {
+        sequence = 1;
+    }
+
+    android_atomic_release_store(sequence, &buffer->writing_sequence);
+    android_memory_barrier();
+
+    GpsFp1SvStatus* sv_status = &buffer->sv_status[sequence & 1];
+    sv_status->size = sizeof(GpsFp1SvStatus);
+    sv_status->num_svs = mediatek_sv_status->num_svs;
+    memcpy(sv_status->sv_list, mediatek_sv_status->sv_list, sizeof(sv_status->sv_list));
+    memcpy(sv_status->ephemeris_mask, mediatek_sv_status->ephemeris_mask, sizeof(sv_status->ephemeris_mask));
+    memcpy(sv_status->almanac_mask, mediatek_sv_status->almanac_mask, sizeof(sv_status->almanac_mask));
+    memcpy(sv_status->used_in_fix_mask, mediatek_sv_status->used_in_fix_mask, sizeof(sv_status->used_in_fix_mask));
+
+    android_atomic_release_store(sequence, &buffer->sequence);
+}
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+/**
+ * NMEA coalescing.
+ *
+ * The MediaTek GPS engine reports each NMEA sentence in its own call to the
+ * nmea callback, so there are dozens of calls to the client for each fix epoch.
+ *
+ * When GPS_WRAPPER_NMEA_COALESCING is defined the sentences are instead
+ * accumulated in a buffer and passed to the additional clients all at once in a
+ * single call to their nmea callback, one sentence after the other (each one
+ * terminated by "\r\n"), with the timestamp of the first sentence.
+ *
+ * The primary client still gets each sentence in its own call. It is expected
+ * to be the Android framework, whose GpsLocationProvider reads the NMEA data of
+ * each call in a buffer of just 120 bytes, so several sentences would be
+ * truncated there.
+ *
+ * The buffer is flushed when the location of the fix epoch is reported (that
+ * is, when location_callback is called), when NMEA_EPOCH_GAP_MS pass after the
+ * last sentence without a new one (which happens when there is no fix and thus
+ * no location is reported), when the next sentence does not fit in the buffer
+ * and when the GPS is stopped or cleaned up.
+ *
+ * The flush after NMEA_EPOCH_GAP_MS is done by a flusher thread created with
+ * the create_thread callback of the primary client, so the last sentences of an epoch
+ * without fix are not kept until the next epoch. The thread sleeps until it
+ * is notified that the buffer is no longer empty, and then until
+ * NMEA_EPOCH_GAP_MS pass after the last sentence. If the thread can not be
+ * created the buffer is flushed only when the next sentence arrives.
+ */
+#define NMEA_BUFFER_SIZE 4096
+#define NMEA_EPOCH_GAP_MS 250
+
+static struct nmea_coalescer {
+    pthread_mutex_t mutex;
+
+    char buffer[NMEA_BUFFER_SIZE];
+    int length;
+    int sentences;
+    GpsUtcTime timestamp;
+    int64_t last_sentence_time_ms;
+
+    uint32_t total_sentences;
+    uint32_t total_flushes;
+
+    volatile int32_t flusher_running;
+    sem_t flusher_pending;
+    sem_t flusher_stopped;
+} nmea_coalescer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void nmea_coalescer_flush_locked() {
+    if (!nmea_coalescer.sentences) {
+        return;
+    }
+
+    clients_report_nmea(GPS_FP1_PRIMARY_CLIENT + 1, GPS_FP1_MAX_CLIENTS, nmea_coalescer.timestamp, nmea_coalescer.buffer, nmea_coalescer.length);
+
+    nmea_coalescer.total_flushes++;
+    nmea_coalescer.length = 0;
+    nmea_coalescer.sentences = 0;
+}
+
+static void nmea_coalescer_flush() {
+    pthread_mutex_lock(&nmea_coalescer.mutex);
+    nmea_coalescer_flush_locked();
+    pthread_mutex_unlock(&nmea_coalescer.mutex);
+}
+
+static void nmea_coalescer_flusher_thread(void* arg) {
+    ALOGV("NMEA flusher thread started");
+
+    while (1) {
+        if (sem_wait(&nmea_coalescer.flusher_pending) < 0) {
+            continue;
+        }
+
+        if (!android_atomic_acquire_load(&nmea_coalescer.flusher_running)) {
+            break;
+        }
+
+        while (android_atomic_acquire_load(&nmea_coalescer.flusher_running)) {
+            pthread_mutex_lock(&nmea_coalescer.mutex);
+
+            int64_t remaining_ms = nmea_coalescer.last_sentence_time_ms + NMEA_EPOCH_GAP_MS - get_monotonic_time_ms();
+            if (nmea_coalescer.sentences && remaining_ms <= 0) {
+                nmea_coalescer_flush_locked();
+            }
+
+            int sentences = nmea_coalescer.sentences;
+
+            pthread_mutex_unlock(&nmea_coalescer.mutex);
+
+            // Wait for the next sentence once the buffer is empty.
+            if (!sentences) {
+                break;
+            }
+
+            usleep((useconds_t) remaining_ms * 1000);
+        }
+    }
+
+    ALOGV("NMEA flusher thread finished");
+
+    sem_post(&nmea_coalescer.flusher_stopped);
+}
+
+static void nmea_coalescer_flusher_start() {
+    if (nmea_coalescer.flusher_running) {
+        return;
+    }
+
+    sem_init(&nmea_coalescer.flusher_pending, 0, 0);
+    sem_init(&nmea_coalescer.flusher_stopped, 0, 0);
+
+    android_atomic_release_store(1, &nmea_coalescer.flusher_running);
+
+    if (!create_thread_callback("gps.fp1 nmea", &nmea_coalescer_flusher_thread, NULL)) {
+        ALOGW("Could not create NMEA flusher thread; NMEA will be flushed only when the next sentence arrives");
+
+        android_atomic_release_store(0, &nmea_coalescer.flusher_running);
+
+        sem_destroy(&nmea_coalescer.flusher_pending);
+        sem_destroy(&nmea_coalescer.flusher_stopped);
+    }
+}
+
+static void nmea_coalescer_flusher_stop() {
+    if (!nmea_coalescer.flusher_running) {
+        return;
+    }
+
+    android_atomic_release_store(0, &nmea_coalescer.flusher_running);
+    sem_post(&nmea_coalescer.flusher_pending);
+
+    // The thread created by the client may not be joinable, so just wait for
+    // it to notify that it finished.
+    while (sem_wait(&nmea_coalescer.flusher_stopped) < 0 && errno == EINTR) {
+    }
+
+    sem_destroy(&nmea_coalescer.flusher_pending);
+    sem_destroy(&nmea_coalescer.flusher_stopped);
+}
+
+static void nmea_coalescer_log_statistics() {
+    pthread_mutex_lock(&nmea_coalescer.mutex);
+
+    ALOGI("NMEA coalescing: %u sentences reported to the additional clients in %u callbacks (%u callbacks saved)",
+          nmea_coalescer.total_sentences, nmea_coalescer.total_flushes,
+          nmea_coalescer.total_sentences - nmea_coalescer.total_flushes);
+
+    pthread_mutex_unlock(&nmea_coalescer.mutex);
+}
+
+static void nmea_coalescer_add(GpsUtcTime timestamp, const char* nmea, int length) {
+    // Ignore the null terminator, if included in the length.
+    while (length > 0 && nmea[length - 1] == '\0') {
+        length--;
+    }
+
+    int needs_line_terminator = (length == 0 || nmea[length - 1] != '\n');
+    int needed_length = length + (needs_line_terminator ? 2 : 0);
+
+    pthread_mutex_lock(&nmea_coalescer.mutex);
+
+    int64_t now_ms = get_monotonic_time_ms();
+    if (nmea_coalescer.sentences && now_ms - nmea_coalescer.last_sentence_time_ms > NMEA_EPOCH_GAP_MS) {
+        nmea_coalescer_flush_locked();
+    }
+    nmea_coalescer.last_sentence_time_ms = now_ms;
+
+    nmea_coalescer.total_sentences++;
+
+    // One byte is reserved for the null terminator.
+    if (nmea_coalescer.length + needed_length >= NMEA_BUFFER_SIZE) {
+        nmea_coalescer_flush_locked();
+    }
+
+    if (needed_length >= NMEA_BUFFER_SIZE) {
+        ALOGW("NMEA sentence too long to be coalesced (%d bytes)", length);
+
+        clients_report_nmea(GPS_FP1_PRIMARY_CLIENT + 1, GPS_FP1_MAX_CLIENTS, timestamp, nmea, length);
+        nmea_coalescer.total_flushes++;
+
+        pthread_mutex_unlock(&nmea_coalescer.mutex);
+
+        return;
+    }
+
+    int first_sentence = !nmea_coalescer.sentences;
+    if (first_sentence) {
+        nmea_coalescer.timestamp = timestamp;
+    }
+
+    char* end = nmea_coalescer.buffer + nmea_coalescer.length;
+    memcpy(end, nmea, length);
+    end += length;
+    if (needs_line_terminator) {
+        *end++ = '\r';
+        *end++ = '\n';
+    }
+    *end = '\0';
+
+    nmea_coalescer.length += needed_length;
+    nmea_coalescer.sentences++;
+
+    pthread_mutex_unlock(&nmea_coalescer.mutex);
+
+    if (first_sentence && android_atomic_acquire_load(&nmea_coalescer.flusher_running)) {
+        sem_post(&nmea_coalescer.flusher_pending);
+    }
+}
+
+#endif
+
+/**
+ * Statistics.
+ *
+ * The latency of the entry points of the wrapped module and of the callbacks
+ * from it (including the time spent in the clients) is recorded in histograms,
+ * together with the time to first fix of each session and the stalls, that is,
+ * the fixes that arrive more than STATS_STALL_MIN_MS (or STATS_STALL_INTERVALS
+ * times the fix interval, if longer) after the previous one.
+ *
+ * The statistics are recorded with atomic operations and no locks, so they do
+ * not block the threads of the wrapped module. They are provided through the
+ * GPS_FP1_STATS_INTERFACE extension and logged every STATS_DUMP_INTERVAL_MS
+ * while the GPS is started and when it is stopped.
+ *
+ * Times are kept as the lower 32 bits of the monotonic time in milliseconds;
+ * the intervals are computed with unsigned arithmetic, so they are right as
+ * long as they are shorter than 49 days.
+ */
+#define STATS_STALL_MIN_MS 5000
+#define STATS_STALL_INTERVALS 3
+#define STATS_DUMP_INTERVAL_MS 60000
+
+struct stats_histogram {
+    volatile int32_t count;
+    volatile int32_t max;
+    volatile int32_t buckets[GPS_FP1_STATS_HISTOGRAM_BUCKETS];
+};
+
+struct stats_counters {
+    struct stats_histogram calls[GPS_FP1_STATS_CALL_COUNT];
+    struct stats_histogram ttff;
+    volatile int32_t last_ttff_ms;
+    volatile int32_t sessions;
+    volatile int32_t fixes;
+    volatile int32_t stalls;
+    volatile int32_t max_fix_gap_ms;
+    volatile int32_t nmea_sentences;
+};
+
+static struct stats {
+    struct stats_counters counters;
+
+    // The session state is not cleared when the statistics are reset.
+    volatile int32_t fix_interval_ms;
+    volatile int32_t awaiting_first_fix;
+    volatile int32_t session_start_time_ms;
+    volatile int32_t last_fix_time_ms;
+    volatile int32_t last_dump_time_ms;
+} stats = {
+    .counters.last_ttff_ms = -1,
+};
+
+static const char* const stats_call_names[GPS_FP1_STATS_CALL_COUNT] = {
+    "start",
+    "stop",
+    "inject_time",
+    "inject_location",
+    "set_position_mode",
+    "location_cb",
+    "sv_status_cb",
+    "nmea_cb",
+};
+
+static void stats_update_max(volatile int32_t* max, uint32_t value) {
+    int32_t current;
+    do {
+        current = android_atomic_acquire_load(max);
+        if ((uint32_t) current >= value) {
+            return;
+        }
+    } while (android_atomic_release_cas(current, (int32_t) value, max));
+}
+
+static void stats_histogram_record(struct stats_histogram* histogram, uint32_t value) {
+    int bucket = value ? 32 - __builtin_clz(value) : 0;
+    if (bucket >= GPS_FP1_STATS_HISTOGRAM_BUCKETS) {
+        bucket = GPS_FP1_STATS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    android_atomic_inc(&histogram->buckets[bucket]);
+    android_atomic_inc(&histogram->count);
+    stats_update_max(&histogram->max, value);
+}
+
+static void stats_histogram_copy(const struct stats_histogram* histogram, GpsFp1StatsHistogram* copy) {
+    copy->count = (uint32_t) histogram->count;
+    copy->max = (uint32_t) histogram->max;
+
+    int i;
+    for (i = 0; i < GPS_FP1_STATS_HISTOGRAM_BUCKETS; i++) {
+        copy->buckets[i] = (uint32_t) histogram->buckets[i];
+    }
+}
+
+static void stats_record_call(int call, int64_t start_time_us) {
+    int64_t latency_us = get_monotonic_time_us() - start_time_us;
+
+    stats_histogram_record(&stats.counters.calls[call], latency_us < UINT32_MAX ? (uint32_t) latency_us : UINT32_MAX);
+}
+
+static void stats_record_fix() {
+    int32_t now_ms = (int32_t) get_monotonic_time_ms();
+
+    android_atomic_inc(&stats.counters.fixes);
+
+    if (android_atomic_acquire_cas(1, 0, &stats.awaiting_first_fix) == 0) {
+        uint32_t ttff_ms = (uint32_t) (now_ms - stats.session_start_time_ms);
+
+        stats_histogram_record(&stats.counters.ttff, ttff_ms);
+        android_atomic_release_store((int32_t) ttff_ms, &stats.counters.last_ttff_ms);
+
+        ALOGI("Time to first fix: %u ms", ttff_ms);
+
+        BOOTTRACE_INSTANT("gps first fix");
+    } else {
+        uint32_t gap_ms = (uint32_t) (now_ms - stats.last_fix_time_ms);
+
+        stats_update_max(&stats.counters.max_fix_gap_ms, gap_ms);
+
+        uint32_t stall_threshold_ms = STATS_STALL_INTERVALS * (uint32_t) stats.fix_interval_ms;
+        if (stall_threshold_ms < STATS_STALL_MIN_MS) {
+            stall_threshold_ms = STATS_STALL_MIN_MS;
+        }
+
+        if (gap_ms > stall_threshold_ms) {
+            android_atomic_inc(&stats.counters.stalls);
+
+            ALOGW("Fix stalled; %u ms since the previous fix", gap_ms);
+        }
+    }
+
+    stats.last_fix_time_ms = now_ms;
+}
+
+static void stats_interface_get_stats(GpsFp1Stats* snapshot) {
+    memset(snapshot, 0, sizeof(GpsFp1Stats));
+    snapshot->size = sizeof(GpsFp1Stats);
+
+    int i;
+    for (i = 0; i < GPS_FP1_STATS_CALL_COUNT; i++) {
+        stats_histogram_copy(&stats.counters.calls[i], &snapshot->calls[i]);
+    }
+    stats_histogram_copy(&stats.counters.ttff, &snapshot->ttff);
+
+    snapshot->last_ttff_ms = stats.counters.last_ttff_ms;
+    snapshot->sessions = (uint32_t) stats.counters.sessions;
+    snapshot->fixes = (uint32_t) stats.counters.fixes;
+    snapshot->stalls = (uint32_t) stats.counters.stalls;
+    snapshot->max_fix_gap_ms = (uint32_t) stats.counters.max_fix_gap_ms;
+    snapshot->nmea_sentences = (uint32_t) stats.counters.nmea_sentences;
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+    snapshot->sv_status_overruns = (uint32_t) sv_status_ring.overruns;
+#endif
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    pthread_mutex_lock(&nmea_coalescer.mutex);
+    snapshot->nmea_reports = nmea_coalescer.total_flushes;
+    pthread_mutex_unlock(&nmea_coalescer.mutex);
+#else
+    snapshot->nmea_reports = snapshot->nmea_sentences;
+#endif
+}
+
+static void stats_interface_reset() {
+    ALOGI("Resetting statistics");
+
+    memset((void*) &stats.counters, 0, sizeof(stats.counters));
+    android_atomic_release_store(-1, &stats.counters.last_ttff_ms);
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+    android_atomic_release_store(0, &sv_status_ring.dispatched);
+    android_atomic_release_store(0, &sv_status_ring.overruns);
+#endif
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    pthread_mutex_lock(&nmea_coalescer.mutex);
+    nmea_coalescer.total_sentences = 0;
+    nmea_coalescer.total_flushes = 0;
+    pthread_mutex_unlock(&nmea_coalescer.mutex);
+#endif
+}
+
+static const GpsFp1StatsInterface stats_interface = {
+    .size = sizeof(GpsFp1StatsInterface),
+    .get_stats = &stats_interface_get_stats,
+    .reset = &stats_interface_reset,
+};
+
+static void stats_dump() {
+    GpsFp1Stats snapshot;
+    stats_interface_get_stats(&snapshot);
+
+    ALOGI("Statistics: %u sessions, %u fixes, %u stalls (longest gap between fixes %u ms), %u SV status overruns, %u NMEA sentences in %u reports",
+          snapshot.sessions, snapshot.fixes, snapshot.stalls, snapshot.max_fix_gap_ms,
+          snapshot.sv_status_overruns, snapshot.nmea_sentences, snapshot.nmea_reports);
+
+    if (snapshot.ttff.count) {
+        ALOGI("Statistics: time to first fix %d ms in the latest session; median <= %u ms, max %u ms in %u sessions",
+              snapshot.last_ttff_ms, gps_fp1_stats_histogram_percentile(&snapshot.ttff, 50),
+              snapshot.ttff.max, snapshot.ttff.count);
+    }
+
+    int i;
+    for (i = 0; i < GPS_FP1_STATS_CALL_COUNT; i++) {
+        const GpsFp1StatsHistogram* histogram = &snapshot.calls[i];
+        if (!histogram->count) {
+            continue;
+        }
+
+        ALOGI("Statistics: %s called %u times; median <= %u us, 99th percentile <= %u us, max %u us",
+              stats_call_names[i], histogram->count,
+              gps_fp1_stats_histogram_percentile(histogram, 50),
+              gps_fp1_stats_histogram_percentile(histogram, 99), histogram->max);
+    }
+}
+
+/**
+ * Dumps the statistics if STATS_DUMP_INTERVAL_MS passed since the last time;
+ * called from the threads of the wrapped module, so only one of them dumps
+ * them even if called concurrently.
+ */
+static void stats_dump_if_due() {
+    int32_t now_ms = (int32_t) get_monotonic_time_ms();
+    int32_t last_dump_time_ms = android_atomic_acquire_load(&stats.last_dump_time_ms);
+
+    if ((uint32_t) (now_ms - last_dump_time_ms) < STATS_DUMP_INTERVAL_MS) {
+        return;
+    }
+
+    if (android_atomic_release_cas(last_dump_time_ms, now_ms, &stats.last_dump_time_ms) != 0) {
+        return;
+    }
+
+    stats_dump();
+}
+
+static void stats_session_started() {
+    int32_t now_ms = (int32_t) get_monotonic_time_ms();
+
+    android_atomic_inc(&stats.counters.sessions);
+
+    stats.session_start_time_ms = now_ms;
+    android_atomic_release_store(now_ms, &stats.last_dump_time_ms);
+    android_atomic_release_store(1, &stats.awaiting_first_fix);
+}
+
+static void stats_session_stopped() {
+    android_atomic_release_store(0, &stats.awaiting_first_fix);
+
+    stats_dump();
+}
+
+static void sv_status_callback(struct mediatek_gps_sv_status* mediatek_sv_status) {
+    ALOGV("Calling sv_status_callback wrapper");
+
+    int64_t start_time_us = get_monotonic_time_us();
+
+    GpsFp1SvStatusBuffer* buffer = sv_status_buffer;
+    if (buffer) {
+        sv_status_buffer_write(buffer, mediatek_sv_status);
+    }
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+    if (android_atomic_acquire_load(&sv_status_ring.running)) {
+        sv_status_ring_push(mediatek_sv_status);
+
+        stats_record_call(GPS_FP1_STATS_CALL_SV_STATUS_CB, start_time_us);
+        stats_dump_if_due();
+
+        return;
+    }
+#endif
+
+    // The GpsSvStatus is not expected to be used outside the wrapped callback,
+    // so just create it in the stack.
+    GpsSvStatus standard_sv_status;
+    convert_sv_status(mediatek_sv_status, &standard_sv_status);
+
+    clients_report_sv_status(&standard_sv_status);
+
+    stats_record_call(GPS_FP1_STATS_CALL_SV_STATUS_CB, start_time_us);
+
+    // The SV status is reported periodically even if there is no fix.
+    stats_dump_if_due();
+}
+
+static void nmea_callback(GpsUtcTime timestamp, const char* nmea, int length) {
+    ALOGV("Calling nmea_callback wrapper");
+
+    int64_t start_time_us = get_monotonic_time_us();
+
+    android_atomic_inc(&stats.counters.nmea_sentences);
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    clients_report_nmea(GPS_FP1_PRIMARY_CLIENT, GPS_FP1_PRIMARY_CLIENT + 1, timestamp, nmea, length);
+    nmea_coalescer_add(timestamp, nmea, length);
+#else
+    clients_report_nmea(GPS_FP1_PRIMARY_CLIENT, GPS_FP1_MAX_CLIENTS, timestamp, nmea, length);
+#endif
+
+    stats_record_call(GPS_FP1_STATS_CALL_NMEA_CB, start_time_us);
+}
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+/**
+ * Assistance cache.
+ *
+ * The MediaTek GPS engine forgets the time and the position injected by the
+ * framework when the device is rebooted, so the first start after a reboot has
+ * to acquire the SVs without any hint, even if the device was used a few
+ * minutes before.
+ *
+ * When GPS_WRAPPER_ASSISTANCE_CACHE is defined the last good fix and the last
+ * injected time are stored in ASSISTANCE_CACHE_PATH. When the wrapped module is
+ * started for the first time after being inited, they are injected again if
+ * they are fresh enough (unless the framework already injected a time or a
+ * location since it inited the wrapper, even if the aiding data was deleted
+ * afterwards). Deleting the position or the time aiding data invalidates the
+ * matching record.
+ *
+ * The file is memory mapped, so updating it is just a memory write and the
+ * kernel writes it back to the storage. Each record has a sequence number
+ * that is odd while the record is being written, so a record torn by a crash
+ * is ignored. The file starts with a magic number, a version and its size, and
+ * if any of them does not match the expected value the file is reset.
+ *
+ * The time reference of the injected time is the elapsed realtime, which does
+ * not survive a reboot, so the time is stored as the offset between the UTC
+ * time and the wall clock of the system, which is kept by the RTC. The
+ * uncertainty of the time grows ASSISTANCE_CLOCK_DRIFT_PPM with its age, and
+ * the accuracy of the location ASSISTANCE_LOCATION_SPEED_MPS. The ages are
+ * measured with the wall clock too; if it went back the records are not used.
+ */
+#ifndef ASSISTANCE_CACHE_PATH
+#define ASSISTANCE_CACHE_PATH "/data/misc/gps_fp1/assistance"
+#endif
+
+#define ASSISTANCE_CACHE_MAGIC 0x31504641
+#define ASSISTANCE_CACHE_VERSION 1
+
+#define ASSISTANCE_LOCATION_MAX_ACCURACY_M 100
+#define ASSISTANCE_LOCATION_MAX_AGE_MS (2 * 60 * 60 * 1000LL)
+#define ASSISTANCE_LOCATION_SPEED_MPS 10
+#define ASSISTANCE_TIME_MAX_AGE_MS (7 * 24 * 60 * 60 * 1000LL)
+#define ASSISTANCE_CLOCK_DRIFT_PPM 100
+
+#define ASSISTANCE_INJECTED_LOCATION 0x1
+#define ASSISTANCE_INJECTED_TIME 0x2
+
+struct assistance_location_record {
+    volatile int32_t sequence;
+    int32_t valid;
+    double latitude;
+    double longitude;
+    float accuracy;
+    int64_t wall_time_ms;
+};
+
+struct assistance_time_record {
+    volatile int32_t sequence;
+    int32_t valid;
+    int64_t utc_offset_ms;
+    int64_t wall_time_ms;
+    int32_t uncertainty_ms;
+};
+
+struct assistance_cache_file {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+
+    struct assistance_location_record location;
+    struct assistance_time_record time;
+};
+
+struct assistance_data {
+    int has_location;
+    double latitude;
+    double longitude;
+    float accuracy;
+
+    int has_time;
+    GpsUtcTime time;
+    int64_t time_reference;
+    int uncertainty;
+};
+
+static pthread_mutex_t assistance_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct assistance_cache_file* assistance_cache = 0;
+static int assistance_cache_injected = 0;
+
+static int64_t get_wall_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the same time as SystemClock.elapsedRealtime(), which is the time
+ * reference used by the framework when injecting the time.
+ */
+static int64_t get_elapsed_realtime_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void assistance_cache_record_begin(volatile int32_t* sequence) {
+    *sequence = *sequence | 1;
+    android_memory_barrier();
+}
+
+static void assistance_cache_record_end(volatile int32_t* sequence) {
+    android_memory_barrier();
+    *sequence = *sequence + 1;
+}
+
+/**
+ * Maps the cache file, if not mapped yet. Once mapped it is kept mapped for the
+ * lifetime of the wrapper.
+ */
+static void assistance_cache_open() {
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    if (assistance_cache) {
+        pthread_mutex_unlock(&assistance_cache_mutex);
+
+        return;
+    }
+
+    int fd = open(ASSISTANCE_CACHE_PATH, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        ALOGW("Could not open the assistance cache '%s': %s", ASSISTANCE_CACHE_PATH, strerror(errno));
+
+        pthread_mutex_unlock(&assistance_cache_mutex);
+
+        return;
+    }
+
+    void* address = MAP_FAILED;
+    if (ftruncate(fd, sizeof(struct assistance_cache_file)) == 0) {
+        address = mmap(NULL, sizeof(struct assistance_cache_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (address == MAP_FAILED) {
+        ALOGW("Could not map the assistance cache '%s': %s", ASSISTANCE_CACHE_PATH, strerror(errno));
+
+        close(fd);
+
+        pthread_mutex_unlock(&assistance_cache_mutex);
+
+        return;
+    }
+
+    // The mapping is kept even if the file descriptor is closed.
+    close(fd);
+
+    struct assistance_cache_file* cache = (struct assistance_cache_file*) address;
+    if (cache->magic != ASSISTANCE_CACHE_MAGIC ||
+            cache->version != ASSISTANCE_CACHE_VERSION ||
+            cache->size != sizeof(struct assistance_cache_file)) {
+        ALOGI("Resetting the assistance cache '%s'", ASSISTANCE_CACHE_PATH);
+
+        memset(cache, 0, sizeof(struct assistance_cache_file));
+        cache->magic = ASSISTANCE_CACHE_MAGIC;
+        cache->version = ASSISTANCE_CACHE_VERSION;
+        cache->size = sizeof(struct assistance_cache_file);
+    }
+
+    assistance_cache = cache;
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+static void assistance_cache_record_location(const GpsLocation* location) {
+    uint16_t needed_flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+    if ((location->flags & needed_flags) != needed_flags || location->accuracy > ASSISTANCE_LOCATION_MAX_ACCURACY_M) {
+        return;
+    }
+
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    if (assistance_cache) {
+        struct assistance_location_record* record = &assistance_cache->location;
+
+        assistance_cache_record_begin(&record->sequence);
+        record->valid = 1;
+        record->latitude = location->latitude;
+        record->longitude = location->longitude;
+        record->accuracy = location->accuracy;
+        record->wall_time_ms = get_wall_time_ms();
+        assistance_cache_record_end(&record->sequence);
+    }
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+static void assistance_cache_record_injected_location() {
+    pthread_mutex_lock(&assistance_cache_mutex);
+    assistance_cache_injected |= ASSISTANCE_INJECTED_LOCATION;
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+static void assistance_cache_record_injected_time(GpsUtcTime time, int64_t time_reference, int uncertainty) {
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    assistance_cache_injected |= ASSISTANCE_INJECTED_TIME;
+
+    if (assistance_cache) {
+        struct assistance_time_record* record = &assistance_cache->time;
+
+        int64_t wall_time_ms = get_wall_time_ms();
+        int64_t utc_time_ms = time + (get_elapsed_realtime_ms() - time_reference);
+
+        assistance_cache_record_begin(&record->sequence);
+        record->valid = 1;
+        record->utc_offset_ms = utc_time_ms - wall_time_ms;
+        record->wall_time_ms = wall_time_ms;
+        record->uncertainty_ms = uncertainty;
+        assistance_cache_record_end(&record->sequence);
+    }
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+/**
+ * Forgets the data injected by the framework, so the cached data is injected
+ * again. It must be called only when the framework starts a new session (that
+ * is, in gps_interface_init); the injected data is still the most recent one
+ * after the aiding data is deleted or the wrapped module is inited again for
+ * another client.
+ */
+static void assistance_cache_reset_injected() {
+    pthread_mutex_lock(&assistance_cache_mutex);
+    assistance_cache_injected = 0;
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+static void assistance_cache_invalidate(GpsAidingData flags) {
+    if (!(flags & (GPS_DELETE_POSITION | GPS_DELETE_TIME))) {
+        return;
+    }
+
+    // The aiding data could be deleted before the wrapped module is inited,
+    // and the records must not be injected later anyway.
+    assistance_cache_open();
+
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    if (assistance_cache && (flags & GPS_DELETE_POSITION)) {
+        ALOGI("Invalidating the location in the assistance cache");
+
+        assistance_cache_record_begin(&assistance_cache->location.sequence);
+        assistance_cache->location.valid = 0;
+        assistance_cache_record_end(&assistance_cache->location.sequence);
+    }
+
+    if (assistance_cache && (flags & GPS_DELETE_TIME)) {
+        ALOGI("Invalidating the time in the assistance cache");
+
+        assistance_cache_record_begin(&assistance_cache->time.sequence);
+        assistance_cache->time.valid = 0;
+        assistance_cache_record_end(&assistance_cache->time.sequence);
+    }
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+/**
+ * Gets the fresh data in the cache that was not injected by the framework since
+ * the last gps_interface_init.
+ */
+static void assistance_cache_get(struct assistance_data* data) {
+    memset(data, 0, sizeof(struct assistance_data));
+
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    if (!assistance_cache) {
+        pthread_mutex_unlock(&assistance_cache_mutex);
+
+        return;
+    }
+
+    int64_t wall_time_ms = get_wall_time_ms();
+
+    const struct assistance_location_record* location = &assistance_cache->location;
+    int64_t location_age_ms = wall_time_ms - location->wall_time_ms;
+    if (!(assistance_cache_injected & ASSISTANCE_INJECTED_LOCATION) &&
+            !(location->sequence & 1) && location->valid &&
+            location_age_ms >= 0 && location_age_ms < ASSISTANCE_LOCATION_MAX_AGE_MS) {
+        data->has_location = 1;
+        data->latitude = location->latitude;
+        data->longitude = location->longitude;
+        data->accuracy = location->accuracy + (float) (location_age_ms / 1000 * ASSISTANCE_LOCATION_SPEED_MPS);
+    }
+
+    const struct assistance_time_record* time = &assistance_cache->time;
+    int64_t time_age_ms = wall_time_ms - time->wall_time_ms;
+    if (!(assistance_cache_injected & ASSISTANCE_INJECTED_TIME) &&
+            !(time->sequence & 1) && time->valid &&
+            time_age_ms >= 0 && time_age_ms < ASSISTANCE_TIME_MAX_AGE_MS) {
+        data->has_time = 1;
+        data->time = wall_time_ms + time->utc_offset_ms;
+        data->time_reference = get_elapsed_realtime_ms();
+        data->uncertainty = time->uncertainty_ms + (int) (time_age_ms * ASSISTANCE_CLOCK_DRIFT_PPM / 1000000);
+    }
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+
+static void assistance_cache_sync() {
+    pthread_mutex_lock(&assistance_cache_mutex);
+
+    if (assistance_cache) {
+        msync(assistance_cache, sizeof(struct assistance_cache_file), MS_ASYNC);
+    }
+
+    pthread_mutex_unlock(&assistance_cache_mutex);
+}
+#endif
+
+/**
+ * Location batching extension.
+ *
+ * Each client has its own batch. While a client is batching, the locations
+ * passed to it (that is, those that passed its rate limit) are kept in a ring
+ * buffer instead of being passed to its location callback, and delivered in
+ * bulk when the batch is flushed or a threshold is reached; the rest of the
+ * clients keep receiving the locations as usual. The functions of the
+ * extension without a client identifier act on the batch of the primary
+ * client.
+ *
+ * The ring buffers are statically allocated with the maximum depth; the depth
+ * given in the batching options just limits how much of them is used. The
+ * locations are delivered with the mutex unlocked, so the client can call the
+ * batching interface from the location_batch callback.
+ */
+struct location_batch {
+    GpsFp1BatchingCallbacks* callbacks;
+    int batching;
+    GpsFp1BatchingOptions options;
+
+    GpsLocation locations[GPS_FP1_BATCHING_MAX_DEPTH];
+    // Index of the oldest location.
+    int first;
+    int count;
+    int discarded;
+};
+
+static pthread_mutex_t location_batches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct location_batch location_batches[GPS_FP1_MAX_CLIENTS];
+
+/**
+ * Locations taken from a batch to be delivered to the client.
+ *
+ * The locations are copied to a buffer allocated for each delivery, so the
+ * location_batch callback is called once the mutex has been unlocked.
+ */
+struct location_batch_delivery {
+    GpsFp1BatchingCallbacks* callbacks;
+    GpsLocation* locations;
+    int count;
+};
+
+static void location_batch_take_locked(struct location_batch* batch, struct location_batch_delivery* delivery) {
+    delivery->callbacks = batch->callbacks;
+    delivery->locations = NULL;
+    delivery->count = 0;
+
+    int count = batch->count;
+    if (!count || !batch->callbacks) {
+        return;
+    }
+
+    int first = batch->first;
+
+    batch->first = 0;
+    batch->count = 0;
+
+    GpsLocation* locations = malloc(count * sizeof(GpsLocation));
+    if (!locations) {
+        ALOGE("Could not allocate memory to deliver the batch; %d locations discarded", count);
+
+        batch->discarded += count;
+
+        return;
+    }
+
+    // The client expects the locations from the oldest to the newest in a
+    // single array, so if they wrap around the end of the ring buffer they are
+    // copied in two parts.
+    int depth = batch->options.depth;
+    int first_part_count = depth - first < count ? depth - first : count;
+
+    memcpy(locations, batch->locations + first, first_part_count * sizeof(GpsLocation));
+    memcpy(locations + first_part_count, batch->locations, (count - first_part_count) * sizeof(GpsLocation));
+
+    delivery->locations = locations;
+    delivery->count = count;
+}
+
+/**
+ * Passes the taken locations, if any, to the client; must be called without
+ * the mutex locked. Returns the number of locations delivered.
+ */
+static int location_batch_deliver(struct location_batch_delivery* delivery) {
+    if (!delivery->count) {
+        return 0;
+    }
+
+    delivery->callbacks->location_batch_cb(delivery->locations, delivery->count);
+
+    free(delivery->locations);
+
+    return delivery->count;
+}
+
+static int location_batch_add(int client_id, const GpsLocation* location) {
+    struct location_batch* batch = &location_batches[client_id];
+    struct location_batch_delivery delivery = { NULL, NULL, 0 };
+
+    pthread_mutex_lock(&location_batches_mutex);
+
+    if (!batch->batching) {
+        pthread_mutex_unlock(&location_batches_mutex);
+
+        return 0;
+    }
+
+    int depth = batch->options.depth;
+    if (batch->count == depth) {
+        batch->first = (batch->first + 1) % depth;
+        batch->count--;
+        batch->discarded++;
+    }
+
+    batch->locations[(batch->first + batch->count) % depth] = *location;
+    batch->count++;
+
+    int threshold = batch->options.threshold;
+    if ((threshold && batch->count >= threshold) ||
+            (batch->count == depth && (batch->options.flags & GPS_FP1_BATCHING_WAKEUP_ON_FULL))) {
+        location_batch_take_locked(batch, &delivery);
+    }
+
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    location_batch_deliver(&delivery);
+
+    return 1;
+}
+
+static int is_valid_batching_client_id(int client_id) {
+    return client_id >= 0 && client_id < GPS_FP1_MAX_CLIENTS;
+}
+
+static int batching_interface_init_client(int client_id, GpsFp1BatchingCallbacks* callbacks) {
+    ALOGV("Initing batching interface of client %d", client_id);
+
+    if (!is_valid_batching_client_id(client_id) || !callbacks || !callbacks->location_batch_cb) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&location_batches_mutex);
+    location_batches[client_id].callbacks = callbacks;
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    return 0;
+}
+
+static int batching_interface_start_client(int client_id, const GpsFp1BatchingOptions* options) {
+    ALOGV("Starting batching of client %d", client_id);
+
+    if (!is_valid_batching_client_id(client_id)) {
+        return -EINVAL;
+    }
+
+    if (!options || options->depth < 1 || options->depth > GPS_FP1_BATCHING_MAX_DEPTH ||
+            options->threshold < 0 || options->threshold > options->depth) {
+        ALOGE("Invalid batching options");
+
+        return -EINVAL;
+    }
+
+    struct location_batch* batch = &location_batches[client_id];
+
+    pthread_mutex_lock(&location_batches_mutex);
+
+    if (!batch->callbacks) {
+        pthread_mutex_unlock(&location_batches_mutex);
+
+        ALOGE("Batching started before setting the callbacks");
+
+        return -EINVAL;
+    }
+
+    batch->options = *options;
+    batch->first = 0;
+    batch->count = 0;
+    batch->discarded = 0;
+    batch->batching = 1;
+
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    ALOGI("Batching of client %d started; depth %d, threshold %d, flags 0x%x", client_id, options->depth, options->threshold, options->flags);
+
+    return 0;
+}
+
+static int batching_interface_stop_client(int client_id) {
+    ALOGV("Stopping batching of client %d", client_id);
+
+    if (!is_valid_batching_client_id(client_id)) {
+        return -EINVAL;
+    }
+
+    struct location_batch* batch = &location_batches[client_id];
+    struct location_batch_delivery delivery = { NULL, NULL, 0 };
+
+    pthread_mutex_lock(&location_batches_mutex);
+
+    if (batch->batching) {
+        location_batch_take_locked(batch, &delivery);
+        batch->batching = 0;
+
+        ALOGI("Batching of client %d stopped; %d locations discarded", client_id, batch->discarded);
+    }
+
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    location_batch_deliver(&delivery);
+
+    return 0;
+}
+
+static int batching_interface_flush_client(int client_id) {
+    ALOGV("Flushing batch of client %d", client_id);
+
+    if (!is_valid_batching_client_id(client_id)) {
+        return -EINVAL;
+    }
+
+    struct location_batch_delivery delivery;
+
+    pthread_mutex_lock(&location_batches_mutex);
+    location_batch_take_locked(&location_batches[client_id], &delivery);
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    return location_batch_deliver(&delivery);
+}
+
+static int batching_interface_get_client_discarded_count(int client_id) {
+    if (!is_valid_batching_client_id(client_id)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&location_batches_mutex);
+    int discarded = location_batches[client_id].discarded;
+    pthread_mutex_unlock(&location_batches_mutex);
+
+    return discarded;
+}
+
+static void batching_interface_cleanup_client(int client_id) {
+    ALOGV("Cleaning up batching interface of client %d", client_id);
+
+    if (!is_valid_batching_client_id(client_id)) {
+        return;
+    }
+
+    struct location_batch* batch = &location_batches[client_id];
+
+    pthread_mutex_lock(&location_batches_mutex);
+    batch->batching = 0;
+    batch->count = 0;
+    batch->callbacks = NULL;
+    pthread_mutex_unlock(&location_batches_mutex);
+}
+
+static int batching_interface_init(GpsFp1BatchingCallbacks* callbacks) {
+    return batching_interface_init_client(GPS_FP1_PRIMARY_CLIENT, callbacks);
+}
+
+static int batching_interface_start(const GpsFp1BatchingOptions* options) {
+    return batching_interface_start_client(GPS_FP1_PRIMARY_CLIENT, options);
+}
+
+static int batching_interface_stop() {
+    return batching_interface_stop_client(GPS_FP1_PRIMARY_CLIENT);
+}
+
+static int batching_interface_flush() {
+    return batching_interface_flush_client(GPS_FP1_PRIMARY_CLIENT);
+}
+
+static int batching_interface_get_discarded_count() {
+    return batching_interface_get_client_discarded_count(GPS_FP1_PRIMARY_CLIENT);
+}
+
+static void batching_interface_cleanup() {
+    batching_interface_cleanup_client(GPS_FP1_PRIMARY_CLIENT);
+}
+
+static const GpsFp1BatchingInterface batching_interface = {
+    .size = sizeof(GpsFp1BatchingInterface),
+    .init = &batching_interface_init,
+    .start = &batching_interface_start,
+    .stop = &batching_interface_stop,
+    .flush = &batching_interface_flush,
+    .get_discarded_count = &batching_interface_get_discarded_count,
+    .cleanup = &batching_interface_cleanup,
+    .init_client = &batching_interface_init_client,
+    .start_client = &batching_interface_start_client,
+    .stop_client = &batching_interface_stop_client,
+    .flush_client = &batching_interface_flush_client,
+    .get_client_discarded_count = &batching_interface_get_client_discarded_count,
+    .cleanup_client = &batching_interface_cleanup_client,
+};
+
+static void location_callback(GpsLocation* location) {
+    ALOGV("Calling location_callback wrapper");
+
+    int64_t start_time_us = get_monotonic_time_us();
+
+    stats_record_fix();
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_record_location(location);
+#endif
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    // The location marks the end of the fix epoch.
+    nmea_coalescer_flush();
+#endif
+
+    clients_report_location(location);
+
+    stats_record_call(GPS_FP1_STATS_CALL_LOCATION_CB, start_time_us);
+    stats_dump_if_due();
+}
+
+static void unknown_padding_callback_stub(uint32_t capabilities) {
+    ALOGW("TODO: stub for unknown_padding_callback; ensure that this is the expected callback and disable it in gps_interface_init or fix the mediatek_gps_callbacks");
+}
+
+static void set_capabilities_callback_stub(uint32_t capabilities) {
+    ALOGW("TODO: stub for set_capabilities_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+}
+
+static void acquire_wakelock_callback_stub() {
+    ALOGW("TODO: stub for acquire_wakelock_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+}
+
+static void release_wakelock_callback_stub() {
+    ALOGW("TODO: stub for release_wakelock_callback; ensure that this is the expected callback and enable it in gps_interface_init or fix the mediatek_gps_callbacks");
+}
+
+static struct mediatek_gps_callbacks current_mediatek_gps_callbacks;
+
+struct gps_interface_wrapper {
+    GpsInterface gps_interface;
+
+    const struct mediatek_gps_interface* wrapped_gps_interface;
+};
+
+/**
+ * Returns the path to the module to be wrapped.
+ *
+ * In host builds the path can be overriden with the GPS_FP1_WRAPPED_MODULE_PATH
+ * environment variable, so the wrapper can be exercised with a replacement for
+ * the proprietary MediaTek GPS HAL module.
+ */
+static const char* get_wrapped_module_path() {
+#ifdef GPS_WRAPPER_HOST_BUILD
+    const char* wrapped_module_path = getenv("GPS_FP1_WRAPPED_MODULE_PATH");
+    if (wrapped_module_path && *wrapped_module_path) {
+        return wrapped_module_path;
+    }
+#endif
+
+    return WRAPPED_MODULE_PATH;
+}
+
+/**
+ * Wrapped module.
+ *
+ * Loading the proprietary module resolves all its symbols, which is expensive,
+ * so once loaded its handle and its HAL module info are kept while the module
+ * is in use. Each opened device and the session of the wrapped module hold a
+ * reference, and the module is unloaded when the last reference is released.
+ *
+ * When GPS_WRAPPER_PRELOAD is defined the module is also loaded in a
+ * background thread when this wrapper is loaded. That reference is never
+ * released, so the module is kept loaded for the lifetime of the wrapper and
+ * opening a device does not need to load it.
+ */
+static pthread_mutex_t wrapped_module_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void* wrapped_module_handle = 0;
+static struct hw_module_t* wrapped_module = 0;
+static int wrapped_module_references = 0;
+
+static int wrapped_module_load_locked() {
+    const char* wrapped_module_path = get_wrapped_module_path();
+
+    int64_t start_time_us = get_monotonic_time_us();
+
+    BOOTTRACE_BEGIN("gps load module");
+    void* handle = dlopen(wrapped_module_path, RTLD_NOW);
+    BOOTTRACE_END("gps load module");
+    if (!handle) {
+        ALOGE("Could not dlopen the wrapped MediaTek GPS module: %s", dlerror());
+
+        return -EINVAL;
+    }
+
+    // Reset errors before calling dlsym for proper error checking.
+    dlerror();
+
+    struct hw_module_t* module = (struct hw_module_t*) dlsym(handle, HAL_MODULE_INFO_SYM_AS_STR);
+
+    const char* dlsym_error = dlerror();
+    if (dlsym_error) {
+        ALOGE("Could not find the HAL module symbol in the wrapped MediaTek GPS module: %s", dlsym_error);
+
+        dlclose(handle);
+
+        return -EINVAL;
+    }
+
+    if (strcmp(module->id, GPS_HARDWARE_MODULE_ID) != 0) {
+        ALOGE("Invalid wrapped MediaTek GPS module; expected id is '%s', but '%s' was found", GPS_HARDWARE_MODULE_ID, module->id);
+
+        dlclose(handle);
+
+        return -EINVAL;
+    }
+
+    wrapped_module_handle = handle;
+    wrapped_module = module;
+
+    ALOGI("Wrapped MediaTek GPS module '%s' loaded in %lld us", wrapped_module_path, (long long) (get_monotonic_time_us() - start_time_us));
+
+    return 0;
+}
+
+/**
+ * Returns the wrapped HAL module info, loading the wrapped module if needed, or
+ * NULL if it could not be loaded. Each successful call must be balanced with a
+ * call to wrapped_module_release.
+ */
+static struct hw_module_t* wrapped_module_acquire() {
+    pthread_mutex_lock(&wrapped_module_mutex);
+
+    if (!wrapped_module_handle && wrapped_module_load_locked() < 0) {
+        pthread_mutex_unlock(&wrapped_module_mutex);
+
+        return NULL;
+    }
+
+    wrapped_module_references++;
+
+    struct hw_module_t* module = wrapped_module;
+
+    pthread_mutex_unlock(&wrapped_module_mutex);
+
+    return module;
+}
+
+static void wrapped_module_release() {
+    pthread_mutex_lock(&wrapped_module_mutex);
+
+    wrapped_module_references--;
+    if (wrapped_module_references == 0) {
+        dlclose(wrapped_module_handle);
+
+        wrapped_module_handle = 0;
+        wrapped_module = 0;
+
+        ALOGI("Wrapped MediaTek GPS module unloaded");
+    }
+
+    pthread_mutex_unlock(&wrapped_module_mutex);
+}
+
+#ifdef GPS_WRAPPER_PRELOAD
+static void* wrapped_module_preload_thread(void* arg) {
+    if (!wrapped_module_acquire()) {
+        ALOGW("Could not preload the wrapped MediaTek GPS module; it will be loaded again when opened");
+    }
+
+    return NULL;
+}
+
+__attribute__((constructor))
+static void wrapped_module_preload() {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    // The wrapped module can not be loaded from the constructor itself, as it
+    // is run while the dynamic linker is still loading this wrapper.
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, &wrapped_module_preload_thread, NULL) != 0) {
+        ALOGW("Could not create thread to preload the wrapped MediaTek GPS module");
+    }
+
+    pthread_attr_destroy(&attributes);
+}
+#endif
+
+/**
+ * The parameters passed to the GpsInterface functions do not include the
+ * GpsInterface structure that they belong to. Therefore, when the interface is
+ * got it is necessary to keep a pointer to the wrapped GpsInterface in order to
+ * call the functions in the wrapped one from the wrappers.
+ *
+ * As the wrapped module is expected to always return the same GpsInterface,
+ * a single wrapper for the GpsInterface is used; if the GpsInterface is got
+ * again the same wrapper is just updated and returned.
+ */
+static struct gps_interface_wrapper gps_interface_wrapper_instance;
+static struct gps_interface_wrapper* current_gps_interface_wrapper = 0;
+
+/**
+ * Session of the wrapped module.
+ *
+ * The wrapped module is inited when the primary client inits the GpsInterface,
+ * and it is cleaned up when the primary client cleans it up and no other
+ * clients remain. The wrapped module is started while at least one client is
+ * started.
+ *
+ * The engine_mutex serializes the changes in the session and in the clients;
+ * the clients_lock is write locked too when the clients are modified, so they
+ * are not modified while the callbacks are being dispatched.
+ */
+static pthread_mutex_t engine_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int engine_inited = 0;
+static int engine_started_clients = 0;
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+static int engine_assistance_pending = 0;
+#endif
+
+static int engine_init_locked() {
+    if (engine_inited) {
+        ALOGV("Wrapped GPS interface already inited");
+
+        return 0;
+    }
+
+    current_mediatek_gps_callbacks.size = sizeof(current_mediatek_gps_callbacks);
+    current_mediatek_gps_callbacks.location_cb = &location_callback;
+    current_mediatek_gps_callbacks.status_cb = &status_callback;
+
+    current_mediatek_gps_callbacks.sv_status_cb = &sv_status_callback;
+
+    current_mediatek_gps_callbacks.nmea_cb = &nmea_callback;
+
+    // These callbacks are not guaranteed to be in the right order in the
+    // MediaTek GpsCallbacks, so for the time being just log that they were
+    // called to try to figure that right order.
+    current_mediatek_gps_callbacks.unknown_padding_cb = &unknown_padding_callback_stub;
+    current_mediatek_gps_callbacks.set_capabilities_cb = &set_capabilities_callback_stub;
+    current_mediatek_gps_callbacks.acquire_wakelock_cb = &acquire_wakelock_callback_stub;
+    current_mediatek_gps_callbacks.release_wakelock_cb = &release_wakelock_callback_stub;
+
+    current_mediatek_gps_callbacks.create_thread_cb = &create_thread_callback;
+    current_mediatek_gps_callbacks.request_utc_time_cb = &request_utc_time_callback;
+
+    // The session keeps the wrapped module loaded even if the device is
+    // closed.
+    if (!wrapped_module_acquire()) {
+        return -EINVAL;
+    }
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+    // Started before initing the wrapped module, as it could report the SV
+    // status as soon as it is inited.
+    sv_status_dispatcher_start();
+#endif
+
+    BOOTTRACE_BEGIN("gps init");
+    int result = current_gps_interface_wrapper->wrapped_gps_interface->init(&current_mediatek_gps_callbacks);
+    BOOTTRACE_END("gps init");
+    if (result != 0) {
+        ALOGE("Failed to init wrapped GPS interface: %d", result);
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+        sv_status_dispatcher_stop();
+#endif
+
+        wrapped_module_release();
+
+        return result;
+    }
+
+    engine_inited = 1;
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    nmea_coalescer_flusher_start();
+#endif
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_open();
+    engine_assistance_pending = 1;
+#endif
+
+    return 0;
+}
+
+static void engine_cleanup_locked() {
+    if (!engine_inited) {
+        return;
+    }
+
+    current_gps_interface_wrapper->wrapped_gps_interface->cleanup();
+
+    engine_inited = 0;
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    nmea_coalescer_flusher_stop();
+    nmea_coalescer_flush();
+    nmea_coalescer_log_statistics();
+#endif
+
+#ifdef GPS_WRAPPER_ASYNC_SV_STATUS
+    // The wrapped module is not expected to call sv_status_callback once
+    // cleaned up, so the dispatcher thread can be safely stopped now.
+    sv_status_dispatcher_stop();
+#endif
+
+    wrapped_module_release();
+}
+
+static int engine_has_clients_locked() {
+    int i;
+    for (i = 0; i < GPS_FP1_MAX_CLIENTS; i++) {
+        if (clients[i].callbacks) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+static void engine_inject_assistance_locked() {
+    if (!engine_assistance_pending) {
+        return;
+    }
+
+    engine_assistance_pending = 0;
+
+    struct assistance_data data;
+    assistance_cache_get(&data);
+
+    const struct mediatek_gps_interface* wrapped_gps_interface = current_gps_interface_wrapper->wrapped_gps_interface;
+
+    if (data.has_time) {
+        ALOGI("Injecting cached time (uncertainty %d ms)", data.uncertainty);
+
+        wrapped_gps_interface->inject_time(data.time, data.time_reference, data.uncertainty);
+    }
+
+    if (data.has_location) {
+        ALOGI("Injecting cached location (accuracy %.0f m)", data.accuracy);
+
+        wrapped_gps_interface->inject_location(data.latitude, data.longitude, data.accuracy);
+    }
+}
+#endif
+
+static int client_start_locked(int client_id) {
+    if (clients[client_id].started) {
+        return 0;
+    }
+
+    if (engine_started_clients == 0) {
+        ALOGV("Starting wrapped GPS interface");
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+        engine_inject_assistance_locked();
+#endif
+
+        int64_t start_time_us = get_monotonic_time_us();
+        BOOTTRACE_BEGIN("gps start");
+        int result = current_gps_interface_wrapper->wrapped_gps_interface->start();
+        BOOTTRACE_END("gps start");
+        stats_record_call(GPS_FP1_STATS_CALL_START, start_time_us);
+        if (result != 0) {
+            return result;
+        }
+
+        stats_session_started();
+    }
+    engine_started_clients++;
+
+    pthread_rwlock_wrlock(&clients_lock);
+    clients[client_id].started = 1;
+    pthread_rwlock_unlock(&clients_lock);
+
+    return 0;
+}
+
+static int client_stop_locked(int client_id) {
+    if (!clients[client_id].started) {
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&clients_lock);
+    clients[client_id].started = 0;
+    pthread_rwlock_unlock(&clients_lock);
+
+    engine_started_clients--;
+    if (engine_started_clients > 0) {
+        return 0;
+    }
+
+    ALOGV("Stopping wrapped GPS interface");
+
+    int64_t start_time_us = get_monotonic_time_us();
+    int result = current_gps_interface_wrapper->wrapped_gps_interface->stop();
+    stats_record_call(GPS_FP1_STATS_CALL_STOP, start_time_us);
+
+#ifdef GPS_WRAPPER_NMEA_COALESCING
+    nmea_coalescer_flush();
+#endif
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_sync();
+#endif
+
+    stats_session_stopped();
+
+    return result;
+}
+
+static void client_set_locked(int client_id, GpsCallbacks* callbacks, const GpsFp1ClientOptions* options) {
+    pthread_rwlock_wrlock(&clients_lock);
+
+    clients[client_id].callbacks = callbacks;
+    clients[client_id].options = *options;
+    clients[client_id].last_location_time_ms = 0;
+    clients[client_id].last_sv_status_time_ms = 0;
+
+    pthread_rwlock_unlock(&clients_lock);
+}
+
+static const GpsFp1ClientOptions default_client_options = {
+    .size = sizeof(GpsFp1ClientOptions),
+    .events = GPS_FP1_CLIENT_EVENT_ALL,
+};
+
+static int gps_interface_init(GpsCallbacks* callbacks) {
+    ALOGV("Initing wrapped GPS interface");
+
+    pthread_mutex_lock(&engine_mutex);
+
+    if (clients[GPS_FP1_PRIMARY_CLIENT].callbacks) {
+        ALOGW("gps_interface_init called again; the previous callbacks of the primary client are replaced");
+
+        pthread_rwlock_wrlock(&clients_lock);
+        clients[GPS_FP1_PRIMARY_CLIENT].callbacks = callbacks;
+        pthread_rwlock_unlock(&clients_lock);
+    } else {
+        client_set_locked(GPS_FP1_PRIMARY_CLIENT, callbacks, &default_client_options);
+    }
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_reset_injected();
+#endif
+
+    int result = engine_init_locked();
+    if (result != 0) {
+        client_set_locked(GPS_FP1_PRIMARY_CLIENT, NULL, &default_client_options);
+    }
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    return result;
+}
+
+static int gps_interface_start() {
+    ALOGV("Starting primary client");
+
+    pthread_mutex_lock(&engine_mutex);
+    int result = client_start_locked(GPS_FP1_PRIMARY_CLIENT);
+    pthread_mutex_unlock(&engine_mutex);
+
+    return result;
+}
+
+static int gps_interface_stop() {
+    ALOGV("Stopping primary client");
+
+    pthread_mutex_lock(&engine_mutex);
+    int result = client_stop_locked(GPS_FP1_PRIMARY_CLIENT);
+    pthread_mutex_unlock(&engine_mutex);
+
+    return result;
+}
+
+static void gps_interface_cleanup() {
+    ALOGV("Cleaning up primary client");
+
+    pthread_mutex_lock(&engine_mutex);
+
+    client_stop_locked(GPS_FP1_PRIMARY_CLIENT);
+    client_set_locked(GPS_FP1_PRIMARY_CLIENT, NULL, &default_client_options);
+
+    if (!engine_has_clients_locked()) {
+        engine_cleanup_locked();
+    } else {
+        ALOGI("Wrapped GPS interface kept inited for the remaining clients");
+    }
+
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+static int is_valid_client_options(const GpsFp1ClientOptions* options) {
+    return options && options->size >= sizeof(GpsFp1ClientOptions);
+}
+
+static int is_valid_client_id_locked(int client_id) {
+    return client_id >= 0 && client_id < GPS_FP1_MAX_CLIENTS && clients[client_id].callbacks;
+}
+
+static int clients_interface_add_client(GpsCallbacks* callbacks, const GpsFp1ClientOptions* options) {
+    ALOGV("Adding client");
+
+    if (!callbacks || !is_valid_client_options(options)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&engine_mutex);
+
+    if (!engine_inited) {
+        pthread_mutex_unlock(&engine_mutex);
+
+        ALOGE("Clients can not be added before the primary client inits the GPS interface");
+
+        return -EAGAIN;
+    }
+
+    int client_id;
+    for (client_id = GPS_FP1_PRIMARY_CLIENT + 1; client_id < GPS_FP1_MAX_CLIENTS; client_id++) {
+        if (!clients[client_id].callbacks) {
+            break;
+        }
+    }
+
+    if (client_id == GPS_FP1_MAX_CLIENTS) {
+        pthread_mutex_unlock(&engine_mutex);
+
+        ALOGE("Client can not be added; there are already %d clients", GPS_FP1_MAX_CLIENTS);
+
+        return -ENOSPC;
+    }
+
+    client_set_locked(client_id, callbacks, options);
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    ALOGI("Client %d added", client_id);
+
+    return client_id;
+}
+
+static int clients_interface_remove_client(int client_id) {
+    ALOGV("Removing client %d", client_id);
+
+    pthread_mutex_lock(&engine_mutex);
+
+    if (client_id == GPS_FP1_PRIMARY_CLIENT || !is_valid_client_id_locked(client_id)) {
+        pthread_mutex_unlock(&engine_mutex);
+
+        return -EINVAL;
+    }
+
+    client_stop_locked(client_id);
+    client_set_locked(client_id, NULL, &default_client_options);
+
+    if (!engine_has_clients_locked()) {
+        engine_cleanup_locked();
+    }
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    // The identifier can be reused by a later client, which must not get the
+    // batch of this one.
+    batching_interface_cleanup_client(client_id);
+
+    ALOGI("Client %d removed", client_id);
+
+    return 0;
+}
+
+static int clients_interface_set_client_options(int client_id, const GpsFp1ClientOptions* options) {
+    ALOGV("Setting options of client %d", client_id);
+
+    if (!is_valid_client_options(options)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&engine_mutex);
+
+    if (!is_valid_client_id_locked(client_id)) {
+        pthread_mutex_unlock(&engine_mutex);
+
+        return -EINVAL;
+    }
+
+    client_set_locked(client_id, clients[client_id].callbacks, options);
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    return 0;
+}
+
+static int clients_interface_start(int client_id) {
+    ALOGV("Starting client %d", client_id);
+
+    pthread_mutex_lock(&engine_mutex);
+
+    int result = -EINVAL;
+    if (is_valid_client_id_locked(client_id)) {
+        result = client_start_locked(client_id);
+    }
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    return result;
+}
+
+static int clients_interface_stop(int client_id) {
+    ALOGV("Stopping client %d", client_id);
+
+    pthread_mutex_lock(&engine_mutex);
+
+    int result = -EINVAL;
+    if (is_valid_client_id_locked(client_id)) {
+        result = client_stop_locked(client_id);
+    }
+
+    pthread_mutex_unlock(&engine_mutex);
+
+    return result;
+}
+
+static const GpsFp1ClientsInterface clients_interface = {
+    .size = sizeof(GpsFp1ClientsInterface),
+    .add_client = &clients_interface_add_client,
+    .remove_client = &clients_interface_remove_client,
+    .set_client_options = &clients_interface_set_client_options,
+    .start = &clients_interface_start,
+    .stop = &clients_interface_stop,
+};
+
+static const void* gps_interface_get_extension(const char* name) {
+    ALOGV("Getting extension '%s'", name);
+
+    if (!strcmp(name, GPS_FP1_SV_STATUS_INTERFACE)) {
+        return &sv_status_interface;
+    }
+
+    if (!strcmp(name, GPS_FP1_BATCHING_INTERFACE)) {
+        return &batching_interface;
+    }
+
+    if (!strcmp(name, GPS_FP1_CLIENTS_INTERFACE)) {
+        return &clients_interface;
+    }
+
+    if (!strcmp(name, GPS_FP1_STATS_INTERFACE)) {
+        return &stats_interface;
+    }
+
+    if (!current_gps_interface_wrapper->wrapped_gps_interface->get_extension) {
+        return NULL;
+    }
+
+    return current_gps_interface_wrapper->wrapped_gps_interface->get_extension(name);
+}
+
+static int gps_interface_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty) {
+    ALOGV("Injecting time in wrapped GPS interface");
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_record_injected_time(time, timeReference, uncertainty);
+#endif
+
+    int64_t start_time_us = get_monotonic_time_us();
+    int result = current_gps_interface_wrapper->wrapped_gps_interface->inject_time(time, timeReference, uncertainty);
+    stats_record_call(GPS_FP1_STATS_CALL_INJECT_TIME, start_time_us);
+
+    return result;
+}
+
+static int gps_interface_inject_location(double latitude, double longitude, float accuracy) {
+    ALOGV("Injecting location in wrapped GPS interface");
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_record_injected_location();
+#endif
+
+    int64_t start_time_us = get_monotonic_time_us();
+    int result = current_gps_interface_wrapper->wrapped_gps_interface->inject_location(latitude, longitude, accuracy);
+    stats_record_call(GPS_FP1_STATS_CALL_INJECT_LOCATION, start_time_us);
+
+    return result;
+}
+
+static int gps_interface_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence,
+        uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time) {
+    ALOGV("Setting position mode in wrapped GPS interface");
+
+    // The fix interval is used to tell stalls from fixes that are just
+    // requested at long intervals.
+    android_atomic_release_store((int32_t) min_interval, &stats.fix_interval_ms);
+
+    int64_t start_time_us = get_monotonic_time_us();
+    int result = current_gps_interface_wrapper->wrapped_gps_interface->set_position_mode(mode, recurrence, min_interval, preferred_accuracy, preferred_time);
+    stats_record_call(GPS_FP1_STATS_CALL_SET_POSITION_MODE, start_time_us);
+
+    return result;
+}
+
+static void gps_interface_delete_aiding_data(GpsAidingData flags) {
+    ALOGV("Deleting wrapped aiding data");
+
+#ifdef GPS_WRAPPER_ASSISTANCE_CACHE
+    assistance_cache_invalidate(flags);
+#endif
+
+#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
+    // GpsAidingData was changed from uint16_t to uint32_t in CyanogenMod 11.0
+    // to add room for extra flags. All the original flags in the lower bits
+    // have the same values, except for GPS_DELETE_CELLDB_INFO, which changed
+    // from 0x8000 to 0x0800.
+    uint16_t flags_uint16 = (uint16_t) (flags & 0x000007FF);
+    if (flags & 0x00000800) {
+        flags_uint16 |= 0x8000;
+    }
+    if (flags == 0xFFFFFFFF) {
+        flags_uint16 = 0xFFFF;
+    }
+
+    current_gps_interface_wrapper->wrapped_gps_interface->delete_aiding_data(flags_uint16);
+#else
+    current_gps_interface_wrapper->wrapped_gps_interface->delete_aiding_data(flags);
+#endif
+}
+
+struct gps_device_wrapper {
+    struct gps_device_t device;
+
+    struct mediatek_gps_device_t* wrapped_device;
+};
+
+static const GpsInterface* gps_device_get_gps_interface(struct gps_device_t* device) {
+    ALOGV("Getting GPS interface wrapper");
+
+    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*) device;
+
+    const struct mediatek_gps_interface* wrapped_gps_interface = wrapper->wrapped_device->get_gps_interface(wrapper->wrapped_device);
+
+    if (current_gps_interface_wrapper && current_gps_interface_wrapper->wrapped_gps_interface != wrapped_gps_interface) {
+        ALOGW("get_gps_interface returned a different wrapped GPS interface; the previous one is no longer used");
+    }
+
+    struct gps_interface_wrapper* interface_wrapper = &gps_interface_wrapper_instance;
+
+    // Only the init, start, stop, cleanup, get_extension and (depending on
+    // the GpsAidingData type) the delete_aiding_data functions have to be
+    // overriden in the GPS interface; the rest of them are overriden too to
+    // measure their latency and to keep the assistance cache.
+    interface_wrapper->gps_interface.size = sizeof(struct mediatek_gps_interface);
+    interface_wrapper->gps_interface.init = &gps_interface_init;
+    interface_wrapper->gps_interface.start = &gps_interface_start;
+    interface_wrapper->gps_interface.stop = &gps_interface_stop;
+    interface_wrapper->gps_interface.cleanup = &gps_interface_cleanup;
+    interface_wrapper->gps_interface.inject_time = &gps_interface_inject_time;
+    interface_wrapper->gps_interface.inject_location = &gps_interface_inject_location;
+    interface_wrapper->gps_interface.delete_aiding_data = &gps_interface_delete_aiding_data;
+    interface_wrapper->gps_interface.set_position_mode = &gps_interface_set_position_mode;
+    interface_wrapper->gps_interface.get_extension = &gps_interface_get_extension;
+    interface_wrapper->wrapped_gps_interface = wrapped_gps_interface;
+
+    current_gps_interface_wrapper = interface_wrapper;
+
+    return (GpsInterface*) current_gps_interface_wrapper;
+}
+
+static int gps_device_close(struct hw_device_t* device) {
+    ALOGV("Closing GPS device wrapper");
+
+    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*)device;
+
+    int result = wrapper->wrapped_device->common.close(&wrapper->wrapped_device->common);
+
+    free(device);
+
+    wrapped_module_release();
+
+    return result;
+}
+
+static int gps_module_open(const struct hw_module_t* module, const char* name, struct hw_device_t** device) {
+    ALOGI("Opening MediaTek GPS wrapper HAL module for '%s'", get_wrapped_module_path());
+
+    int64_t start_time_us = get_monotonic_time_us();
+
+    struct hw_module_t* wrapped_module = wrapped_module_acquire();
+    if (!wrapped_module) {
+        return -EINVAL;
+    }
+
+    struct gps_device_wrapper* wrapper = (struct gps_device_wrapper*) malloc(sizeof(struct gps_device_wrapper));
+    memset(wrapper, 0, sizeof(struct gps_device_wrapper));
+
+    wrapper->device.common.tag = HARDWARE_DEVICE_TAG;
+    wrapper->device.common.version = HARDWARE_DEVICE_API_VERSION(1, 0);
+    wrapper->device.common.module = (struct hw_module_t*) module;
+    wrapper->device.common.close = &gps_device_close;
+    wrapper->device.get_gps_interface = &gps_device_get_gps_interface;
+
+    struct mediatek_gps_device_t* wrapped_device;
+    int wrapped_status = wrapped_module->methods->open(wrapped_module, name, (struct hw_device_t**) &wrapped_device);
+    if (wrapped_status != 0) {
+        ALOGE("Failed to open wrapped device: %d", wrapped_status);
+
+        free(wrapper);
+
+        wrapped_module_release();
+
+        return wrapped_status;
+    }
+
+    wrapper->wrapped_device = wrapped_device;
+
+    *device = (struct hw_device_t*) wrapper;
+
+    ALOGI("MediaTek GPS wrapper HAL module opened in %lld us", (long long) (get_monotonic_time_us() - start_time_us));
 
     return 0;
 }
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPS_REPLAY_H
+#define GPS_REPLAY_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/**
+ * Extension provided by the replay module (see replay.c).
+ *
+ * As the gps.fp1 wrapper passes the extensions that it does not know to the
+ * wrapped module, this extension can be got from the GpsInterface of the
+ * wrapper too.
+ */
+
+/** Name for the replay extension. */
+#define GPS_REPLAY_INTERFACE "gps-replay"
+
+/** Callbacks whose latency is recorded while replaying. */
+#define GPS_REPLAY_CALLBACK_LOCATION    0
+#define GPS_REPLAY_CALLBACK_SV_STATUS   1
+#define GPS_REPLAY_CALLBACK_NMEA        2
+#define GPS_REPLAY_CALLBACK_COUNT       3
+
+/** Aiding data whose injections are counted. */
+#define GPS_REPLAY_INJECTED_TIME        0
+#define GPS_REPLAY_INJECTED_LOCATION    1
+#define GPS_REPLAY_INJECTED_COUNT       2
+
+/** Maximum number of latencies recorded for each callback in a replay. */
+#define GPS_REPLAY_MAX_LATENCIES 65536
+
+typedef struct {
+    /** set to sizeof(GpsReplayInterface) */
+    size_t size;
+
+    /**
+     * Replays the recording in the given path from the calling thread.
+     *
+     * The events are replayed at the given rate, relative to the times in the
+     * recording (1 is real time, 2 twice as fast...); if the rate is 0 they
+     * are replayed as fast as possible. The latency of each call to the
+     * callbacks is recorded.
+     *
+     * It must not be called while the module is started.
+     *
+     * Returns the number of events replayed, or a negative errno value.
+     */
+    int (*replay)(const char* path, double rate);
+
+    /**
+     * Copies to latencies_ns up to max latencies, in nanoseconds, of the calls
+     * to the given callback in the last replay.
+     *
+     * Returns the number of latencies copied.
+     */
+    int (*get_latencies)(int callback, uint32_t* latencies_ns, int max);
+
+    /**
+     * Returns the number of times that the given aiding data was injected in
+     * the module since it was inited.
+     */
+    int (*get_injected_count)(int aiding_data);
+} GpsReplayInterface;
+
+__END_DECLS
+
+#endif
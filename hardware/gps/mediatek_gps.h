@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIATEK_GPS_H
+#define MEDIATEK_GPS_H
+
+#include <stdint.h>
+
+#include <hardware/gps.h>
+
+/**
+ * Layout of the data structures of the proprietary MediaTek GPS HAL module.
+ *
+ * They are shared by the gps.fp1 wrapper and by the replay module that stands
+ * in for the proprietary one in host builds, so both agree on the layout.
+ */
+
+#define MEDIATEK_GPS_MAX_SVS 256
+#define MEDIATEK_GPS_MASK_COUNT (MEDIATEK_GPS_MAX_SVS / 32)
+
+/**
+ * MediaTek SV status.
+ *
+ * The standard GpsSvStatus supports up to GPS_MAX_SVS (32) SVs, while the
+ * MediaTek GpsSvStatus version seems to support up to 256.
+ *
+ * As the standard GpsSvStatus has 32 SVs, all the SVs fit in uint32 masks.
+ * However, with the increased amount of SVs in the MediaTek version, each mask
+ * needs now 256 bits, so arrays of eight uint32 are used instead.
+ *
+ * Note, however, that nothing guarantees that this layout is indeed the layout
+ * used in the proprietary MediaTek GPS HAL module. It is just hypothetical
+ * (although it seems to work).
+ */
+struct mediatek_gps_sv_status {
+    size_t      size;
+    int         num_svs;
+    GpsSvInfo   sv_list[MEDIATEK_GPS_MAX_SVS];
+    uint32_t    ephemeris_mask[MEDIATEK_GPS_MASK_COUNT];
+    uint32_t    almanac_mask[MEDIATEK_GPS_MASK_COUNT];
+    uint32_t    used_in_fix_mask[MEDIATEK_GPS_MASK_COUNT];
+};
+
+/**
+ * MediaTek GPS callback.
+ *
+ * The create_thread callback in the MediaTek GpsCallback version is at the
+ * same location as the request_utc_time callback in the standard version. The
+ * nmea callback and those preceding it are at the same location in both
+ * versions. Therefore, there is an unknown callback between them. However, the
+ * exact location is also unknown, as the set_capabilities, acquire_wakelock and
+ * release_wakelock do not seem to be ever called, so they can not be used as a
+ * reference.
+ */
+struct mediatek_gps_callbacks {
+    size_t      size;
+    gps_location_callback location_cb;
+    gps_status_callback status_cb;
+    void (*sv_status_cb)(struct mediatek_gps_sv_status* mediatek_sv_status);
+    gps_nmea_callback nmea_cb;
+    void (*unknown_padding_cb)();
+    gps_set_capabilities set_capabilities_cb;
+    gps_acquire_wakelock acquire_wakelock_cb;
+    gps_release_wakelock release_wakelock_cb;
+    gps_create_thread create_thread_cb;
+    gps_request_utc_time request_utc_time_cb;
+};
+
+struct mediatek_gps_interface {
+    size_t size;
+    int (*init)(struct mediatek_gps_callbacks* callbacks);
+    int (*start)(void);
+    int (*stop)(void);
+    void (*cleanup)(void);
+    int (*inject_time)(GpsUtcTime time, int64_t timeReference, int uncertainty);
+    int (*inject_location)(double latitude, double longitude, float accuracy);
+#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
+    void (*delete_aiding_data)(uint16_t flags);
+#else
+    void (*delete_aiding_data)(GpsAidingData flags);
+#endif
+    int (*set_position_mode)(GpsPositionMode mode, GpsPositionRecurrence recurrence,
+         uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time);
+    const void* (*get_extension)(const char* name);
+};
+
+struct mediatek_gps_device_t {
+    struct hw_device_t common;
+
+    const struct mediatek_gps_interface* (*get_gps_interface)(struct mediatek_gps_device_t* dev);
+};
+
+#endif
@@ -0,0 +1,689 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "gps.replay"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/log.h>
+
+#include <hardware/gps.h>
+
+#include "gps_replay.h"
+#include "mediatek_gps.h"
+
+/**
+ * Replay module.
+ *
+ * Stand-in for the proprietary MediaTek GPS HAL module in host builds of the
+ * gps.fp1 wrapper. It exposes the same data structures as the proprietary
+ * module (see mediatek_gps.h) and, instead of talking to the GPS chip, it
+ * replays a recording of the location, SV status and NMEA reported by the
+ * engine through the MediaTek GpsCallbacks.
+ *
+ * When GPS_REPLAY_PATH is set in the environment, the recording in that path
+ * is replayed each time that the module is started, from a thread created with
+ * the create_thread callback (like the proprietary module does), at the rate
+ * set in GPS_REPLAY_RATE (1 by default; see GpsReplayInterface.replay). If
+ * GPS_REPLAY_LOOP is set the recording is replayed again and again until the
+ * module is stopped. Besides that, the GPS_REPLAY_INTERFACE extension replays a
+ * recording synchronously and provides the latency of each callback, which is
+ * used by the benchmark of the wrapper, and counts the injected time and
+ * locations, which it uses to check the assistance cache of the wrapper.
+ *
+ * Recordings are text files with an event in each line. Empty lines and lines
+ * starting with '#' are ignored. The first field of each line is the type of
+ * the event and the second one the time, in milliseconds since the start of
+ * the recording, at which it is reported:
+ *
+ *   L <time> <latitude> <longitude> <altitude> <speed> <bearing> <accuracy>
+ *   S <time> [<prn>,<snr>,<elevation>,<azimuth>[,<flags>]]...
+ *   N <time> <sentence>
+ *
+ * In SV status events, the flags of each SV are any combination of 'e' (has
+ * ephemeris), 'a' (has almanac) and 'u' (used in fix). The timestamps of the
+ * location and the NMEA are the time at which they are replayed.
+ */
+#define REPLAY_EVENT_LOCATION 'L'
+#define REPLAY_EVENT_SV_STATUS 'S'
+#define REPLAY_EVENT_NMEA 'N'
+
+struct replay_event {
+    char type;
+    int64_t time_ms;
+
+    union {
+        GpsLocation location;
+        struct mediatek_gps_sv_status* sv_status;
+        char* nmea;
+    };
+};
+
+struct recording {
+    struct replay_event* events;
+    int count;
+};
+
+static int64_t get_monotonic_time_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static GpsUtcTime get_utc_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (GpsUtcTime) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int parse_location(char* fields, GpsLocation* location) {
+    memset(location, 0, sizeof(GpsLocation));
+    location->size = sizeof(GpsLocation);
+
+    if (sscanf(fields, "%lf %lf %lf %f %f %f", &location->latitude, &location->longitude,
+               &location->altitude, &location->speed, &location->bearing, &location->accuracy) != 6) {
+        return -1;
+    }
+
+    location->flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE | GPS_LOCATION_HAS_SPEED |
+                      GPS_LOCATION_HAS_BEARING | GPS_LOCATION_HAS_ACCURACY;
+
+    return 0;
+}
+
+static void set_mask_bit(uint32_t* mask, int prn) {
+    if (prn >= 1 && prn <= MEDIATEK_GPS_MAX_SVS) {
+        mask[(prn - 1) / 32] |= 1U << ((prn - 1) % 32);
+    }
+}
+
+static int parse_sv_status(char* fields, struct mediatek_gps_sv_status* sv_status) {
+    memset(sv_status, 0, sizeof(struct mediatek_gps_sv_status));
+    sv_status->size = sizeof(struct mediatek_gps_sv_status);
+
+    char* saveptr;
+    char* field;
+    for (field = strtok_r(fields, " \t", &saveptr); field; field = strtok_r(NULL, " \t", &saveptr)) {
+        if (sv_status->num_svs == MEDIATEK_GPS_MAX_SVS) {
+            return -1;
+        }
+
+        GpsSvInfo* sv = &sv_status->sv_list[sv_status->num_svs];
+        sv->size = sizeof(GpsSvInfo);
+
+        char flags[4] = "";
+        if (sscanf(field, "%d,%f,%f,%f,%3s", &sv->prn, &sv->snr, &sv->elevation, &sv->azimuth, flags) < 4) {
+            return -1;
+        }
+
+        if (strchr(flags, 'e')) {
+            set_mask_bit(sv_status->ephemeris_mask, sv->prn);
+        }
+        if (strchr(flags, 'a')) {
+            set_mask_bit(sv_status->almanac_mask, sv->prn);
+        }
+        if (strchr(flags, 'u')) {
+            set_mask_bit(sv_status->used_in_fix_mask, sv->prn);
+        }
+
+        sv_status->num_svs++;
+    }
+
+    return 0;
+}
+
+static void recording_free(struct recording* recording) {
+    int i;
+    for (i = 0; i < recording->count; i++) {
+        struct replay_event* event = &recording->events[i];
+        if (event->type == REPLAY_EVENT_SV_STATUS) {
+            free(event->sv_status);
+        } else if (event->type == REPLAY_EVENT_NMEA) {
+            free(event->nmea);
+        }
+    }
+
+    free(recording->events);
+
+    recording->events = NULL;
+    recording->count = 0;
+}
+
+static int recording_parse_event(char* line, struct replay_event* event) {
+    char type;
+    long long time_ms;
+    int fields_offset;
+    if (sscanf(line, "%c %lld %n", &type, &time_ms, &fields_offset) != 2) {
+        return -1;
+    }
+
+    char* fields = line + fields_offset;
+    fields[strcspn(fields, "\r\n")] = '\0';
+
+    event->type = type;
+    event->time_ms = time_ms;
+
+    switch (type) {
+    case REPLAY_EVENT_LOCATION:
+        return parse_location(fields, &event->location);
+    case REPLAY_EVENT_SV_STATUS:
+        event->sv_status = malloc(sizeof(struct mediatek_gps_sv_status));
+        if (!event->sv_status) {
+            return -1;
+        }
+        if (parse_sv_status(fields, event->sv_status) < 0) {
+            free(event->sv_status);
+
+            return -1;
+        }
+        return 0;
+    case REPLAY_EVENT_NMEA:
+        event->nmea = strdup(fields);
+        return event->nmea ? 0 : -1;
+    }
+
+    return -1;
+}
+
+static int recording_load(const char* path, struct recording* recording) {
+    recording->events = NULL;
+    recording->count = 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        int error = errno;
+
+        ALOGE("Could not open recording '%s': %s", path, strerror(error));
+
+        return -error;
+    }
+
+    int capacity = 0;
+    int line_number = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    int result = 0;
+
+    while (getline(&line, &line_size, file) >= 0) {
+        line_number++;
+
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        if (recording->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+
+            struct replay_event* events = realloc(recording->events, capacity * sizeof(struct replay_event));
+            if (!events) {
+                result = -ENOMEM;
+
+                break;
+            }
+
+            recording->events = events;
+        }
+
+        if (recording_parse_event(line, &recording->events[recording->count]) < 0) {
+            ALOGE("Invalid event in line %d of recording '%s'", line_number, path);
+
+            result = -EINVAL;
+
+            break;
+        }
+
+        recording->count++;
+    }
+
+    free(line);
+    fclose(file);
+
+    if (result < 0) {
+        recording_free(recording);
+    }
+
+    return result;
+}
+
+static struct mediatek_gps_callbacks* current_callbacks = NULL;
+
+static struct {
+    uint32_t latencies_ns[GPS_REPLAY_CALLBACK_COUNT][GPS_REPLAY_MAX_LATENCIES];
+    int counts[GPS_REPLAY_CALLBACK_COUNT];
+} replay_latencies;
+
+static int replay_injected_counts[GPS_REPLAY_INJECTED_COUNT];
+
+static void record_latency(int callback, int64_t start_time_ns) {
+    int64_t latency_ns = get_monotonic_time_ns() - start_time_ns;
+
+    int count = replay_latencies.counts[callback];
+    if (count < GPS_REPLAY_MAX_LATENCIES) {
+        replay_latencies.latencies_ns[callback][count] = latency_ns < UINT32_MAX ? (uint32_t) latency_ns : UINT32_MAX;
+        replay_latencies.counts[callback] = count + 1;
+    }
+}
+
+static struct mediatek_gps_sv_status replay_sv_status;
+
+static void replay_event(struct replay_event* event) {
+    int64_t start_time_ns;
+
+    switch (event->type) {
+    case REPLAY_EVENT_LOCATION:
+        event->location.timestamp = get_utc_time_ms();
+
+        start_time_ns = get_monotonic_time_ns();
+        current_callbacks->location_cb(&event->location);
+        record_latency(GPS_REPLAY_CALLBACK_LOCATION, start_time_ns);
+        break;
+    case REPLAY_EVENT_SV_STATUS:
+        // Like the engine, the SV status is always reported in the same
+        // buffer, which was just written before calling the callback.
+        memcpy(&replay_sv_status, event->sv_status, sizeof(struct mediatek_gps_sv_status));
+
+        start_time_ns = get_monotonic_time_ns();
+        current_callbacks->sv_status_cb(&replay_sv_status);
+        record_latency(GPS_REPLAY_CALLBACK_SV_STATUS, start_time_ns);
+        break;
+    case REPLAY_EVENT_NMEA: {
+        GpsUtcTime timestamp = get_utc_time_ms();
+        int length = (int) strlen(event->nmea);
+
+        start_time_ns = get_monotonic_time_ns();
+        current_callbacks->nmea_cb(timestamp, event->nmea, length);
+        record_latency(GPS_REPLAY_CALLBACK_NMEA, start_time_ns);
+        break;
+    }
+    }
+}
+
+/**
+ * Replay thread.
+ *
+ * The thread waits for the time of each event on a condition variable, so it
+ * can be woken up as soon as the module is stopped. The thread created by the
+ * create_thread callback may not be joinable, so it notifies that it finished
+ * through a semaphore.
+ */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    int running;
+    sem_t stopped;
+
+    struct recording recording;
+    double rate;
+    int loop;
+} replay_thread_state = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * Waits until the given monotonic time or until the module is stopped.
+ *
+ * Returns 1 if still running, or 0 if stopped.
+ */
+static int replay_thread_wait_until(int64_t time_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = time_ns / 1000000000;
+    deadline.tv_nsec = time_ns % 1000000000;
+
+    pthread_mutex_lock(&replay_thread_state.mutex);
+
+    while (replay_thread_state.running &&
+           pthread_cond_timedwait(&replay_thread_state.condition, &replay_thread_state.mutex, &deadline) != ETIMEDOUT) {
+    }
+
+    int running = replay_thread_state.running;
+
+    pthread_mutex_unlock(&replay_thread_state.mutex);
+
+    return running;
+}
+
+static int replay_thread_is_running() {
+    pthread_mutex_lock(&replay_thread_state.mutex);
+    int running = replay_thread_state.running;
+    pthread_mutex_unlock(&replay_thread_state.mutex);
+
+    return running;
+}
+
+/**
+ * Replays the given recording at the given rate, waiting for the time of each
+ * event with the given function; the replay is stopped early if it returns 0.
+ *
+ * Returns the number of events replayed.
+ */
+static int replay_recording(struct recording* recording, double rate, int (*wait_until)(int64_t time_ns)) {
+    if (!recording->count) {
+        return 0;
+    }
+
+    int64_t start_time_ns = get_monotonic_time_ns();
+    int64_t first_event_time_ms = recording->events[0].time_ms;
+
+    int i;
+    for (i = 0; i < recording->count; i++) {
+        struct replay_event* event = &recording->events[i];
+
+        if (rate > 0) {
+            int64_t offset_ns = (int64_t) ((event->time_ms - first_event_time_ms) * 1000000 / rate);
+            if (!wait_until(start_time_ns + offset_ns)) {
+                break;
+            }
+        }
+
+        replay_event(event);
+    }
+
+    return i;
+}
+
+static int sleep_until(int64_t time_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = time_ns / 1000000000;
+    deadline.tv_nsec = time_ns % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+
+    return 1;
+}
+
+static void replay_thread(void* arg) {
+    ALOGV("Replay thread started");
+
+    do {
+        replay_recording(&replay_thread_state.recording, replay_thread_state.rate, &replay_thread_wait_until);
+    } while (replay_thread_state.loop && replay_thread_is_running());
+
+    ALOGV("Replay thread finished");
+
+    sem_post(&replay_thread_state.stopped);
+}
+
+static int replay_interface_replay(const char* path, double rate) {
+    if (!current_callbacks) {
+        return -EINVAL;
+    }
+
+    if (replay_thread_is_running()) {
+        return -EBUSY;
+    }
+
+    struct recording recording;
+    int result = recording_load(path, &recording);
+    if (result < 0) {
+        return result;
+    }
+
+    memset(replay_latencies.counts, 0, sizeof(replay_latencies.counts));
+
+    result = replay_recording(&recording, rate, &sleep_until);
+
+    recording_free(&recording);
+
+    return result;
+}
+
+static int replay_interface_get_latencies(int callback, uint32_t* latencies_ns, int max) {
+    if (callback < 0 || callback >= GPS_REPLAY_CALLBACK_COUNT || max < 0) {
+        return 0;
+    }
+
+    int count = replay_latencies.counts[callback];
+    count = count < max ? count : max;
+
+    memcpy(latencies_ns, replay_latencies.latencies_ns[callback], count * sizeof(uint32_t));
+
+    return count;
+}
+
+static int replay_interface_get_injected_count(int aiding_data) {
+    if (aiding_data < 0 || aiding_data >= GPS_REPLAY_INJECTED_COUNT) {
+        return 0;
+    }
+
+    return replay_injected_counts[aiding_data];
+}
+
+static const GpsReplayInterface replay_interface = {
+    .size = sizeof(GpsReplayInterface),
+    .replay = &replay_interface_replay,
+    .get_latencies = &replay_interface_get_latencies,
+    .get_injected_count = &replay_interface_get_injected_count,
+};
+
+static void report_status(GpsStatusValue value) {
+    GpsStatus status;
+    status.size = sizeof(GpsStatus);
+    status.status = value;
+
+    current_callbacks->status_cb(&status);
+}
+
+static int replay_gps_init(struct mediatek_gps_callbacks* callbacks) {
+    ALOGV("Initing replay GPS interface");
+
+    if (!callbacks || callbacks->size != sizeof(struct mediatek_gps_callbacks)) {
+        ALOGE("Unexpected GpsCallbacks size: %zu", callbacks ? callbacks->size : 0);
+
+        return -EINVAL;
+    }
+
+    current_callbacks = callbacks;
+
+    memset(replay_injected_counts, 0, sizeof(replay_injected_counts));
+
+    recording_free(&replay_thread_state.recording);
+
+    const char* path = getenv("GPS_REPLAY_PATH");
+    if (path && *path) {
+        int result = recording_load(path, &replay_thread_state.recording);
+        if (result < 0) {
+            return result;
+        }
+
+        const char* rate = getenv("GPS_REPLAY_RATE");
+        replay_thread_state.rate = rate && *rate ? strtod(rate, NULL) : 1;
+        replay_thread_state.loop = getenv("GPS_REPLAY_LOOP") != NULL;
+
+        ALOGI("Recording '%s' loaded; %d events, replayed at rate %g", path, replay_thread_state.recording.count, replay_thread_state.rate);
+    }
+
+    report_status(GPS_STATUS_ENGINE_ON);
+
+    return 0;
+}
+
+static int replay_gps_start() {
+    ALOGV("Starting replay GPS interface");
+
+    if (!current_callbacks) {
+        return -EINVAL;
+    }
+
+    if (replay_thread_is_running()) {
+        return 0;
+    }
+
+    report_status(GPS_STATUS_SESSION_BEGIN);
+
+    if (!replay_thread_state.recording.count) {
+        return 0;
+    }
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&replay_thread_state.condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    sem_init(&replay_thread_state.stopped, 0, 0);
+
+    replay_thread_state.running = 1;
+
+    if (!current_callbacks->create_thread_cb("gps.replay", &replay_thread, NULL)) {
+        ALOGE("Could not create replay thread");
+
+        replay_thread_state.running = 0;
+
+        pthread_cond_destroy(&replay_thread_state.condition);
+        sem_destroy(&replay_thread_state.stopped);
+
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+static int replay_gps_stop() {
+    ALOGV("Stopping replay GPS interface");
+
+    if (!current_callbacks) {
+        return -EINVAL;
+    }
+
+    if (replay_thread_is_running()) {
+        pthread_mutex_lock(&replay_thread_state.mutex);
+        replay_thread_state.running = 0;
+        pthread_cond_signal(&replay_thread_state.condition);
+        pthread_mutex_unlock(&replay_thread_state.mutex);
+
+        while (sem_wait(&replay_thread_state.stopped) < 0 && errno == EINTR) {
+        }
+
+        pthread_cond_destroy(&replay_thread_state.condition);
+        sem_destroy(&replay_thread_state.stopped);
+    }
+
+    report_status(GPS_STATUS_SESSION_END);
+
+    return 0;
+}
+
+static void replay_gps_cleanup() {
+    ALOGV("Cleaning up replay GPS interface");
+
+    if (!current_callbacks) {
+        return;
+    }
+
+    replay_gps_stop();
+
+    report_status(GPS_STATUS_ENGINE_OFF);
+
+    recording_free(&replay_thread_state.recording);
+
+    current_callbacks = NULL;
+}
+
+static int replay_gps_inject_time(GpsUtcTime time, int64_t time_reference, int uncertainty) {
+    replay_injected_counts[GPS_REPLAY_INJECTED_TIME]++;
+
+    return 0;
+}
+
+static int replay_gps_inject_location(double latitude, double longitude, float accuracy) {
+    replay_injected_counts[GPS_REPLAY_INJECTED_LOCATION]++;
+
+    return 0;
+}
+
+#ifdef GPS_HAL_USES_UINT32_AIDING_DATA
+static void replay_gps_delete_aiding_data(uint16_t flags) {
+#else
+static void replay_gps_delete_aiding_data(GpsAidingData flags) {
+#endif
+}
+
+static int replay_gps_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence,
+        uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time) {
+    return 0;
+}
+
+static const void* replay_gps_get_extension(const char* name) {
+    if (!strcmp(name, GPS_REPLAY_INTERFACE)) {
+        return &replay_interface;
+    }
+
+    return NULL;
+}
+
+static const struct mediatek_gps_interface replay_gps_interface = {
+    .size = sizeof(struct mediatek_gps_interface),
+    .init = &replay_gps_init,
+    .start = &replay_gps_start,
+    .stop = &replay_gps_stop,
+    .cleanup = &replay_gps_cleanup,
+    .inject_time = &replay_gps_inject_time,
+    .inject_location = &replay_gps_inject_location,
+    .delete_aiding_data = &replay_gps_delete_aiding_data,
+    .set_position_mode = &replay_gps_set_position_mode,
+    .get_extension = &replay_gps_get_extension,
+};
+
+static const struct mediatek_gps_interface* replay_device_get_gps_interface(struct mediatek_gps_device_t* device) {
+    return &replay_gps_interface;
+}
+
+static int replay_device_close(struct hw_device_t* device) {
+    free(device);
+
+    return 0;
+}
+
+static int replay_module_open(const struct hw_module_t* module, const char* name, struct hw_device_t** device) {
+    struct mediatek_gps_device_t* replay_device = calloc(1, sizeof(struct mediatek_gps_device_t));
+    if (!replay_device) {
+        return -ENOMEM;
+    }
+
+    replay_device->common.tag = HARDWARE_DEVICE_TAG;
+    replay_device->common.version = HARDWARE_DEVICE_API_VERSION(1, 0);
+    replay_device->common.module = (struct hw_module_t*) module;
+    replay_device->common.close = &replay_device_close;
+    replay_device->get_gps_interface = &replay_device_get_gps_interface;
+
+    *device = (struct hw_device_t*) replay_device;
+
+    return 0;
+}
+
+static struct hw_module_methods_t replay_module_methods = {
+    .open = replay_module_open,
+};
+
+struct hw_module_t HAL_MODULE_INFO_SYM = {
+    .tag = HARDWARE_MODULE_TAG,
+    .module_api_version = HARDWARE_MODULE_API_VERSION(1, 0),
+    .hal_api_version = HARDWARE_HAL_API_VERSION,
+    .id = GPS_HARDWARE_MODULE_ID,
+    .name = "fp1 GPS replay HAL module",
+    .author = "Daniel Calviño Sánchez",
+    .methods = &replay_module_methods,
+};
@@ -15,6 +15,12 @@
 
 LOCAL_PATH:= $(call my-dir)
 
+WLAN_IFACE_CTRL_CFLAGS :=
+
+ifneq ($(FP1_BOOT_TRACE),)
+    WLAN_IFACE_CTRL_CFLAGS += -DFP1_BOOT_TRACE
+endif
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := mt6628_wlan_iface_ctrl.c
@@ -23,6 +29,50 @@ LOCAL_SHARED_LIBRARIES := \
     libcutils \
     liblog
 
+LOCAL_STATIC_LIBRARIES := libboottrace_fp1
+
 LOCAL_MODULE := mt6628_wlan_iface_ctrl
 
+LOCAL_CFLAGS += $(WLAN_IFACE_CTRL_CFLAGS)
+
 include $(BUILD_EXECUTABLE)
+
+
+
+# Host build of the helper command, so the interface control path can be
+# exercised and measured off-device with fake devices (see the
+# WLAN_IFACE_CTRL_WMTWIFI_PATH and WLAN_IFACE_CTRL_P2P_PATH environment
+# variables).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := mt6628_wlan_iface_ctrl.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../../include
+
+LOCAL_STATIC_LIBRARIES := \
+    libboottrace_fp1 \
+    libcutils \
+    liblog
+
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE := mt6628_wlan_iface_ctrl
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += $(WLAN_IFACE_CTRL_CFLAGS)
+LOCAL_CFLAGS += -DWLAN_IFACE_CTRL_HOST_BUILD
+
+include $(BUILD_HOST_EXECUTABLE)
+
+
+
+# Stand-in for "/dev/wmtWifi" and the p2p0 ioctl used by the host build (see
+# host_bench.sh).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fake_wmtwifi.c
+
+LOCAL_MODULE := fake_wmtwifi
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
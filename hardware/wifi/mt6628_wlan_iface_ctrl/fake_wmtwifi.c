@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/**
+ * Stand-in for "/dev/wmtWifi" and the p2p0 private ioctl, used to run the host
+ * build of mt6628_wlan_iface_ctrl.
+ *
+ * Creates two FIFOs, one for wlan0 and one for p2p0, that have to be set in the
+ * WLAN_IFACE_CTRL_WMTWIFI_PATH and WLAN_IFACE_CTRL_P2P_PATH environment
+ * variables. The orders written by mt6628_wlan_iface_ctrl to them ("1" to add
+ * and "0" to remove) are performed after the given delay by adding or removing
+ * a fake interface with the same name, like the kernel module does
+ * asynchronously for the real interfaces.
+ *
+ * The fake interfaces are real net interfaces of the given kind ("ifb" by
+ * default), so mt6628_wlan_iface_ctrl sees them through rtnetlink. Adding them
+ * needs CAP_NET_ADMIN, so this should be run in its own network namespace (for
+ * example, with "unshare -rn"), together with mt6628_wlan_iface_ctrl; see
+ * host_bench.sh.
+ *
+ * Usage: fake_wmtwifi [-d DELAY_MS] [-k KIND] WMTWIFI_PATH P2P_PATH
+ */
+#define DEFAULT_DELAY_MS 50
+#define DEFAULT_KIND "ifb"
+
+#define NETLINK_BUFFER_SIZE 1024
+
+struct fake_device {
+    const char* path;
+    const char* interface;
+    int fd;
+};
+
+static void add_attribute(struct nlmsghdr* header, int type, const void* data, int length) {
+    struct rtattr* attribute = (struct rtattr*) ((char*) header + NLMSG_ALIGN(header->nlmsg_len));
+
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(length);
+    memcpy(RTA_DATA(attribute), data, length);
+
+    header->nlmsg_len = NLMSG_ALIGN(header->nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+}
+
+/**
+ * Adds or removes the interface. Returns 0 on success, or a negative error
+ * code.
+ */
+static int ctrl_interface(int netlink_fd, const char* interface, const char* kind, int add) {
+    char buffer[NETLINK_BUFFER_SIZE];
+    memset(buffer, 0, sizeof(buffer));
+
+    struct nlmsghdr* header = (struct nlmsghdr*) buffer;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    header->nlmsg_type = add ? RTM_NEWLINK : RTM_DELLINK;
+    header->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | (add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+
+    struct ifinfomsg* info = (struct ifinfomsg*) NLMSG_DATA(header);
+    info->ifi_family = AF_UNSPEC;
+
+    add_attribute(header, IFLA_IFNAME, interface, strlen(interface) + 1);
+
+    if (add) {
+        struct rtattr* link_info = (struct rtattr*) ((char*) header + NLMSG_ALIGN(header->nlmsg_len));
+        add_attribute(header, IFLA_LINKINFO, NULL, 0);
+        add_attribute(header, IFLA_INFO_KIND, kind, strlen(kind));
+        link_info->rta_len = (char*) header + header->nlmsg_len - (char*) link_info;
+    }
+
+    if (send(netlink_fd, header, header->nlmsg_len, 0) < 0) {
+        return -errno;
+    }
+
+    ssize_t length = recv(netlink_fd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+        return -errno;
+    }
+
+    if (header->nlmsg_type == NLMSG_ERROR) {
+        return ((struct nlmsgerr*) NLMSG_DATA(header))->error;
+    }
+
+    return 0;
+}
+
+/**
+ * Opens the FIFO in the given path, creating it if needed. It is opened for
+ * reading and writing, so it does not report the end of file when
+ * mt6628_wlan_iface_ctrl closes it.
+ */
+static int open_fifo(const char* path) {
+    if (mkfifo(path, 0600) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    }
+
+    return fd;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-d DELAY_MS] [-k KIND] WMTWIFI_PATH P2P_PATH\n", name);
+}
+
+int main(int argc, char** argv) {
+    int delay_ms = DEFAULT_DELAY_MS;
+    const char* kind = DEFAULT_KIND;
+
+    int option;
+    while ((option = getopt(argc, argv, "d:k:")) != -1) {
+        switch (option) {
+        case 'd':
+            delay_ms = atoi(optarg);
+            break;
+        case 'k':
+            kind = optarg;
+            break;
+        default:
+            usage(argv[0]);
+
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    struct fake_device devices[] = {
+        { argv[optind], "wlan0", -1 },
+        { argv[optind + 1], "p2p0", -1 },
+    };
+
+    int netlink_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (netlink_fd < 0) {
+        fprintf(stderr, "Could not create netlink socket: %s\n", strerror(errno));
+
+        return 1;
+    }
+
+    struct pollfd poll_fds[2];
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        devices[i].fd = open_fifo(devices[i].path);
+        if (devices[i].fd < 0) {
+            return 1;
+        }
+
+        poll_fds[i].fd = devices[i].fd;
+        poll_fds[i].events = POLLIN;
+    }
+
+    for (;;) {
+        if (poll(poll_fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "Could not poll: %s\n", strerror(errno));
+
+            return 1;
+        }
+
+        for (i = 0; i < 2; i++) {
+            if (!poll_fds[i].revents) {
+                continue;
+            }
+
+            char orders[64];
+            ssize_t length = read(devices[i].fd, orders, sizeof(orders));
+            if (length < 0) {
+                fprintf(stderr, "Could not read %s: %s\n", devices[i].path, strerror(errno));
+
+                return 1;
+            }
+
+            // Each order is written with its terminating null character, and
+            // several orders may be read at once.
+            ssize_t j;
+            for (j = 0; j < length; j++) {
+                if (orders[j] != '0' && orders[j] != '1') {
+                    continue;
+                }
+
+                usleep(delay_ms * 1000);
+
+                int result = ctrl_interface(netlink_fd, devices[i].interface, kind, orders[j] == '1');
+                if (result < 0) {
+                    fprintf(stderr, "Could not %s %s: %s\n", orders[j] == '1' ? "add" : "remove",
+                            devices[i].interface, strerror(-result));
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+# Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Host harness for mt6628_wlan_iface_ctrl.
+#
+# Runs the host builds of mt6628_wlan_iface_ctrl and fake_wmtwifi in their own
+# network namespace (so the fake interfaces can be added without being root and
+# without touching the host interfaces). First the "bench" command is run with
+# the given number of cycles, and then the daemon is started and the "add",
+# "status", "remove" and "stats" requests are sent to it.
+#
+# The binaries are looked for in $ANDROID_HOST_OUT/bin unless the directory is
+# given in the WLAN_IFACE_CTRL_HOST_BIN environment variable.
+#
+# Usage: host_bench.sh [-d DELAY_MS] [CYCLES]
+
+DELAY_MS=50
+CYCLES=1000
+
+if [ "$1" = "-d" ]; then
+    DELAY_MS="$2"
+    shift 2
+fi
+
+if [ -n "$1" ]; then
+    CYCLES="$1"
+fi
+
+BIN="${WLAN_IFACE_CTRL_HOST_BIN:-$ANDROID_HOST_OUT/bin}"
+
+if [ ! -x "$BIN/mt6628_wlan_iface_ctrl" ] || [ ! -x "$BIN/fake_wmtwifi" ]; then
+    echo "mt6628_wlan_iface_ctrl and fake_wmtwifi not found in $BIN" >&2
+    exit 1
+fi
+
+# Run again in a new user and network namespace.
+if [ -z "$WLAN_IFACE_CTRL_HOST_NAMESPACE" ]; then
+    WLAN_IFACE_CTRL_HOST_NAMESPACE=1 WLAN_IFACE_CTRL_HOST_BIN="$BIN" exec unshare -rn "$0" -d "$DELAY_MS" "$CYCLES"
+fi
+
+TMP_DIR=$(mktemp -d)
+
+export WLAN_IFACE_CTRL_WMTWIFI_PATH="$TMP_DIR/wmtWifi"
+export WLAN_IFACE_CTRL_P2P_PATH="$TMP_DIR/p2p"
+export WLAN_IFACE_CTRL_SOCKET_PATH="$TMP_DIR/wlan_iface_ctrl"
+
+"$BIN/fake_wmtwifi" -d "$DELAY_MS" "$WLAN_IFACE_CTRL_WMTWIFI_PATH" "$WLAN_IFACE_CTRL_P2P_PATH" &
+FAKE_PID=$!
+
+DAEMON_PID=
+
+function cleanup() {
+    if [ -n "$DAEMON_PID" ]; then
+        kill $DAEMON_PID
+    fi
+    kill $FAKE_PID
+    rm -rf "$TMP_DIR"
+}
+
+trap cleanup EXIT
+
+# Wait for the FIFOs to be created.
+while [ ! -p "$WLAN_IFACE_CTRL_WMTWIFI_PATH" ] || [ ! -p "$WLAN_IFACE_CTRL_P2P_PATH" ]; do
+    sleep 0.1
+done
+
+echo "Bench ($CYCLES cycles, $DELAY_MS ms delay):"
+"$BIN/mt6628_wlan_iface_ctrl" bench "$CYCLES" || exit 1
+
+"$BIN/mt6628_wlan_iface_ctrl" daemon &
+DAEMON_PID=$!
+
+while [ ! -S "$WLAN_IFACE_CTRL_SOCKET_PATH" ]; do
+    sleep 0.1
+done
+
+echo "Daemon:"
+for REQUEST in add status remove status stats; do
+    "$BIN/mt6628_wlan_iface_ctrl" $REQUEST || exit 1
+done
@@ -17,18 +17,28 @@
 
 #define LOG_TAG "mt6628_wlan_iface_ctrl"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <linux/socket.h>
 #include <linux/wireless.h>
 
 #include <cutils/log.h>
 #include <cutils/properties.h>
+#include <cutils/sockets.h>
+
+#include <boottrace_fp1.h>
 
 // From "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/include/gl_wext_priv.h"
 #define IOCTL_SET_INT        (SIOCIWFIRSTPRIV+0)
@@ -37,6 +47,38 @@
 #define CMD_REMOVE 0
 #define CMD_ADD 1
 
+#ifndef WMTWIFI_DEVICE_PATH
+#define WMTWIFI_DEVICE_PATH "/dev/wmtWifi"
+#endif
+
+// Name of the init socket used in daemon mode.
+#define CTRL_SOCKET_NAME "wlan_iface_ctrl"
+
+#define CTRL_REQUEST_MAX 64
+#define CTRL_REPLY_MAX 128
+
+// Time to wait for a request from a connected client before dropping it, in
+// seconds.
+#define CTRL_CLIENT_TIMEOUT 10
+
+// Maximum number of clients connected at the same time to the daemon.
+#define CTRL_MAX_CLIENTS 8
+
+// Time to wait for the reply from the daemon, in seconds; the interfaces are
+// expected to be added or removed in well less than that.
+#define CTRL_REPLY_TIMEOUT 10
+
+// Time to wait for an interface to appear or disappear once the kernel was
+// ordered to add or remove it, in milliseconds. The Wi-Fi HAL waits 5 seconds
+// for the whole request, so the wait for both interfaces must be shorter.
+#define IFACE_WAIT_TIMEOUT_MS 2000
+
+#define NETLINK_BUFFER_SIZE 8192
+
+// Times that the dump of the links is requested if the socket buffer overflowed
+// while receiving it.
+#define NETLINK_DUMP_ATTEMPTS 3
+
 /**
  * Helper command to add and remove the wlan0 and p2p0 net interfaces.
  *
@@ -53,28 +95,396 @@
  * explicitly by using "mknod /dev/wmtWifi c 153 0"; this helper command also
  * expects the "/dev/wmtWifi" to be already created when executed.
  *
- * When this helper command is executed a system property name can be provided
- * to store in it the result of the execution (either "ok" or "failed"). This
- * makes possible to define a one shot service for this command and be able to
- * check its result once finished.
+ * The helper command can be run as a daemon ("daemon" argument) to avoid
+ * spawning a process each time that the interfaces are added or removed. The
+ * daemon keeps "/dev/wmtWifi" and the ioctl socket open, and serves requests
+ * received through the CTRL_SOCKET_NAME init socket (a SOCK_SEQPACKET socket).
+ * Each request is a single message with the command ("add", "remove" or
+ * "status"), and it is replied synchronously, once the command was performed,
+ * with "ok" or "failed"; the reply to "status" is followed by the interfaces
+ * that are currently added, separated by spaces.
+ *
+ * When executed with a command instead, if the daemon is running the command
+ * just forwards it to the daemon; otherwise it performs the command itself.
+ *
+ * Wi-Fi can be toggled quickly (for example, when airplane mode is toggled),
+ * so the daemon can defer removing the interfaces for a grace period
+ * ("grace-period=<milliseconds>" argument after "daemon"). "remove" is replied
+ * at once, and the interfaces are removed only if they are not added again
+ * before the grace period ends; if they are, adding them is immediate. Besides
+ * that, when several clients send "add" and "remove" requests at the same time
+ * only the last one received is performed; the requests with the same command
+ * get its reply, and the others are replied with "superseded". The "stats"
+ * request, only served by the daemon, replies with the number of orders sent
+ * to the kernel and of the requests that did not need one.
+ *
+ * The kernel adds and removes the interfaces asynchronously, so after sending
+ * each order the helper command waits (up to IFACE_WAIT_TIMEOUT_MS) until the
+ * interface actually appears or disappears, and only then the command is
+ * considered successful. Which interfaces exist is tracked with the link
+ * events from rtnetlink, starting from a dump of the links requested at the
+ * beginning of each command.
+ *
+ * The "bench" command (followed by the number of cycles) adds and removes the
+ * interfaces the given number of times, and prints the percentiles of the time
+ * taken to add them, to remove them and to do both (a toggle). It is meant to
+ * be run by hand with Wi-Fi disabled, so the requests are never forwarded to
+ * the daemon.
+ *
+ * In the host build (WLAN_IFACE_CTRL_HOST_BUILD) the device used to control
+ * wlan0 can be set with the WLAN_IFACE_CTRL_WMTWIFI_PATH environment variable,
+ * and if WLAN_IFACE_CTRL_P2P_PATH is set the orders to control p2p0 are written
+ * to that file ("1" to add and "0" to remove, like for wlan0) instead of sent
+ * with the private ioctl. Besides that, if WLAN_IFACE_CTRL_SOCKET_PATH is set
+ * the daemon listens on a socket created in that path instead of on the init
+ * socket, and the commands connect to it. Fake devices (see fake_wmtwifi.c and
+ * host_bench.sh) can be used then to exercise and measure the whole path
+ * off-device, including the daemon.
+ *
+ * When this helper command is executed with a command a system property name
+ * can be provided to store in it the result of the execution (either "ok" or
+ * "failed"). This makes possible to define a one shot service for this command
+ * and be able to check its result once finished.
  *
  * As this helper command is expected to be used through an init service its
  * output is written to the Android log instead of to the standard console.
  */
 
-static int is_cmd_needed(int cmd, const char* interface) {
-    char interface_path[256];
-    snprintf(interface_path, sizeof(interface_path), "/sys/class/net/%s", interface);
+/**
+ * File descriptors used to control the interfaces; they are opened when first
+ * needed and, in daemon mode, kept open between requests. If an operation on
+ * any of them fails it is closed, so it is opened again for the next request.
+ *
+ * The netlink socket is subscribed to the link events, and wlan0_exists and
+ * p2p0_exists are updated from them.
+ */
+struct iface_ctrl {
+    int wmtWifi_fd;
+    int ioctl_fd;
+
+    int netlink_fd;
+    uint32_t netlink_seq;
+
+    int wlan0_exists;
+    int p2p0_exists;
+
+    // Number of orders sent to the kernel to add or remove an interface.
+    uint32_t transitions;
+};
+
+static void iface_ctrl_init(struct iface_ctrl* ctrl) {
+    ctrl->wmtWifi_fd = -1;
+    ctrl->ioctl_fd = -1;
+    ctrl->netlink_fd = -1;
+    ctrl->netlink_seq = 0;
+    ctrl->wlan0_exists = 0;
+    ctrl->p2p0_exists = 0;
+    ctrl->transitions = 0;
+}
+
+static void iface_ctrl_close(struct iface_ctrl* ctrl) {
+    if (ctrl->wmtWifi_fd >= 0) {
+        close(ctrl->wmtWifi_fd);
+        ctrl->wmtWifi_fd = -1;
+    }
+
+    if (ctrl->ioctl_fd >= 0) {
+        close(ctrl->ioctl_fd);
+        ctrl->ioctl_fd = -1;
+    }
+
+    if (ctrl->netlink_fd >= 0) {
+        close(ctrl->netlink_fd);
+        ctrl->netlink_fd = -1;
+    }
+}
+
+static int64_t get_monotonic_time_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t get_monotonic_time_ms() {
+    return get_monotonic_time_us() / 1000;
+}
+
+/**
+ * Returns the path to the device used to control the wlan0 interface.
+ */
+static const char* get_wmtWifi_path() {
+#ifdef WLAN_IFACE_CTRL_HOST_BUILD
+    const char* wmtWifi_path = getenv("WLAN_IFACE_CTRL_WMTWIFI_PATH");
+    if (wmtWifi_path && *wmtWifi_path) {
+        return wmtWifi_path;
+    }
+#endif
+
+    return WMTWIFI_DEVICE_PATH;
+}
+
+/**
+ * Returns the path to the file used to control the p2p0 interface instead of
+ * the private ioctl, or NULL if the ioctl has to be used.
+ */
+static const char* get_p2p_path() {
+#ifdef WLAN_IFACE_CTRL_HOST_BUILD
+    const char* p2p_path = getenv("WLAN_IFACE_CTRL_P2P_PATH");
+    if (p2p_path && *p2p_path) {
+        return p2p_path;
+    }
+#endif
+
+    return NULL;
+}
+
+/**
+ * Returns the path to the socket used by the daemon instead of the init socket,
+ * or NULL if the init socket has to be used.
+ */
+static const char* get_socket_path() {
+#ifdef WLAN_IFACE_CTRL_HOST_BUILD
+    const char* socket_path = getenv("WLAN_IFACE_CTRL_SOCKET_PATH");
+    if (socket_path && *socket_path) {
+        return socket_path;
+    }
+#endif
+
+    return NULL;
+}
+
+static int* get_interface_exists(struct iface_ctrl* ctrl, const char* interface) {
+    if (!strcmp(interface, "wlan0")) {
+        return &ctrl->wlan0_exists;
+    }
+
+    if (!strcmp(interface, "p2p0")) {
+        return &ctrl->p2p0_exists;
+    }
+
+    return NULL;
+}
+
+static void netlink_process_link(struct iface_ctrl* ctrl, const struct nlmsghdr* header) {
+    const struct ifinfomsg* info = (const struct ifinfomsg*) NLMSG_DATA(header);
+    int attributes_length = (int) header->nlmsg_len - NLMSG_LENGTH(sizeof(*info));
+
+    const struct rtattr* attribute;
+    for (attribute = IFLA_RTA(info); RTA_OK(attribute, attributes_length); attribute = RTA_NEXT(attribute, attributes_length)) {
+        if (attribute->rta_type != IFLA_IFNAME) {
+            continue;
+        }
+
+        int* exists = get_interface_exists(ctrl, (const char*) RTA_DATA(attribute));
+        if (exists) {
+            *exists = (header->nlmsg_type == RTM_NEWLINK);
+        }
+
+        return;
+    }
+}
+
+/**
+ * Processes the messages in the buffer. Returns 1 if the end of the dump with
+ * the given sequence number was found, a negative error code if the dump
+ * failed, or 0 otherwise.
+ */
+static int netlink_process(struct iface_ctrl* ctrl, const char* buffer, int length, uint32_t dump_seq) {
+    int result = 0;
+
+    const struct nlmsghdr* header;
+    for (header = (const struct nlmsghdr*) buffer; NLMSG_OK(header, (unsigned int) length); header = NLMSG_NEXT(header, length)) {
+        if (header->nlmsg_type == RTM_NEWLINK || header->nlmsg_type == RTM_DELLINK) {
+            netlink_process_link(ctrl, header);
+        } else if (header->nlmsg_type == NLMSG_DONE && header->nlmsg_seq == dump_seq) {
+            result = 1;
+        } else if (header->nlmsg_type == NLMSG_ERROR && header->nlmsg_seq == dump_seq) {
+            const struct nlmsgerr* error = (const struct nlmsgerr*) NLMSG_DATA(header);
+            if (error->error) {
+                result = error->error;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Waits up to timeout_ms for messages and processes them. Returns the result of
+ * netlink_process, -ETIMEDOUT if no message was received, or a negative error
+ * code.
+ */
+static int netlink_receive(struct iface_ctrl* ctrl, int timeout_ms, uint32_t dump_seq) {
+    struct pollfd poll_fd = { ctrl->netlink_fd, POLLIN, 0 };
+
+    int ready = poll(&poll_fd, 1, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+    if (ready == 0) {
+        return -ETIMEDOUT;
+    }
+
+    char buffer[NETLINK_BUFFER_SIZE];
+    ssize_t length = recv(ctrl->netlink_fd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+        return -errno;
+    }
+
+    return netlink_process(ctrl, buffer, length, dump_seq);
+}
+
+/**
+ * Requests a dump of all the links and processes it, together with any link
+ * event received before it. Returns 0 on success, or a negative error code.
+ *
+ * If the socket buffer overflowed (for example, because in daemon mode the link
+ * events are not received between requests) the pending error is reported
+ * instead of the dump, and part of the dump could be lost too, so the dump is
+ * requested again.
+ */
+static int netlink_dump_links(struct iface_ctrl* ctrl) {
+    int result;
+    int attempt;
+
+    for (attempt = 0; attempt < NETLINK_DUMP_ATTEMPTS; attempt++) {
+        struct {
+            struct nlmsghdr header;
+            struct ifinfomsg info;
+        } request;
+        memset(&request, 0, sizeof(request));
+
+        request.header.nlmsg_len = NLMSG_LENGTH(sizeof(request.info));
+        request.header.nlmsg_type = RTM_GETLINK;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++ctrl->netlink_seq;
+        request.info.ifi_family = AF_UNSPEC;
+
+        if (send(ctrl->netlink_fd, &request, request.header.nlmsg_len, 0) < 0) {
+            ALOGE("Could not request the dump of the links: %s", strerror(errno));
+
+            return -errno;
+        }
+
+        // The links are dumped as soon as requested, so the timeout just
+        // guards against a kernel that never ends the dump.
+        while ((result = netlink_receive(ctrl, IFACE_WAIT_TIMEOUT_MS, request.header.nlmsg_seq)) == 0) {
+        }
+
+        if (result != -ENOBUFS) {
+            break;
+        }
+
+        ALOGW("Link events lost; dumping the links again");
+    }
+
+    if (result < 0) {
+        ALOGE("Could not dump the links: %s", strerror(-result));
+
+        return result;
+    }
+
+    return 0;
+}
+
+/**
+ * Gets the current state of the interfaces, opening and subscribing the
+ * netlink socket if needed. Returns 0 on success, or a negative error code.
+ */
+static int iface_ctrl_refresh(struct iface_ctrl* ctrl) {
+    if (ctrl->netlink_fd < 0) {
+        ctrl->netlink_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+        if (ctrl->netlink_fd < 0) {
+            ALOGE("Could not create netlink socket: %s", strerror(errno));
+
+            return -errno;
+        }
+
+        struct sockaddr_nl address;
+        memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = RTMGRP_LINK;
+
+        if (bind(ctrl->netlink_fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+            int error = errno;
+
+            ALOGE("Could not subscribe to link events: %s", strerror(error));
+
+            close(ctrl->netlink_fd);
+            ctrl->netlink_fd = -1;
+
+            return -error;
+        }
+    }
+
+    // In daemon mode the events received since the previous request could
+    // have overflowed the socket buffer; the dump is requested again in that
+    // case, so it gets the right state anyway.
+    int result = netlink_dump_links(ctrl);
+    if (result < 0) {
+        close(ctrl->netlink_fd);
+        ctrl->netlink_fd = -1;
+    }
+
+    return result;
+}
+
+/**
+ * Waits until the interface exists (or not, depending on the given value).
+ * Returns 0 on success, or a negative error code.
+ */
+static int wait_for_interface(struct iface_ctrl* ctrl, const char* interface, int exists) {
+    int* current = get_interface_exists(ctrl, interface);
+
+    int64_t deadline = get_monotonic_time_ms() + IFACE_WAIT_TIMEOUT_MS;
+
+    char step[BOOTTRACE_FP1_NAME_MAX];
+    snprintf(step, sizeof(step), "wait %s %s", interface, exists ? "added" : "removed");
+
+    BOOTTRACE_BEGIN(step);
+
+    int ret = 0;
+
+    while (*current != exists) {
+        int64_t remaining = deadline - get_monotonic_time_ms();
+        if (remaining <= 0) {
+            ALOGE("Interface %s was not %s in %d ms", interface, exists ? "added" : "removed", IFACE_WAIT_TIMEOUT_MS);
+
+            ret = -ETIMEDOUT;
+
+            break;
+        }
+
+        int result = netlink_receive(ctrl, (int) remaining, 0);
+        if (result == -ENOBUFS) {
+            // Some events were lost, so the current state is got again.
+            result = netlink_dump_links(ctrl);
+        }
+        if (result < 0 && result != -ETIMEDOUT) {
+            ALOGE("Could not receive link events: %s", strerror(-result));
 
-    int interface_exists = (access(interface_path, F_OK) == 0);
+            ret = result;
 
-    if (interface_exists && cmd == CMD_ADD) {
+            break;
+        }
+    }
+
+    BOOTTRACE_END(step);
+
+    return ret;
+}
+
+static int is_cmd_needed(struct iface_ctrl* ctrl, int cmd, const char* interface) {
+    int exists = *get_interface_exists(ctrl, interface);
+
+    if (exists && cmd == CMD_ADD) {
         ALOGI("Interface %s has been added already", interface);
 
         return 0;
     }
 
-    if (!interface_exists && cmd == CMD_REMOVE) {
+    if (!exists && cmd == CMD_REMOVE) {
         ALOGI("Interface %s has been removed already", interface);
 
         return 0;
@@ -83,16 +493,18 @@ static int is_cmd_needed(int cmd, const char* interface) {
     return 1;
 }
 
-static int ctrl_wlan0(int cmd) {
-    if (!is_cmd_needed(cmd, "wlan0")) {
+static int ctrl_wlan0(struct iface_ctrl* ctrl, int cmd) {
+    if (!is_cmd_needed(ctrl, cmd, "wlan0")) {
         return 0;
     }
 
-    int fd = open("/dev/wmtWifi", O_WRONLY);
-    if (fd < 0) {
-        ALOGE("Could not open /dev/wmtWifi to control the wlan0 interface: %s", strerror(errno));
+    if (ctrl->wmtWifi_fd < 0) {
+        ctrl->wmtWifi_fd = open(get_wmtWifi_path(), O_WRONLY);
+        if (ctrl->wmtWifi_fd < 0) {
+            ALOGE("Could not open %s to control the wlan0 interface: %s", get_wmtWifi_path(), strerror(errno));
 
-        return -errno;
+            return -errno;
+        }
     }
 
     char wmtWifi_cmd[2];
@@ -102,29 +514,76 @@ static int ctrl_wlan0(int cmd) {
         strcpy(wmtWifi_cmd, "0");
     }
 
-    if (write(fd, &wmtWifi_cmd, sizeof(wmtWifi_cmd)) < 0) {
-        ALOGE("Could not write to /dev/wmtWifi to control the wlan0 interface: %s", strerror(errno));
+    if (write(ctrl->wmtWifi_fd, &wmtWifi_cmd, sizeof(wmtWifi_cmd)) < 0) {
+        int error = errno;
 
-        close(fd);
+        ALOGE("Could not write to %s to control the wlan0 interface: %s", get_wmtWifi_path(), strerror(error));
+
+        close(ctrl->wmtWifi_fd);
+        ctrl->wmtWifi_fd = -1;
+
+        return -error;
+    }
+
+    ctrl->transitions++;
+
+    return wait_for_interface(ctrl, "wlan0", cmd == CMD_ADD);
+}
+
+/**
+ * Controls the p2p0 interface through the file set in the host build, the same
+ * way as wlan0 is controlled through "/dev/wmtWifi". The file is opened for
+ * each order, as it is just a stand-in for the ioctl.
+ */
+static int ctrl_p2p0_file(const char* p2p_path, int cmd) {
+    int fd = open(p2p_path, O_WRONLY);
+    if (fd < 0) {
+        ALOGE("Could not open %s to control the p2p0 interface: %s", p2p_path, strerror(errno));
 
         return -errno;
     }
 
+    const char* p2p_cmd = cmd == CMD_ADD ? "1" : "0";
+
+    if (write(fd, p2p_cmd, 2) < 0) {
+        int error = errno;
+
+        ALOGE("Could not write to %s to control the p2p0 interface: %s", p2p_path, strerror(error));
+
+        close(fd);
+
+        return -error;
+    }
+
     close(fd);
 
     return 0;
 }
 
-static int ctrl_p2p0(int cmd) {
-    if (!is_cmd_needed(cmd, "p2p0")) {
+static int ctrl_p2p0(struct iface_ctrl* ctrl, int cmd) {
+    if (!is_cmd_needed(ctrl, cmd, "p2p0")) {
         return 0;
     }
 
-    int fd = socket(PF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        ALOGE("Could not create socket to control the p2p0 interface: %s", strerror(errno));
+    const char* p2p_path = get_p2p_path();
+    if (p2p_path) {
+        int result = ctrl_p2p0_file(p2p_path, cmd);
+        if (result < 0) {
+            return result;
+        }
 
-        return -errno;
+        ctrl->transitions++;
+
+        return wait_for_interface(ctrl, "p2p0", cmd == CMD_ADD);
+    }
+
+    if (ctrl->ioctl_fd < 0) {
+        ctrl->ioctl_fd = socket(PF_INET, SOCK_DGRAM, 0);
+        if (ctrl->ioctl_fd < 0) {
+            ALOGE("Could not create socket to control the p2p0 interface: %s", strerror(errno));
+
+            return -errno;
+        }
     }
 
     struct iwreq ioctl_data;
@@ -144,27 +603,30 @@ static int ctrl_p2p0(int cmd) {
         ioctl_data_extra[1] = 0;
     }
 
-    if (ioctl(fd, IOCTL_SET_INT, &ioctl_data) < 0) {
-        ALOGE("Could not send ioctl to control the p2p0 interface: %s", strerror(errno));
+    if (ioctl(ctrl->ioctl_fd, IOCTL_SET_INT, &ioctl_data) < 0) {
+        int error = errno;
 
-        close(fd);
+        ALOGE("Could not send ioctl to control the p2p0 interface: %s", strerror(error));
 
-        return -errno;
+        close(ctrl->ioctl_fd);
+        ctrl->ioctl_fd = -1;
+
+        return -error;
     }
 
-    close(fd);
+    ctrl->transitions++;
 
-    return 0;
+    return wait_for_interface(ctrl, "p2p0", cmd == CMD_ADD);
 }
 
-int add_interfaces() {
-    if (ctrl_wlan0(CMD_ADD) < 0) {
+static int add_interfaces(struct iface_ctrl* ctrl) {
+    if (ctrl_wlan0(ctrl, CMD_ADD) < 0) {
         ALOGE("Could not add the wlan0 interface");
 
         return 1;
     }
 
-    if (ctrl_p2p0(CMD_ADD) < 0) {
+    if (ctrl_p2p0(ctrl, CMD_ADD) < 0) {
         ALOGE("Could not add the p2p0 interface");
 
         return 1;
@@ -173,16 +635,16 @@ int add_interfaces() {
     return 0;
 }
 
-int remove_interfaces() {
+static int remove_interfaces(struct iface_ctrl* ctrl) {
     int failure = 0;
 
-    if (ctrl_p2p0(CMD_REMOVE) < 0) {
+    if (ctrl_p2p0(ctrl, CMD_REMOVE) < 0) {
         ALOGE("Could not remove the p2p0 interface");
 
         failure = 1;
     }
 
-    if (ctrl_wlan0(CMD_REMOVE) < 0) {
+    if (ctrl_wlan0(ctrl, CMD_REMOVE) < 0) {
         ALOGE("Could not remove the wlan0 interface");
 
         failure = 1;
@@ -191,22 +653,630 @@ int remove_interfaces() {
     return failure;
 }
 
+/**
+ * Performs the given request and writes the reply in the given buffer.
+ * Returns 0 if the request succeeded, 1 otherwise.
+ */
+static int handle_request(struct iface_ctrl* ctrl, const char* request, char* reply, size_t reply_size) {
+    int ret;
+
+    if (iface_ctrl_refresh(ctrl) < 0) {
+        ALOGE("Could not get the state of the interfaces");
+
+        snprintf(reply, reply_size, "failed");
+
+        return 1;
+    }
+
+    char step[BOOTTRACE_FP1_NAME_MAX];
+    snprintf(step, sizeof(step), "iface %s", request);
+
+    BOOTTRACE_BEGIN(step);
+
+    if (!strcmp(request, "add")) {
+        ret = add_interfaces(ctrl);
+        snprintf(reply, reply_size, "%s", ret ? "failed" : "ok");
+    } else if (!strcmp(request, "remove")) {
+        ret = remove_interfaces(ctrl);
+        snprintf(reply, reply_size, "%s", ret ? "failed" : "ok");
+    } else if (!strcmp(request, "status")) {
+        ret = 0;
+        snprintf(reply, reply_size, "ok%s%s",
+                 ctrl->wlan0_exists ? " wlan0" : "",
+                 ctrl->p2p0_exists ? " p2p0" : "");
+    } else {
+        ALOGE("Unknown request: '%s'", request);
+
+        ret = 1;
+        snprintf(reply, reply_size, "failed");
+    }
+
+    BOOTTRACE_END(step);
+
+    return ret;
+}
+
+/**
+ * Client connected to the daemon.
+ */
+struct ctrl_client {
+    int fd;
+    int64_t last_request_time_ms;
+
+    // Order in which the request was received, used to find the last one.
+    uint32_t request_seq;
+
+    // Request received but not served yet, if any.
+    int has_request;
+    char request[CTRL_REQUEST_MAX];
+
+    // Whether the client has to be dropped once the received requests are
+    // served.
+    int dropped;
+};
+
+/**
+ * Counters of the "add" and "remove" requests and of those that did not need
+ * any order to the kernel.
+ */
+struct ctrl_stats {
+    uint32_t requests;
+    uint32_t coalesced_requests;
+    uint32_t deferred_removes;
+    uint32_t cancelled_removes;
+};
+
+/**
+ * State of the daemon.
+ */
+struct ctrl_daemon {
+    struct iface_ctrl ctrl;
+
+    struct ctrl_client clients[CTRL_MAX_CLIENTS];
+    int num_clients;
+
+    // Time to wait before removing the interfaces, in milliseconds.
+    int grace_period_ms;
+
+    // Time at which the interfaces will be removed if they are not added
+    // again, or -1.
+    int64_t remove_deadline_ms;
+
+    // Order of the next request received.
+    uint32_t next_request_seq;
+
+    struct ctrl_stats stats;
+};
+
+static int is_state_request(const char* request) {
+    return !strcmp(request, "add") || !strcmp(request, "remove");
+}
+
+static void drop_client(struct ctrl_daemon* daemon, int index) {
+    struct ctrl_client* client = &daemon->clients[index];
+
+    close(client->fd);
+
+    daemon->num_clients--;
+    daemon->clients[index] = daemon->clients[daemon->num_clients];
+}
+
+/**
+ * Removes the interfaces for real, either once the grace period ended or right
+ * away if there is no grace period.
+ */
+static int remove_interfaces_now(struct ctrl_daemon* daemon, char* reply, size_t reply_size) {
+    daemon->remove_deadline_ms = -1;
+
+    return handle_request(&daemon->ctrl, "remove", reply, reply_size);
+}
+
+/**
+ * Performs the request like handle_request, but deferring the removal of the
+ * interfaces for the grace period, and serving "stats" too.
+ */
+static int daemon_handle_request(struct ctrl_daemon* daemon, const char* request, char* reply, size_t reply_size) {
+    if (!strcmp(request, "stats")) {
+        snprintf(reply, reply_size, "ok transitions=%u requests=%u coalesced=%u deferred=%u cancelled=%u",
+                 daemon->ctrl.transitions, daemon->stats.requests, daemon->stats.coalesced_requests,
+                 daemon->stats.deferred_removes, daemon->stats.cancelled_removes);
+
+        return 0;
+    }
+
+    if (!strcmp(request, "remove")) {
+        if (daemon->grace_period_ms <= 0) {
+            return remove_interfaces_now(daemon, reply, reply_size);
+        }
+
+        if (daemon->remove_deadline_ms < 0) {
+            daemon->remove_deadline_ms = get_monotonic_time_ms() + daemon->grace_period_ms;
+            daemon->stats.deferred_removes++;
+
+            ALOGI("Removing the interfaces in %d ms unless they are added again", daemon->grace_period_ms);
+        }
+
+        snprintf(reply, reply_size, "ok");
+
+        return 0;
+    }
+
+    if (!strcmp(request, "add") && daemon->remove_deadline_ms >= 0) {
+        daemon->remove_deadline_ms = -1;
+        daemon->stats.cancelled_removes++;
+
+        ALOGI("Pending removal of the interfaces cancelled");
+    }
+
+    return handle_request(&daemon->ctrl, request, reply, reply_size);
+}
+
+/**
+ * Receives a request from the client, if any, and marks the client to be
+ * dropped if it disconnected.
+ */
+static void receive_request(struct ctrl_daemon* daemon, struct ctrl_client* client) {
+    ssize_t length = recv(client->fd, client->request, sizeof(client->request) - 1, MSG_DONTWAIT);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (length <= 0) {
+        client->dropped = 1;
+
+        return;
+    }
+
+    client->request[length] = '\0';
+    client->has_request = 1;
+    client->last_request_time_ms = get_monotonic_time_ms();
+    client->request_seq = daemon->next_request_seq++;
+}
+
+/**
+ * Serves the requests received from the clients in the order in which they were
+ * received. Consecutive "add" and "remove" requests are coalesced: only the
+ * last one is performed, the requests with its same command are replied with
+ * its reply, and the others with "superseded", as they were not performed.
+ */
+static void serve_requests(struct ctrl_daemon* daemon) {
+    // Indexes of the clients with a request, sorted by the order in which the
+    // requests were received. The position of a client in the array has
+    // nothing to do with it, as dropping a client moves the last one.
+    int pending[CTRL_MAX_CLIENTS];
+    int num_pending = 0;
+
+    int i;
+    for (i = 0; i < daemon->num_clients; i++) {
+        if (!daemon->clients[i].has_request) {
+            continue;
+        }
+
+        int j = num_pending++;
+        while (j > 0 && (int32_t) (daemon->clients[pending[j - 1]].request_seq - daemon->clients[i].request_seq) > 0) {
+            pending[j] = pending[j - 1];
+            j--;
+        }
+        pending[j] = i;
+    }
+
+    i = 0;
+    while (i < num_pending) {
+        int last = i;
+
+        if (is_state_request(daemon->clients[pending[i]].request)) {
+            while (last + 1 < num_pending && is_state_request(daemon->clients[pending[last + 1]].request)) {
+                last++;
+            }
+        }
+
+        const char* performed_request = daemon->clients[pending[last]].request;
+
+        char reply[CTRL_REPLY_MAX];
+        daemon_handle_request(daemon, performed_request, reply, sizeof(reply));
+
+        int j;
+        for (j = i; j <= last; j++) {
+            struct ctrl_client* client = &daemon->clients[pending[j]];
+            const char* client_reply = reply;
+
+            if (is_state_request(client->request)) {
+                daemon->stats.requests++;
+            }
+
+            if (j != last) {
+                daemon->stats.coalesced_requests++;
+
+                if (strcmp(client->request, performed_request)) {
+                    client_reply = "superseded";
+                }
+
+                ALOGI("Request '%s' coalesced with '%s'", client->request, performed_request);
+            }
+
+            ALOGI("Request '%s' replied with '%s'", client->request, client_reply);
+
+            client->has_request = 0;
+
+            if (send(client->fd, client_reply, strlen(client_reply), MSG_NOSIGNAL) < 0) {
+                ALOGW("Could not send reply: %s", strerror(errno));
+
+                client->dropped = 1;
+            }
+        }
+
+        i = last + 1;
+    }
+}
+
+/**
+ * Accepts all the pending connections (the server socket is non blocking), so
+ * the requests sent by clients that connected while another request was being
+ * served are received, and can be coalesced, together.
+ */
+static void accept_clients(struct ctrl_daemon* daemon, int server_fd) {
+    for (;;) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ALOGW("Could not accept connection: %s", strerror(errno));
+            }
+
+            return;
+        }
+
+        if (daemon->num_clients == CTRL_MAX_CLIENTS) {
+            ALOGW("Too many clients; connection dropped");
+
+            close(client_fd);
+
+            continue;
+        }
+
+        struct ctrl_client* client = &daemon->clients[daemon->num_clients++];
+        memset(client, 0, sizeof(*client));
+        client->fd = client_fd;
+        client->last_request_time_ms = get_monotonic_time_ms();
+    }
+}
+
+static int64_t min_timeout(int64_t timeout, int64_t remaining) {
+    if (timeout < 0 || remaining < timeout) {
+        return remaining;
+    }
+
+    return timeout;
+}
+
+/**
+ * Removes the interfaces if the grace period ended, and drops the clients that
+ * have not sent a request for too long. Returns the time to wait until the next timeout, in
+ * milliseconds, or -1 if there is none.
+ */
+static int handle_timeouts(struct ctrl_daemon* daemon) {
+    int64_t now = get_monotonic_time_ms();
+    int64_t next_timeout = -1;
+
+    char reply[CTRL_REPLY_MAX];
+
+    if (daemon->remove_deadline_ms >= 0) {
+        if (now >= daemon->remove_deadline_ms) {
+            ALOGI("Grace period ended; removing the interfaces");
+
+            remove_interfaces_now(daemon, reply, sizeof(reply));
+        } else {
+            next_timeout = min_timeout(next_timeout, daemon->remove_deadline_ms - now);
+        }
+    }
+
+    // Removing the interfaces may have taken a while.
+    now = get_monotonic_time_ms();
+
+    int i = 0;
+    while (i < daemon->num_clients) {
+        struct ctrl_client* client = &daemon->clients[i];
+
+        int64_t remaining = client->last_request_time_ms + CTRL_CLIENT_TIMEOUT * 1000 - now;
+        if (remaining <= 0) {
+            drop_client(daemon, i);
+
+            continue;
+        }
+
+        next_timeout = min_timeout(next_timeout, remaining);
+
+        i++;
+    }
+
+    return (int) next_timeout;
+}
+
+static int run_daemon(int grace_period_ms) {
+    int server_fd;
+
+    const char* socket_path = get_socket_path();
+    if (socket_path) {
+        server_fd = socket_local_server(socket_path, ANDROID_SOCKET_NAMESPACE_FILESYSTEM, SOCK_SEQPACKET);
+        if (server_fd < 0) {
+            ALOGE("Could not create the socket '%s'", socket_path);
+
+            return 1;
+        }
+    } else {
+        server_fd = android_get_control_socket(CTRL_SOCKET_NAME);
+        if (server_fd < 0) {
+            ALOGE("Could not get the init socket '%s'", CTRL_SOCKET_NAME);
+
+            return 1;
+        }
+    }
+
+    if (listen(server_fd, 4) < 0) {
+        ALOGE("Could not listen on the init socket '%s': %s", CTRL_SOCKET_NAME, strerror(errno));
+
+        return 1;
+    }
+
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+
+    struct ctrl_daemon daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    iface_ctrl_init(&daemon.ctrl);
+    daemon.grace_period_ms = grace_period_ms;
+    daemon.remove_deadline_ms = -1;
+
+    ALOGI("Waiting for requests, grace period %d ms", grace_period_ms);
+
+    for (;;) {
+        struct pollfd poll_fds[1 + CTRL_MAX_CLIENTS];
+        int num_clients = daemon.num_clients;
+
+        poll_fds[0].fd = server_fd;
+        poll_fds[0].events = POLLIN;
+
+        int i;
+        for (i = 0; i < num_clients; i++) {
+            poll_fds[1 + i].fd = daemon.clients[i].fd;
+            poll_fds[1 + i].events = POLLIN;
+        }
+
+        int timeout = handle_timeouts(&daemon);
+        if (daemon.num_clients != num_clients) {
+            continue;
+        }
+
+        if (poll(poll_fds, 1 + num_clients, timeout) < 0) {
+            if (errno != EINTR) {
+                ALOGW("Could not poll: %s", strerror(errno));
+            }
+
+            continue;
+        }
+
+        for (i = 0; i < num_clients; i++) {
+            if (poll_fds[1 + i].revents) {
+                receive_request(&daemon, &daemon.clients[i]);
+            }
+        }
+
+        // Requests are served one at a time, so adding and removing the
+        // interfaces is always serialized.
+        serve_requests(&daemon);
+
+        // Clients are dropped from the last one, as dropping a client moves
+        // the last one to its position.
+        for (i = daemon.num_clients - 1; i >= 0; i--) {
+            if (daemon.clients[i].dropped) {
+                drop_client(&daemon, i);
+            }
+        }
+
+        if (poll_fds[0].revents & POLLIN) {
+            accept_clients(&daemon, server_fd);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Forwards the request to the daemon through the given connection. Returns 0 if
+ * the request succeeded, or 1 otherwise.
+ */
+static int forward_request_on(int fd, const char* request) {
+    struct timeval timeout = { CTRL_REPLY_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (send(fd, request, strlen(request), MSG_NOSIGNAL) < 0) {
+        ALOGE("Could not send request '%s' to the daemon: %s", request, strerror(errno));
+
+        return 1;
+    }
+
+    char reply[CTRL_REPLY_MAX];
+    ssize_t length = recv(fd, reply, sizeof(reply) - 1, 0);
+    if (length <= 0) {
+        ALOGE("Could not receive reply to request '%s' from the daemon: %s", request, length < 0 ? strerror(errno) : "connection closed");
+
+        return 1;
+    }
+
+    reply[length] = '\0';
+
+    ALOGI("Request '%s' replied by the daemon with '%s'", request, reply);
+
+    return strncmp(reply, "ok", 2) != 0;
+}
+
+static int connect_to_daemon() {
+    const char* socket_path = get_socket_path();
+    if (socket_path) {
+        return socket_local_client(socket_path, ANDROID_SOCKET_NAMESPACE_FILESYSTEM, SOCK_SEQPACKET);
+    }
+
+    return socket_local_client(CTRL_SOCKET_NAME, ANDROID_SOCKET_NAMESPACE_RESERVED, SOCK_SEQPACKET);
+}
+
+/**
+ * Forwards the request to the daemon. Returns 0 if the request succeeded, 1 if
+ * it failed, or -1 if the daemon is not running.
+ */
+static int forward_request(const char* request) {
+    int fd = connect_to_daemon();
+    if (fd < 0) {
+        return -1;
+    }
+
+    int ret = forward_request_on(fd, request);
+
+    close(fd);
+
+    return ret;
+}
+
+/**
+ * Performs the request locally, without the daemon. Returns 0 if the request
+ * succeeded, 1 otherwise.
+ */
+static int perform_request(const char* request) {
+    ALOGI("Daemon not running; performing request '%s' directly", request);
+
+    struct iface_ctrl ctrl;
+    iface_ctrl_init(&ctrl);
+
+    char reply[CTRL_REPLY_MAX];
+    int ret = handle_request(&ctrl, request, reply, sizeof(reply));
+
+    ALOGI("Request '%s' result: '%s'", request, reply);
+
+    iface_ctrl_close(&ctrl);
+
+    return ret;
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t first = *(const int64_t*) a;
+    int64_t second = *(const int64_t*) b;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * Sorts the given latencies and prints their percentiles.
+ */
+static void print_latencies(const char* name, int64_t* latencies, int count) {
+    qsort(latencies, count, sizeof(*latencies), compare_int64);
+
+    printf("%-6s p50 %lld us, p90 %lld us, p99 %lld us, max %lld us\n", name,
+           (long long) latencies[count * 50 / 100],
+           (long long) latencies[count * 90 / 100],
+           (long long) latencies[count * 99 / 100],
+           (long long) latencies[count - 1]);
+}
+
+/**
+ * Adds and removes the interfaces the given number of times and prints the
+ * latencies. The interfaces are removed first, so every cycle starts from the
+ * same state. Returns 0 if all the cycles succeeded, 1 otherwise.
+ */
+static int run_bench(int cycles) {
+    int64_t* latencies = malloc(3 * cycles * sizeof(*latencies));
+    if (!latencies) {
+        ALOGE("Could not allocate the latencies of %d cycles", cycles);
+
+        return 1;
+    }
+
+    int64_t* add_latencies = latencies;
+    int64_t* remove_latencies = latencies + cycles;
+    int64_t* toggle_latencies = latencies + 2 * cycles;
+
+    struct iface_ctrl ctrl;
+    iface_ctrl_init(&ctrl);
+
+    char reply[CTRL_REPLY_MAX];
+
+    int ret = handle_request(&ctrl, "remove", reply, sizeof(reply));
+
+    int cycle;
+    for (cycle = 0; cycle < cycles && !ret; cycle++) {
+        int64_t start = get_monotonic_time_us();
+
+        ret = handle_request(&ctrl, "add", reply, sizeof(reply));
+
+        int64_t added = get_monotonic_time_us();
+
+        if (!ret) {
+            ret = handle_request(&ctrl, "remove", reply, sizeof(reply));
+        }
+
+        int64_t removed = get_monotonic_time_us();
+
+        add_latencies[cycle] = added - start;
+        remove_latencies[cycle] = removed - added;
+        toggle_latencies[cycle] = removed - start;
+    }
+
+    iface_ctrl_close(&ctrl);
+
+    if (ret) {
+        fprintf(stderr, "Cycle %d failed\n", cycle);
+    } else {
+        printf("%d cycles\n", cycles);
+        print_latencies("add", add_latencies, cycles);
+        print_latencies("remove", remove_latencies, cycles);
+        print_latencies("toggle", toggle_latencies, cycles);
+    }
+
+    free(latencies);
+
+    return ret;
+}
+
 int main(int argc, char** argv) {
+    if (argc >= 2 && !strcmp(argv[1], "daemon")) {
+        int grace_period_ms = 0;
+
+        int i;
+        for (i = 2; i < argc; i++) {
+            if (!strncmp(argv[i], "grace-period=", 13)) {
+                grace_period_ms = atoi(argv[i] + 13);
+            } else {
+                ALOGE("Unknown daemon option: '%s'", argv[i]);
+                return 1;
+            }
+        }
+
+        return run_daemon(grace_period_ms);
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "bench")) {
+        int cycles = atoi(argv[2]);
+        if (cycles <= 0) {
+            fprintf(stderr, "Usage: %s bench <number of cycles>\n", argv[0]);
+            return 1;
+        }
+
+        return run_bench(cycles);
+    }
+
     if (argc < 2 || argc > 3) {
-        ALOGE("Usage: %s add|remove [property name for result]", argv[0]);
+        ALOGE("Usage: %s daemon [grace-period=<milliseconds>] | add|remove|status|stats [property name for result] | bench <number of cycles>", argv[0]);
         return 1;
     }
 
-    if (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "remove") != 0) {
-        ALOGE("Value must be 'add' or 'remove'; value given: '%s'", argv[1]);
+    if (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "remove") != 0 &&
+            strcmp(argv[1], "status") != 0 && strcmp(argv[1], "stats") != 0) {
+        ALOGE("Value must be 'daemon', 'add', 'remove', 'status', 'stats' or 'bench'; value given: '%s'", argv[1]);
         return 1;
     }
 
-    int ret;
-    if (!strcmp(argv[1], "add")) {
-        ret = add_interfaces();
-    } else {
-        ret = remove_interfaces();
+    int ret = forward_request(argv[1]);
+    if (ret < 0) {
+        ret = perform_request(argv[1]);
     }
 
     if (argc == 3) {
@@ -28,3 +28,25 @@ LOCAL_SRC_FILES := driver_nl80211_cmd.c
 LOCAL_MODULE := wpa_supplicant_8_private_lib_fp1
 
 include $(BUILD_STATIC_LIBRARY)
+
+
+
+# Host test of the private driver commands, which runs the library against a
+# mock ioctl backend that records what would be sent to the driver.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := \
+    external/libnl-headers \
+    external/wpa_supplicant_8/src \
+    external/wpa_supplicant_8/src/drivers \
+    external/wpa_supplicant_8/src/utils \
+    hardware/libhardware_legacy/include
+
+LOCAL_SRC_FILES := \
+    driver_nl80211_cmd.c \
+    driver_nl80211_cmd_test.c
+
+LOCAL_MODULE := wpa_supplicant_8_private_lib_fp1_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
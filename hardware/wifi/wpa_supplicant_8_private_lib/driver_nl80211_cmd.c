@@ -17,8 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -39,62 +42,505 @@
 #include "drivers/driver.h"
 #include "drivers/linux_ioctl.h"
 
+// From "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/include/gl_wext_priv.h"
+#define IOCTL_SET_INT          (SIOCIWFIRSTPRIV+0)
+#define IOCTL_GET_INT          (SIOCIWFIRSTPRIV+1)
+#define PRIV_CMD_POWER_MODE    6
+
+// From "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/include/wlan_oid.h"
+#define PARAM_POWER_MODE_CAM       0
+#define PARAM_POWER_MODE_FAST_PSP  2
+
+/**
+ * Sends a private command to the driver as a string, like the Android driver
+ * commands.
+ *
+ * See "wext_support_ioctl" in
+ * "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/gl_wext.c".
+ */
+static int send_private_cmd(struct i802_bss* bss, char* cmd) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    struct iwreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    os_strncpy(ifr.ifr_name, bss->ifname, IFNAMSIZ);
+
+    ifr.u.data.pointer = cmd;
+    ifr.u.data.length = strlen(cmd) + 1;
+
+    return ioctl(drv->global->ioctl_sock, SIOCSIWPRIV, &ifr);
+}
+
+/**
+ * Sends a private command to the driver as an integer sub command with its
+ * value.
+ *
+ * See "priv_set_int" in
+ * "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/gl_wext_priv.c".
+ */
+static int send_private_int(struct i802_bss* bss, int sub_cmd, u32 value) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    struct iwreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    os_strncpy(ifr.ifr_name, bss->ifname, IFNAMSIZ);
+
+    ifr.u.mode = sub_cmd;
+
+    u32* ifr_extra = (u32*) &ifr.u;
+    ifr_extra[1] = value;
+
+    return ioctl(drv->global->ioctl_sock, IOCTL_SET_INT, &ifr);
+}
+
+/**
+ * Gets the value of an integer private sub command from the driver.
+ *
+ * See "priv_get_int" in
+ * "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/gl_wext_priv.c".
+ */
+static int get_private_int(struct i802_bss* bss, int sub_cmd, u32* value) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    struct iwreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    os_strncpy(ifr.ifr_name, bss->ifname, IFNAMSIZ);
+
+    ifr.u.mode = sub_cmd;
+
+    int ret = ioctl(drv->global->ioctl_sock, IOCTL_GET_INT, &ifr);
+    if (ret == 0) {
+        *value = ifr.u.mode;
+    }
+
+    return ret;
+}
+
+/**
+ * Statistics of a private command, reported by the "STATS" private command.
+ *
+ * The latency histogram uses power of two buckets: bucket 0 counts the calls
+ * that took less than 1 microsecond, and bucket i (i > 0) those that took from
+ * 2^(i-1) to 2^i - 1 microseconds; the last bucket counts any longer call too.
+ */
+#define PRIVATE_CMD_HISTOGRAM_BUCKETS 24
+
+// Size of the last command remembered to deduplicate repeated commands.
+#define PRIVATE_CMD_LAST_SIZE 64
+
+// Interfaces whose last command is remembered: the supplicant sends private
+// commands to the station and the P2P interfaces.
+#define PRIVATE_CMD_LAST_INTERFACES 2
+
+struct private_cmd_last {
+    char ifname[IFNAMSIZ + 1];
+    char cmd[PRIVATE_CMD_LAST_SIZE];
+};
+
+struct private_cmd_stats {
+    unsigned int count;
+    unsigned int failures;
+    unsigned int deduplicated;
+    u64 total_time_us;
+    u64 max_time_us;
+    unsigned int histogram[PRIVATE_CMD_HISTOGRAM_BUCKETS];
+
+    // Last command that succeeded on each interface, if the command is
+    // deduplicated.
+    struct private_cmd_last last[PRIVATE_CMD_LAST_INTERFACES];
+};
+
+/**
+ * Private command handled by this library.
+ *
+ * The name is matched, case insensitively, against the first word of the
+ * command, and the handler receives the whole command and its arguments (the
+ * rest of the words). If "dedupe" is set, repeating the last command that
+ * succeeded on the same interface is a no-op, so it is not sent again to the
+ * driver.
+ */
+struct private_cmd {
+    const char* name;
+    int (*handler)(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len);
+    int dedupe;
+};
+
+static int cmd_start(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    linux_set_iface_flags(drv->global->ioctl_sock, bss->ifname, 1);
+
+    wpa_msg(drv->ctx, MSG_INFO, WPA_EVENT_DRIVER_STATE "STARTED");
+
+    return 0;
+}
+
+static void forget_last_cmds();
+
+static int cmd_stop(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    linux_set_iface_flags(drv->global->ioctl_sock, bss->ifname, 0);
+
+    // The settings could be lost while the driver is stopped.
+    forget_last_cmds();
+
+    wpa_msg(drv->ctx, MSG_INFO, WPA_EVENT_DRIVER_STATE "STOPPED");
+
+    return 0;
+}
+
+static int cmd_macaddr(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+    u8 macaddr[ETH_ALEN] = {};
+
+    int ret = linux_get_ifhwaddr(drv->global->ioctl_sock, bss->ifname, macaddr);
+    if (!ret) {
+        ret = os_snprintf(buf, buf_len, "Macaddr = " MACSTR "\n", MAC2STR(macaddr));
+    }
+
+    return ret;
+}
+
+static int cmd_country(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    struct wpa_driver_nl80211_data* drv = bss->drv;
+
+    // See "wext_set_country" in
+    // "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/gl_wext.c".
+    int ret = send_private_cmd(bss, cmd);
+    if (ret < 0) {
+        wpa_printf(MSG_ERROR, "Failed to issue 'COUNTRY' private command");
+    } else {
+        wpa_supplicant_event(drv->ctx, EVENT_CHANNEL_LIST_CHANGED, NULL);
+    }
+
+    return ret;
+}
+
+/**
+ * Power save mode of the station before "POWERMODE 1", restored by
+ * "POWERMODE 0". The driver has a single power save profile for the station,
+ * so it is shared by all the interfaces.
+ */
+static u32 saved_power_mode;
+static int power_mode_saved;
+
+/**
+ * Sets the power save mode of the station: "POWERMODE 1" disables power save
+ * (for example, while DHCP is running) and "POWERMODE 0" restores the mode
+ * that was set before. If that mode could not be got from the driver the
+ * default one, PARAM_POWER_MODE_FAST_PSP, is restored instead.
+ */
+static int cmd_power_mode(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    int active = atoi(args);
+
+    // See "wlanoidSet802dot11PowerSaveProfile" in
+    // "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/common/wlan_oid.c".
+    u32 power_mode;
+    if (active) {
+        if (!power_mode_saved) {
+            if (get_private_int(bss, PRIV_CMD_POWER_MODE, &saved_power_mode) < 0) {
+                wpa_printf(MSG_WARNING, "Failed to get power mode: %s", strerror(errno));
+
+                saved_power_mode = PARAM_POWER_MODE_FAST_PSP;
+            }
+        }
+
+        power_mode = PARAM_POWER_MODE_CAM;
+    } else {
+        power_mode = power_mode_saved ? saved_power_mode : PARAM_POWER_MODE_FAST_PSP;
+    }
+
+    int ret = send_private_int(bss, PRIV_CMD_POWER_MODE, power_mode);
+    if (ret < 0) {
+        wpa_printf(MSG_ERROR, "Failed to set power mode %u: %s", power_mode, strerror(errno));
+    } else {
+        power_mode_saved = active;
+    }
+
+    return ret;
+}
+
+/**
+ * The packet filters used while suspended (RXFILTER-ADD/REMOVE to choose the
+ * filters, RXFILTER-START/STOP to enable them), the suspend mode itself and the
+ * Bluetooth coexistence mode can not be set through the driver: it has no
+ * private sub command for them, and the only string private command that it
+ * handles through SIOCSIWPRIV is "COUNTRY". The commands are just logged and
+ * ignored, like before they were known, so the framework does not consider
+ * them failed.
+ */
+static int cmd_ignored(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    wpa_printf(MSG_DEBUG, "Private command '%s' not supported by the driver; ignored", cmd);
+
+    return 0;
+}
+
+static int cmd_stats(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len);
+
+static const struct private_cmd private_cmds[] = {
+    { "START", cmd_start, 0 },
+    { "STOP", cmd_stop, 0 },
+    { "MACADDR", cmd_macaddr, 0 },
+    { "COUNTRY", cmd_country, 1 },
+    { "POWERMODE", cmd_power_mode, 1 },
+    { "RXFILTER-ADD", cmd_ignored, 0 },
+    { "RXFILTER-REMOVE", cmd_ignored, 0 },
+    { "RXFILTER-START", cmd_ignored, 0 },
+    { "RXFILTER-STOP", cmd_ignored, 0 },
+    { "SETSUSPENDMODE", cmd_ignored, 0 },
+    { "BTCOEXMODE", cmd_ignored, 0 },
+    { "STATS", cmd_stats, 0 },
+};
+
+#define NUM_PRIVATE_CMDS (sizeof(private_cmds) / sizeof(private_cmds[0]))
+
+static struct private_cmd_stats private_cmd_stats[NUM_PRIVATE_CMDS];
+
+static void forget_last_cmds() {
+    size_t i;
+    for (i = 0; i < NUM_PRIVATE_CMDS; i++) {
+        memset(private_cmd_stats[i].last, 0, sizeof(private_cmd_stats[i].last));
+    }
+}
+
+/**
+ * Returns the last command remembered for the given interface. If the
+ * interface had none a free slot is given to it or, if there is none, the
+ * slot of the first interface.
+ */
+static struct private_cmd_last* get_last_cmd(struct private_cmd_stats* stats, const char* ifname) {
+    struct private_cmd_last* free_last = NULL;
+
+    int i;
+    for (i = 0; i < PRIVATE_CMD_LAST_INTERFACES; i++) {
+        if (!os_strcmp(stats->last[i].ifname, ifname)) {
+            return &stats->last[i];
+        }
+
+        if (!free_last && !stats->last[i].ifname[0]) {
+            free_last = &stats->last[i];
+        }
+    }
+
+    if (!free_last) {
+        free_last = &stats->last[0];
+    }
+
+    os_strlcpy(free_last->ifname, ifname, sizeof(free_last->ifname));
+    free_last->cmd[0] = '\0';
+
+    return free_last;
+}
+
+static u64 get_monotonic_time_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (u64) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void record_latency(struct private_cmd_stats* stats, u64 time_us) {
+    int bucket = 0;
+    while (bucket < PRIVATE_CMD_HISTOGRAM_BUCKETS - 1 && (time_us >> bucket) != 0) {
+        bucket++;
+    }
+
+    stats->histogram[bucket]++;
+    stats->total_time_us += time_us;
+
+    if (time_us > stats->max_time_us) {
+        stats->max_time_us = time_us;
+    }
+}
+
+static unsigned int get_recorded_calls(const struct private_cmd_stats* stats) {
+    unsigned int calls = 0;
+
+    int bucket;
+    for (bucket = 0; bucket < PRIVATE_CMD_HISTOGRAM_BUCKETS; bucket++) {
+        calls += stats->histogram[bucket];
+    }
+
+    return calls;
+}
+
+/**
+ * Returns the upper bound, in microseconds, of the bucket that contains the
+ * given percentile of the calls, or the maximum latency if it is lower (the
+ * last bucket has no upper bound).
+ */
+static u64 get_latency_percentile(const struct private_cmd_stats* stats, unsigned int calls, unsigned int percentile) {
+    unsigned int target = (calls * percentile + 99) / 100;
+    unsigned int accumulated = 0;
+
+    int bucket;
+    for (bucket = 0; bucket < PRIVATE_CMD_HISTOGRAM_BUCKETS - 1; bucket++) {
+        accumulated += stats->histogram[bucket];
+        if (accumulated >= target) {
+            break;
+        }
+    }
+
+    u64 upper_bound_us = ((u64) 1 << bucket) - 1;
+    if (bucket == PRIVATE_CMD_HISTOGRAM_BUCKETS - 1 || upper_bound_us > stats->max_time_us) {
+        return stats->max_time_us;
+    }
+
+    return upper_bound_us;
+}
+
+/**
+ * Writes a line for each private command used so far with the number of times
+ * that it was used, failed and deduplicated, and with its average, maximum,
+ * 50th and 99th percentile latencies (the percentiles being the upper bound of
+ * their histogram bucket).
+ */
+static int cmd_stats(struct i802_bss* bss, char* cmd, const char* args, char* buf, size_t buf_len) {
+    size_t length = 0;
+
+    size_t i;
+    for (i = 0; i < NUM_PRIVATE_CMDS; i++) {
+        const struct private_cmd_stats* stats = &private_cmd_stats[i];
+        unsigned int calls = get_recorded_calls(stats);
+
+        if (!stats->count) {
+            continue;
+        }
+
+        int ret = os_snprintf(buf + length, buf_len - length,
+                              "%s count=%u failed=%u dedup=%u avg=%lluus max=%lluus p50<=%lluus p99<=%lluus\n",
+                              private_cmds[i].name, stats->count, stats->failures, stats->deduplicated,
+                              calls ? (unsigned long long) (stats->total_time_us / calls) : 0,
+                              (unsigned long long) stats->max_time_us,
+                              calls ? (unsigned long long) get_latency_percentile(stats, calls, 50) : 0,
+                              calls ? (unsigned long long) get_latency_percentile(stats, calls, 99) : 0);
+        if (ret < 0 || (size_t) ret >= buf_len - length) {
+            // Only whole lines are reported.
+            if (buf_len) {
+                buf[length] = '\0';
+            }
+
+            break;
+        }
+
+        length += ret;
+    }
+
+    return length;
+}
+
+static const struct private_cmd* find_private_cmd(const char* cmd, const char** args) {
+    size_t name_length = strcspn(cmd, " ");
+
+    size_t i;
+    for (i = 0; i < NUM_PRIVATE_CMDS; i++) {
+        if (os_strlen(private_cmds[i].name) == name_length &&
+                !os_strncasecmp(cmd, private_cmds[i].name, name_length)) {
+            *args = cmd + name_length + strspn(cmd + name_length, " ");
+
+            return &private_cmds[i];
+        }
+    }
+
+    return NULL;
+}
+
 int wpa_driver_nl80211_driver_cmd(void* priv, char* cmd, char* buf, size_t buf_len) {
     struct i802_bss* bss = priv;
-    struct wpa_driver_nl80211_data* drv = bss->drv;
-    int ret = 0;
+    const char* args;
+
+    const struct private_cmd* private_cmd = find_private_cmd(cmd, &args);
+    if (!private_cmd) {
+        wpa_printf(MSG_WARNING, "Unsupported private command: %s", cmd);
+
+        return 0;
+    }
 
-    if (os_strcmp(cmd, "START") == 0) {
-        linux_set_iface_flags(drv->global->ioctl_sock, bss->ifname, 1);
+    struct private_cmd_stats* stats = &private_cmd_stats[private_cmd - private_cmds];
+    stats->count++;
 
-        wpa_msg(drv->ctx, MSG_INFO, WPA_EVENT_DRIVER_STATE "STARTED");
-    } else if (os_strcmp(cmd, "STOP") == 0) {
-        linux_set_iface_flags(drv->global->ioctl_sock, bss->ifname, 0);
+    // Commands too long to be remembered are never deduplicated.
+    struct private_cmd_last* last = NULL;
+    if (private_cmd->dedupe && os_strlen(cmd) < PRIVATE_CMD_LAST_SIZE) {
+        last = get_last_cmd(stats, bss->ifname);
+    }
+
+    if (last) {
+        if (!os_strcmp(cmd, last->cmd)) {
+            wpa_printf(MSG_DEBUG, "Private command '%s' already set on %s", cmd, bss->ifname);
 
-        wpa_msg(drv->ctx, MSG_INFO, WPA_EVENT_DRIVER_STATE "STOPPED");
-    } else if (os_strcasecmp(cmd, "MACADDR") == 0) {
-        u8 macaddr[ETH_ALEN] = {};
+            stats->deduplicated++;
 
-        ret = linux_get_ifhwaddr(drv->global->ioctl_sock, bss->ifname, macaddr);
-        if (!ret) {
-            ret = os_snprintf(buf, buf_len, "Macaddr = " MACSTR "\n", MAC2STR(macaddr));
+            return 0;
         }
-    } else if (!os_strncmp(cmd, "COUNTRY", os_strlen("COUNTRY"))) {
-        struct iwreq ifr;
-        memset(&ifr, 0, sizeof(ifr));
-        os_strncpy(ifr.ifr_name, bss->ifname, IFNAMSIZ);
-
-        // See "wext_support_ioctl" and "wext_set_country" in
-        // "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/gl_wext.c".
-        ifr.u.data.pointer = cmd;
-        ifr.u.data.length = strlen(cmd) + 1;
-
-        if ((ret = ioctl(drv->global->ioctl_sock, SIOCSIWPRIV, &ifr)) < 0) {
-            wpa_printf(MSG_ERROR, "Failed to issue 'COUNTRY' private command");
+    }
+
+    u64 start_time_us = get_monotonic_time_us();
+
+    int ret = private_cmd->handler(bss, cmd, args, buf, buf_len);
+
+    record_latency(stats, get_monotonic_time_us() - start_time_us);
+
+    if (ret < 0) {
+        stats->failures++;
+    }
+
+    if (last) {
+        if (ret < 0) {
+            last->cmd[0] = '\0';
         } else {
-            wpa_supplicant_event(drv->ctx, EVENT_CHANNEL_LIST_CHANGED, NULL);
+            os_strlcpy(last->cmd, cmd, sizeof(last->cmd));
         }
-    } else {
-        wpa_printf(MSG_WARNING, "Unsupported private command: %s", cmd);
     }
 
     return ret;
 }
 
+/**
+ * Sets the Notice of Absence schedule of the group owner: "count" absence
+ * periods of "duration" milliseconds, the first one "start" milliseconds from
+ * now (a count of 255 means a continuous schedule, and a count or a duration
+ * of 0 cancels it).
+ *
+ * The driver does not provide a way to set the schedule (the only string
+ * private command that it handles through SIOCSIWPRIV is "COUNTRY"), so only
+ * cancelling it, which is always the case, succeeds.
+ */
 int wpa_driver_set_p2p_noa(void *priv, u8 count, int start, int duration) {
-    wpa_printf(MSG_WARNING, "wpa_driver_set_p2p_noa is not implemented");
+    if (count == 0 || duration == 0) {
+        return 0;
+    }
+
+    wpa_printf(MSG_WARNING, "Setting the NoA schedule is not supported by the driver");
 
     return -1;
 }
 
+/**
+ * No NoA schedule can be set (see wpa_driver_set_p2p_noa), so there is no NoA
+ * attribute to be added by wpa_supplicant.
+ */
 int wpa_driver_get_p2p_noa(void *priv, u8 *buf, size_t len) {
-    wpa_printf(MSG_WARNING, "wpa_driver_get_p2p_noa is not implemented");
-
-    return -1;
+    return 0;
 }
 
+/**
+ * Sets the power save mode of the P2P interface: legacy power save (when
+ * client) and opportunistic power save with the given CTWindow (when group
+ * owner). Negative values leave the corresponding setting unchanged.
+ *
+ * The legacy power save is set by "nl80211_set_p2p_powersave" itself with
+ * NL80211_CMD_SET_POWER_SAVE, so it is ignored here. The driver does not
+ * provide a way to set the opportunistic power save, so only disabling it,
+ * which is always the case, succeeds.
+ */
 int wpa_driver_set_p2p_ps(void *priv, int legacy_ps, int opp_ps, int ctwindow) {
-    wpa_printf(MSG_WARNING, "wpa_driver_set_p2p_ps is not implemented");
+    if (opp_ps <= 0 && ctwindow <= 0) {
+        return 0;
+    }
+
+    wpa_printf(MSG_WARNING, "Opportunistic power save is not supported by the driver");
 
     return -1;
 }
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/if.h>
+#include <linux/wireless.h>
+
+#include <hardware_legacy/driver_nl80211.h>
+
+#include "utils/common.h"
+#include "utils/os.h"
+#include "utils/wpa_debug.h"
+
+#include "drivers/driver.h"
+#include "drivers/linux_ioctl.h"
+
+/**
+ * Host test of the private driver commands.
+ *
+ * The library is linked against a mock ioctl backend that records the requests
+ * sent to the driver instead of sending them, so the test checks exactly what
+ * would reach the driver for each command. The functions of wpa_supplicant
+ * used by the library are stubbed too.
+ *
+ * Usage: wpa_supplicant_8_private_lib_fp1_test
+ */
+
+// From "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/os/linux/include/gl_wext_priv.h"
+#define IOCTL_SET_INT          (SIOCIWFIRSTPRIV+0)
+#define IOCTL_GET_INT          (SIOCIWFIRSTPRIV+1)
+#define PRIV_CMD_POWER_MODE    6
+
+// From "mediatek/kernel/drivers/combo/drv_wlan/mt6628/wlan/include/wlan_oid.h"
+#define PARAM_POWER_MODE_CAM       0
+#define PARAM_POWER_MODE_MAX_PSP   1
+#define PARAM_POWER_MODE_FAST_PSP  2
+
+#define MOCK_IOCTL_MAX_REQUESTS 16
+#define MOCK_IOCTL_MAX_DATA 256
+
+/**
+ * Request received by the mock ioctl backend: the string of SIOCSIWPRIV, or
+ * the sub command and the value of IOCTL_SET_INT, or the sub command of
+ * IOCTL_GET_INT.
+ */
+struct mock_ioctl_request {
+    unsigned long request;
+    char ifname[IFNAMSIZ + 1];
+    char data[MOCK_IOCTL_MAX_DATA];
+    int sub_cmd;
+    u32 value;
+};
+
+static struct mock_ioctl_request mock_ioctl_requests[MOCK_IOCTL_MAX_REQUESTS];
+static int mock_ioctl_num_requests;
+
+// errno set by the mock ioctl backend, or 0 if it succeeds.
+static int mock_ioctl_error;
+
+// errno set by the mock ioctl backend for IOCTL_GET_INT, or 0 if it succeeds
+// and returns mock_ioctl_get_int_value.
+static int mock_ioctl_get_int_error;
+static u32 mock_ioctl_get_int_value;
+
+static int failures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+int ioctl(int fd, unsigned long request, ...) {
+    va_list arguments;
+    va_start(arguments, request);
+    struct iwreq* ifr = va_arg(arguments, struct iwreq*);
+    va_end(arguments);
+
+    if (mock_ioctl_num_requests == MOCK_IOCTL_MAX_REQUESTS) {
+        errno = ENOSPC;
+
+        return -1;
+    }
+
+    struct mock_ioctl_request* mock_request = &mock_ioctl_requests[mock_ioctl_num_requests++];
+    memset(mock_request, 0, sizeof(*mock_request));
+
+    mock_request->request = request;
+    memcpy(mock_request->ifname, ifr->ifr_name, IFNAMSIZ);
+
+    if (request == SIOCSIWPRIV) {
+        size_t length = ifr->u.data.length < MOCK_IOCTL_MAX_DATA ? ifr->u.data.length : MOCK_IOCTL_MAX_DATA;
+        memcpy(mock_request->data, ifr->u.data.pointer, length);
+    } else if (request == IOCTL_SET_INT) {
+        mock_request->sub_cmd = ifr->u.mode;
+        mock_request->value = ((u32*) &ifr->u)[1];
+    } else if (request == IOCTL_GET_INT) {
+        mock_request->sub_cmd = ifr->u.mode;
+    }
+
+    if (mock_ioctl_error) {
+        errno = mock_ioctl_error;
+
+        return -1;
+    }
+
+    if (request == IOCTL_GET_INT) {
+        if (mock_ioctl_get_int_error) {
+            errno = mock_ioctl_get_int_error;
+
+            return -1;
+        }
+
+        ifr->u.mode = mock_ioctl_get_int_value;
+    }
+
+    return 0;
+}
+
+static void mock_ioctl_reset() {
+    mock_ioctl_num_requests = 0;
+    mock_ioctl_error = 0;
+    mock_ioctl_get_int_error = 0;
+    mock_ioctl_get_int_value = 0;
+}
+
+void wpa_printf(int level, const char* fmt, ...) {
+}
+
+void wpa_msg(void* ctx, int level, const char* fmt, ...) {
+}
+
+void wpa_supplicant_event(void* ctx, enum wpa_event_type event, union wpa_event_data* data) {
+}
+
+int linux_set_iface_flags(int sock, const char* ifname, int dev_up) {
+    return 0;
+}
+
+int linux_get_ifhwaddr(int sock, const char* ifname, u8* addr) {
+    return 0;
+}
+
+size_t os_strlcpy(char* dest, const char* src, size_t siz) {
+    size_t length = strlen(src);
+
+    if (siz) {
+        size_t copied = length < siz - 1 ? length : siz - 1;
+        memcpy(dest, src, copied);
+        dest[copied] = '\0';
+    }
+
+    return length;
+}
+
+int wpa_driver_nl80211_driver_cmd(void* priv, char* cmd, char* buf, size_t buf_len);
+int wpa_driver_set_p2p_noa(void* priv, u8 count, int start, int duration);
+int wpa_driver_get_p2p_noa(void* priv, u8* buf, size_t len);
+int wpa_driver_set_p2p_ps(void* priv, int legacy_ps, int opp_ps, int ctwindow);
+
+static struct nl80211_global global;
+static struct wpa_driver_nl80211_data drv;
+static struct i802_bss wlan0;
+static struct i802_bss p2p0;
+
+static int driver_cmd(struct i802_bss* bss, const char* cmd) {
+    char cmd_copy[MOCK_IOCTL_MAX_DATA];
+    char buf[MOCK_IOCTL_MAX_DATA];
+
+    snprintf(cmd_copy, sizeof(cmd_copy), "%s", cmd);
+
+    return wpa_driver_nl80211_driver_cmd(bss, cmd_copy, buf, sizeof(buf));
+}
+
+static void test_country() {
+    mock_ioctl_reset();
+
+    CHECK(driver_cmd(&wlan0, "COUNTRY DE") == 0);
+    CHECK(mock_ioctl_num_requests == 1);
+    CHECK(mock_ioctl_requests[0].request == SIOCSIWPRIV);
+    CHECK(!strcmp(mock_ioctl_requests[0].ifname, "wlan0"));
+    CHECK(!strcmp(mock_ioctl_requests[0].data, "COUNTRY DE"));
+
+    // Repeating it is deduplicated.
+    CHECK(driver_cmd(&wlan0, "COUNTRY DE") == 0);
+    CHECK(mock_ioctl_num_requests == 1);
+
+    // The last command is remembered for each interface.
+    CHECK(driver_cmd(&p2p0, "COUNTRY DE") == 0);
+    CHECK(mock_ioctl_num_requests == 2);
+    CHECK(!strcmp(mock_ioctl_requests[1].ifname, "p2p0"));
+
+    CHECK(driver_cmd(&wlan0, "COUNTRY DE") == 0);
+    CHECK(driver_cmd(&p2p0, "COUNTRY DE") == 0);
+    CHECK(mock_ioctl_num_requests == 2);
+
+    mock_ioctl_error = EIO;
+    CHECK(driver_cmd(&wlan0, "COUNTRY FR") < 0);
+    CHECK(mock_ioctl_num_requests == 3);
+}
+
+static void test_power_mode() {
+    mock_ioctl_reset();
+
+    // The mode before disabling power save is restored.
+    mock_ioctl_get_int_value = PARAM_POWER_MODE_MAX_PSP;
+
+    CHECK(driver_cmd(&wlan0, "POWERMODE 1") == 0);
+    CHECK(mock_ioctl_num_requests == 2);
+    CHECK(mock_ioctl_requests[0].request == IOCTL_GET_INT);
+    CHECK(mock_ioctl_requests[0].sub_cmd == PRIV_CMD_POWER_MODE);
+    CHECK(mock_ioctl_requests[1].request == IOCTL_SET_INT);
+    CHECK(mock_ioctl_requests[1].sub_cmd == PRIV_CMD_POWER_MODE);
+    CHECK(mock_ioctl_requests[1].value == PARAM_POWER_MODE_CAM);
+
+    CHECK(driver_cmd(&wlan0, "POWERMODE 0") == 0);
+    CHECK(mock_ioctl_num_requests == 3);
+    CHECK(mock_ioctl_requests[2].request == IOCTL_SET_INT);
+    CHECK(mock_ioctl_requests[2].sub_cmd == PRIV_CMD_POWER_MODE);
+    CHECK(mock_ioctl_requests[2].value == PARAM_POWER_MODE_MAX_PSP);
+
+    // If the mode can not be got the default one is restored.
+    mock_ioctl_reset();
+    mock_ioctl_get_int_error = EOPNOTSUPP;
+
+    CHECK(driver_cmd(&wlan0, "POWERMODE 1") == 0);
+    CHECK(mock_ioctl_num_requests == 2);
+    CHECK(mock_ioctl_requests[1].request == IOCTL_SET_INT);
+    CHECK(mock_ioctl_requests[1].value == PARAM_POWER_MODE_CAM);
+
+    CHECK(driver_cmd(&wlan0, "POWERMODE 0") == 0);
+    CHECK(mock_ioctl_num_requests == 3);
+    CHECK(mock_ioctl_requests[2].request == IOCTL_SET_INT);
+    CHECK(mock_ioctl_requests[2].value == PARAM_POWER_MODE_FAST_PSP);
+}
+
+static void test_ignored() {
+    static const char* ignored_cmds[] = {
+        "RXFILTER-ADD 0",
+        "RXFILTER-REMOVE 0",
+        "RXFILTER-START",
+        "RXFILTER-STOP",
+        "SETSUSPENDMODE 1",
+        "BTCOEXMODE 1",
+    };
+
+    mock_ioctl_reset();
+
+    // The commands succeed, but nothing is sent to the driver, even if it
+    // would fail.
+    mock_ioctl_error = EINVAL;
+
+    size_t i;
+    for (i = 0; i < sizeof(ignored_cmds) / sizeof(ignored_cmds[0]); i++) {
+        CHECK(driver_cmd(&wlan0, ignored_cmds[i]) == 0);
+    }
+
+    CHECK(mock_ioctl_num_requests == 0);
+}
+
+static void test_stats() {
+    char cmd[] = "STATS";
+    char buf[MOCK_IOCTL_MAX_DATA];
+
+    CHECK(wpa_driver_nl80211_driver_cmd(&wlan0, cmd, buf, sizeof(buf)) > 0);
+    CHECK(!strncmp(buf, "COUNTRY count=", strlen("COUNTRY count=")));
+
+    // Nothing is written if there is no room for anything.
+    buf[0] = 'x';
+    CHECK(wpa_driver_nl80211_driver_cmd(&wlan0, cmd, buf, 0) == 0);
+    CHECK(buf[0] == 'x');
+}
+
+static void test_p2p_noa() {
+    mock_ioctl_reset();
+
+    // Setting a schedule is not supported by the driver, and cancelling it
+    // is a no-op; in no case anything is sent to the driver.
+    CHECK(wpa_driver_set_p2p_noa(&p2p0, 255, 100, 50) < 0);
+    CHECK(wpa_driver_set_p2p_noa(&p2p0, 1, 0, 50) < 0);
+    CHECK(wpa_driver_set_p2p_noa(&p2p0, 0, 0, 0) == 0);
+    CHECK(wpa_driver_set_p2p_noa(&p2p0, 255, 100, 0) == 0);
+    CHECK(mock_ioctl_num_requests == 0);
+
+    u8 buf[16];
+    CHECK(wpa_driver_get_p2p_noa(&p2p0, buf, sizeof(buf)) == 0);
+}
+
+static void test_p2p_ps() {
+    mock_ioctl_reset();
+
+    // The legacy power save is set by nl80211 itself, the opportunistic power
+    // save is not supported by the driver, and disabling it is a no-op; in no
+    // case anything is sent to the driver.
+    CHECK(wpa_driver_set_p2p_ps(&p2p0, 1, -1, -1) == 0);
+    CHECK(wpa_driver_set_p2p_ps(&p2p0, -1, 0, 0) == 0);
+    CHECK(wpa_driver_set_p2p_ps(&p2p0, -1, 1, 10) < 0);
+    CHECK(wpa_driver_set_p2p_ps(&p2p0, -1, -1, 10) < 0);
+    CHECK(mock_ioctl_num_requests == 0);
+}
+
+int main() {
+    global.ioctl_sock = -1;
+    drv.global = &global;
+
+    wlan0.drv = &drv;
+    snprintf(wlan0.ifname, sizeof(wlan0.ifname), "wlan0");
+
+    p2p0.drv = &drv;
+    snprintf(p2p0.ifname, sizeof(p2p0.ifname), "p2p0");
+
+    test_country();
+    test_power_mode();
+    test_ignored();
+    test_stats();
+    test_p2p_noa();
+    test_p2p_ps();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    printf("All checks passed\n");
+
+    return 0;
+}
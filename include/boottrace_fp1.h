@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANDROID_INCLUDE_BOOTTRACE_FP1_H
+#define ANDROID_INCLUDE_BOOTTRACE_FP1_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/**
+ * Boot trace of the vendor binaries.
+ *
+ * The begin and end of the steps of the boot and of the radio bring-up are
+ * appended, with their monotonic timestamp, to a trace file shared by all the
+ * processes and mapped in memory. Appending an event is lock free, so it can be
+ * done from any thread and from several processes at once, and it does not
+ * perform any system call once the trace file is mapped.
+ *
+ * The trace file is pulled from the device (as root, as it is only accessible
+ * by its owner and the BOOTTRACE_FP1_GID group) and converted by the host command
+ * boottrace-fp1-analyze into a timeline with the critical path of the boot and
+ * a Chrome trace (JSON) that can be loaded in chrome://tracing.
+ *
+ * The events are only recorded if the FP1_BOOT_TRACE build variable is set;
+ * otherwise the BOOTTRACE_* macros expand to nothing and the trace file is not
+ * created.
+ */
+
+/** Path of the trace file; it is created by the first process that traces. */
+#define BOOTTRACE_FP1_PATH "/dev/boottrace-fp1"
+
+/**
+ * Group of the trace file (AID_SYSTEM), shared by all the traced processes that
+ * do not run as root: the services run as system, and nvram_daemon, which runs
+ * as nvram, has the system group too.
+ */
+#define BOOTTRACE_FP1_GID 1000
+
+#define BOOTTRACE_FP1_MAGIC 0x31505442 // "BTP1"
+#define BOOTTRACE_FP1_VERSION 1
+
+/** Maximum number of events in the trace file; later events are dropped. */
+#define BOOTTRACE_FP1_MAX_EVENTS 4096
+
+/** Maximum length of the event names, including the null terminator. */
+#define BOOTTRACE_FP1_NAME_MAX 40
+
+#define BOOTTRACE_FP1_EVENT_BEGIN 'B'
+#define BOOTTRACE_FP1_EVENT_END 'E'
+#define BOOTTRACE_FP1_EVENT_INSTANT 'i'
+
+/**
+ * Header at the start of the trace file.
+ *
+ * A trace file full of zeros is a valid empty trace, so the processes do not
+ * need to agree on which of them initializes it.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+
+    /** Index of the next event to be appended; it can exceed max_events. */
+    volatile uint32_t next_event;
+
+    /** Number of events that did not fit in the trace file. */
+    volatile uint32_t dropped_events;
+
+    uint32_t reserved[12];
+} BootTraceFp1Header;
+
+/**
+ * Event in the trace file, after the header.
+ */
+typedef struct {
+    /**
+     * Index of the event plus one, set once the rest of the event was written;
+     * 0 if the event is not complete yet (or was never completed, if the
+     * process died while appending it).
+     */
+    volatile uint32_t sequence;
+
+    /** BOOTTRACE_FP1_EVENT_BEGIN, BOOTTRACE_FP1_EVENT_END or BOOTTRACE_FP1_EVENT_INSTANT. */
+    uint32_t type;
+
+    uint32_t pid;
+    uint32_t tid;
+
+    /** CLOCK_MONOTONIC time, in nanoseconds. */
+    uint64_t timestamp_ns;
+
+    char name[BOOTTRACE_FP1_NAME_MAX];
+} BootTraceFp1Event;
+
+#define BOOTTRACE_FP1_FILE_SIZE (sizeof(BootTraceFp1Header) + BOOTTRACE_FP1_MAX_EVENTS * sizeof(BootTraceFp1Event))
+
+/**
+ * Appends an event to the trace file, mapping it first if needed. The name is
+ * truncated if it does not fit in an event. Does nothing if the trace file
+ * could not be mapped.
+ */
+void boottrace_fp1_event(uint32_t type, const char* name);
+
+#ifdef FP1_BOOT_TRACE
+
+/** Begins a step in the calling thread; steps can be nested. */
+#define BOOTTRACE_BEGIN(name) boottrace_fp1_event(BOOTTRACE_FP1_EVENT_BEGIN, (name))
+/** Ends the step most recently begun in the calling thread. */
+#define BOOTTRACE_END(name) boottrace_fp1_event(BOOTTRACE_FP1_EVENT_END, (name))
+/** Marks a point in time, like the first GPS fix. */
+#define BOOTTRACE_INSTANT(name) boottrace_fp1_event(BOOTTRACE_FP1_EVENT_INSTANT, (name))
+
+#else
+
+#define BOOTTRACE_BEGIN(name) do { } while (0)
+#define BOOTTRACE_END(name) do { } while (0)
+#define BOOTTRACE_INSTANT(name) do { } while (0)
+
+#endif
+
+__END_DECLS
+
+#endif // ANDROID_INCLUDE_BOOTTRACE_FP1_H
@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANDROID_INCLUDE_HARDWARE_GPS_FP1_H
+#define ANDROID_INCLUDE_HARDWARE_GPS_FP1_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <cutils/atomic.h>
+
+#include <hardware/gps.h>
+
+__BEGIN_DECLS
+
+/**
+ * Extensions provided by the gps.fp1 wrapper for the proprietary MediaTek GPS
+ * HAL module.
+ *
+ * They are got like any other GPS extension, that is, through the
+ * get_extension function of the GpsInterface.
+ */
+
+/** Maximum number of SVs reported by the MediaTek GPS engine. */
+#define GPS_FP1_MAX_SVS 256
+
+/** Number of uint32_t needed for a mask with a bit for each SV. */
+#define GPS_FP1_SV_MASK_COUNT (GPS_FP1_MAX_SVS / 32)
+
+/** Name for the full SV status extension. */
+#define GPS_FP1_SV_STATUS_INTERFACE "gps-fp1-sv-status"
+
+/**
+ * SV status with all the SVs reported by the MediaTek GPS engine.
+ *
+ * Like GpsSvStatus, but with up to GPS_FP1_MAX_SVS SVs and masks of
+ * GPS_FP1_MAX_SVS bits.
+ */
+typedef struct {
+    /** set to sizeof(GpsFp1SvStatus) */
+    size_t size;
+
+    int num_svs;
+
+    GpsSvInfo sv_list[GPS_FP1_MAX_SVS];
+
+    uint32_t ephemeris_mask[GPS_FP1_SV_MASK_COUNT];
+
+    uint32_t almanac_mask[GPS_FP1_SV_MASK_COUNT];
+
+    uint32_t used_in_fix_mask[GPS_FP1_SV_MASK_COUNT];
+} GpsFp1SvStatus;
+
+/**
+ * Double buffer with the latest full SV status.
+ *
+ * The buffer is written by the wrapper each time that the MediaTek GPS engine
+ * reports the SV status, and it is read directly by the clients without any
+ * further copy. Each SV status has a sequence number, starting at 1, and the
+ * SV status with sequence number N is stored in sv_status[N & 1]. Therefore,
+ * the latest SV status is kept unmodified until the wrapper starts writing the
+ * next but one SV status.
+ *
+ * The buffer should be read using gps_fp1_sv_status_read_begin and
+ * gps_fp1_sv_status_read_end.
+ */
+typedef struct {
+    /** set to sizeof(GpsFp1SvStatusBuffer) */
+    size_t size;
+
+    /** Sequence number of the latest SV status written, or 0 if none. */
+    volatile int32_t sequence;
+
+    /**
+     * Sequence number of the SV status being written, or equal to sequence if
+     * none is being written.
+     */
+    volatile int32_t writing_sequence;
+
+    GpsFp1SvStatus sv_status[2];
+} GpsFp1SvStatusBuffer;
+
+/** Extended interface for the full SV status. */
+typedef struct {
+    /** set to sizeof(GpsFp1SvStatusInterface) */
+    size_t size;
+
+    /**
+     * Returns the buffer with the latest full SV status, or NULL if it could
+     * not be created. The wrapper only starts writing the buffer once this
+     * function has been called.
+     */
+    const GpsFp1SvStatusBuffer* (*get_buffer)(void);
+
+    /**
+     * Returns the file descriptor of the shared memory that contains the
+     * buffer, or -1 if it could not be created. The file descriptor can be
+     * passed to other processes to map the buffer (read only) in them. The
+     * file descriptor is owned by the wrapper and must not be closed.
+     */
+    int (*get_buffer_fd)(void);
+} GpsFp1SvStatusInterface;
+
+/**
+ * Starts reading the latest full SV status.
+ *
+ * Returns the latest SV status written, or NULL if none has been written yet,
+ * and sets the given sequence to its sequence number. Once the SV status has
+ * been read gps_fp1_sv_status_read_end must be called to check that it was not
+ * overwritten while it was being read.
+ */
+static inline const GpsFp1SvStatus* gps_fp1_sv_status_read_begin(const GpsFp1SvStatusBuffer* buffer, int32_t* sequence) {
+    *sequence = android_atomic_acquire_load(&buffer->sequence);
+    if (*sequence == 0) {
+        return NULL;
+    }
+
+    return &buffer->sv_status[*sequence & 1];
+}
+
+/**
+ * Finishes reading the full SV status with the given sequence number.
+ *
+ * Returns non zero if the SV status was not modified while it was being read,
+ * or 0 if it was (and thus the data read must be discarded).
+ */
+static inline int gps_fp1_sv_status_read_end(const GpsFp1SvStatusBuffer* buffer, int32_t sequence) {
+    android_memory_barrier();
+
+    return (uint32_t) (buffer->writing_sequence - sequence) < 2;
+}
+
+/** Name for the location batching extension. */
+#define GPS_FP1_BATCHING_INTERFACE "gps-fp1-batching"
+
+/** Maximum number of locations that can be kept in a batch. */
+#define GPS_FP1_BATCHING_MAX_DEPTH 1024
+
+/**
+ * Batching flag to deliver the batch when it is full. If not set, once the
+ * batch is full the oldest location is discarded each time that a new one is
+ * added, and the batch is delivered only when flushed (or when the threshold is
+ * reached, if any).
+ */
+#define GPS_FP1_BATCHING_WAKEUP_ON_FULL 0x0001
+
+/**
+ * Callback with a batch of locations, from the oldest to the newest. The
+ * locations are only valid during the call.
+ */
+typedef void (* gps_fp1_location_batch_callback)(GpsLocation* locations, int num_locations);
+
+typedef struct {
+    /** set to sizeof(GpsFp1BatchingCallbacks) */
+    size_t size;
+
+    gps_fp1_location_batch_callback location_batch_cb;
+} GpsFp1BatchingCallbacks;
+
+typedef struct {
+    /** set to sizeof(GpsFp1BatchingOptions) */
+    size_t size;
+
+    /** Number of locations kept in the batch; 1 to GPS_FP1_BATCHING_MAX_DEPTH. */
+    int depth;
+
+    /**
+     * Number of locations that causes the batch to be delivered, or 0 to
+     * deliver it only when flushed (or full, if
+     * GPS_FP1_BATCHING_WAKEUP_ON_FULL is set). It can not be greater than the
+     * depth.
+     */
+    int threshold;
+
+    /** Bitwise OR of GPS_FP1_BATCHING_* flags. */
+    uint32_t flags;
+} GpsFp1BatchingOptions;
+
+/**
+ * Extended interface for location batching.
+ *
+ * While batching, the locations reported by the MediaTek GPS engine are not
+ * passed to the location callback of the GpsCallbacks, but stored in a batch
+ * and delivered in bulk to the location_batch callback. Note that the batching
+ * only controls how the locations are delivered; the GPS must be started as
+ * usual through the GpsInterface for the locations to be reported.
+ *
+ * Each client (see GPS_FP1_CLIENTS_INTERFACE) has its own batch, and batching
+ * for one client does not affect the locations passed to the others. The
+ * functions with a client_id parameter act on the batch of the given client,
+ * while the rest act on the batch of the primary client. The batch of a client
+ * is cleaned up when the client is removed.
+ *
+ * The location_batch callback can call the functions of this interface, but,
+ * like the other callbacks, it may be called with the internal lock of the
+ * clients held, so it must not call the functions of the clients interface.
+ */
+typedef struct {
+    /** set to sizeof(GpsFp1BatchingInterface) */
+    size_t size;
+
+    /** Sets the callbacks; returns 0 on success. */
+    int (*init)(GpsFp1BatchingCallbacks* callbacks);
+
+    /**
+     * Starts batching with the given options, discarding any location
+     * previously batched; returns 0 on success.
+     */
+    int (*start)(const GpsFp1BatchingOptions* options);
+
+    /** Delivers the batch, if not empty, and stops batching; returns 0 on success. */
+    int (*stop)(void);
+
+    /** Delivers the batch now; returns the number of locations delivered. */
+    int (*flush)(void);
+
+    /** Returns the number of locations discarded since batching started. */
+    int (*get_discarded_count)(void);
+
+    /** Stops batching, discarding any location batched, and unsets the callbacks. */
+    void (*cleanup)(void);
+
+    /** Like init, but for the given client. */
+    int (*init_client)(int client_id, GpsFp1BatchingCallbacks* callbacks);
+
+    /** Like start, but for the given client. */
+    int (*start_client)(int client_id, const GpsFp1BatchingOptions* options);
+
+    /** Like stop, but for the given client. */
+    int (*stop_client)(int client_id);
+
+    /** Like flush, but for the given client. */
+    int (*flush_client)(int client_id);
+
+    /** Like get_discarded_count, but for the given client. */
+    int (*get_client_discarded_count)(int client_id);
+
+    /** Like cleanup, but for the given client. */
+    void (*cleanup_client)(int client_id);
+} GpsFp1BatchingInterface;
+
+/** Name for the multiple clients extension. */
+#define GPS_FP1_CLIENTS_INTERFACE "gps-fp1-clients"
+
+/** Maximum number of clients, including the primary client. */
+#define GPS_FP1_MAX_CLIENTS 4
+
+/**
+ * Identifier of the primary client, that is, the client that set its
+ * GpsCallbacks through the init function of the GpsInterface.
+ */
+#define GPS_FP1_PRIMARY_CLIENT 0
+
+/** Events that can be passed to a client. */
+#define GPS_FP1_CLIENT_EVENT_LOCATION   0x0001
+#define GPS_FP1_CLIENT_EVENT_STATUS     0x0002
+#define GPS_FP1_CLIENT_EVENT_SV_STATUS  0x0004
+#define GPS_FP1_CLIENT_EVENT_NMEA       0x0008
+#define GPS_FP1_CLIENT_EVENT_ALL        0x000F
+
+typedef struct {
+    /** set to sizeof(GpsFp1ClientOptions) */
+    size_t size;
+
+    /** Bitwise OR of the GPS_FP1_CLIENT_EVENT_* passed to the client. */
+    uint32_t events;
+
+    /**
+     * Minimum time between two locations passed to the client, in
+     * milliseconds, or 0 to pass all of them.
+     */
+    uint32_t location_min_interval_ms;
+
+    /**
+     * Minimum time between two SV status passed to the client, in
+     * milliseconds, or 0 to pass all of them.
+     */
+    uint32_t sv_status_min_interval_ms;
+} GpsFp1ClientOptions;
+
+/**
+ * Extended interface for multiple clients.
+ *
+ * Besides the primary client, up to GPS_FP1_MAX_CLIENTS - 1 clients can
+ * receive the data reported by the MediaTek GPS engine at the same time. All
+ * the clients share the same session of the engine, so they can only be added
+ * once the GpsInterface has been inited by the primary client; the engine is
+ * started while at least one client is started, and it is cleaned up once the
+ * primary client cleaned up the GpsInterface and no other clients remain.
+ *
+ * Only the location_cb, status_cb, sv_status_cb and nmea_cb callbacks of the
+ * GpsCallbacks of the additional clients are used. Location, SV status and NMEA
+ * are passed only to started clients, while status is passed to every client.
+ *
+ * The callbacks are called with an internal lock held, so they must not call
+ * any function of this interface.
+ */
+typedef struct {
+    /** set to sizeof(GpsFp1ClientsInterface) */
+    size_t size;
+
+    /**
+     * Adds a client with the given callbacks and options; the callbacks must
+     * be valid until the client is removed. Returns the identifier of the new
+     * client, or a negative error code.
+     */
+    int (*add_client)(GpsCallbacks* callbacks, const GpsFp1ClientOptions* options);
+
+    /** Stops and removes the given client; returns 0 on success. */
+    int (*remove_client)(int client_id);
+
+    /**
+     * Sets the options of the given client (which can be the primary client);
+     * returns 0 on success.
+     */
+    int (*set_client_options)(int client_id, const GpsFp1ClientOptions* options);
+
+    /** Starts the given client; returns 0 on success. */
+    int (*start)(int client_id);
+
+    /** Stops the given client; returns 0 on success. */
+    int (*stop)(int client_id);
+} GpsFp1ClientsInterface;
+
+/** Name for the statistics extension. */
+#define GPS_FP1_STATS_INTERFACE "gps-fp1-stats"
+
+/**
+ * Calls whose latency is measured; the entry points of the MediaTek GPS engine
+ * and the callbacks from it.
+ */
+#define GPS_FP1_STATS_CALL_START                0
+#define GPS_FP1_STATS_CALL_STOP                 1
+#define GPS_FP1_STATS_CALL_INJECT_TIME          2
+#define GPS_FP1_STATS_CALL_INJECT_LOCATION      3
+#define GPS_FP1_STATS_CALL_SET_POSITION_MODE    4
+#define GPS_FP1_STATS_CALL_LOCATION_CB          5
+#define GPS_FP1_STATS_CALL_SV_STATUS_CB         6
+#define GPS_FP1_STATS_CALL_NMEA_CB              7
+#define GPS_FP1_STATS_CALL_COUNT                8
+
+/** Number of buckets in a histogram. */
+#define GPS_FP1_STATS_HISTOGRAM_BUCKETS 24
+
+/**
+ * Histogram with logarithmic buckets.
+ *
+ * The bucket 0 counts the values lower than 1, and the bucket N counts the
+ * values from 2^(N-1) to 2^N - 1, except the last bucket, which also counts all
+ * the values above it.
+ */
+typedef struct {
+    uint32_t count;
+
+    uint32_t max;
+
+    uint32_t buckets[GPS_FP1_STATS_HISTOGRAM_BUCKETS];
+} GpsFp1StatsHistogram;
+
+typedef struct {
+    /** set to sizeof(GpsFp1Stats) */
+    size_t size;
+
+    /**
+     * Latency of each call, in microseconds, indexed by GPS_FP1_STATS_CALL_*.
+     * The latency of the callbacks includes the time spent in the clients.
+     */
+    GpsFp1StatsHistogram calls[GPS_FP1_STATS_CALL_COUNT];
+
+    /** Time from starting the engine to the first fix, in milliseconds. */
+    GpsFp1StatsHistogram ttff;
+
+    /** Time to first fix of the latest session, or -1 if it had no fix. */
+    int32_t last_ttff_ms;
+
+    /** Number of times that the engine was started. */
+    uint32_t sessions;
+
+    /** Number of locations reported by the engine. */
+    uint32_t fixes;
+
+    /**
+     * Number of times that a fix arrived much later than expected after the
+     * previous one in the same session.
+     */
+    uint32_t stalls;
+
+    /** Longest time between two fixes in the same session, in milliseconds. */
+    uint32_t max_fix_gap_ms;
+
+    /** Number of SV status dropped when they are delivered asynchronously. */
+    uint32_t sv_status_overruns;
+
+    /** Number of NMEA sentences reported by the engine. */
+    uint32_t nmea_sentences;
+
+    /**
+     * Number of NMEA reports passed to the clients; lower than the number of
+     * sentences if they are coalesced for the additional clients (the primary
+     * client always gets each sentence in its own report).
+     */
+    uint32_t nmea_reports;
+} GpsFp1Stats;
+
+/**
+ * Extended interface for statistics.
+ *
+ * The statistics are recorded without locks, so the values in a snapshot are
+ * not guaranteed to be consistent with each other.
+ */
+typedef struct {
+    /** set to sizeof(GpsFp1StatsInterface) */
+    size_t size;
+
+    /** Gets a snapshot of the statistics since the wrapper was loaded or reset. */
+    void (*get_stats)(GpsFp1Stats* stats);
+
+    /** Resets the statistics. */
+    void (*reset)(void);
+} GpsFp1StatsInterface;
+
+/**
+ * Returns an upper bound of the given percentile (0 to 100) of the values in
+ * the histogram, or 0 if it is empty.
+ */
+static inline uint32_t gps_fp1_stats_histogram_percentile(const GpsFp1StatsHistogram* histogram, int percentile) {
+    uint32_t target = (uint32_t) (((uint64_t) histogram->count * percentile + 99) / 100);
+    uint32_t accumulated = 0;
+
+    int i;
+    for (i = 0; i < GPS_FP1_STATS_HISTOGRAM_BUCKETS - 1 && histogram->count; i++) {
+        accumulated += histogram->buckets[i];
+        if (accumulated >= target) {
+            uint32_t upper_bound = (1U << i) - 1;
+            return upper_bound < histogram->max ? upper_bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+__END_DECLS
+
+#endif // ANDROID_INCLUDE_HARDWARE_GPS_FP1_H
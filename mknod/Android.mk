@@ -15,18 +15,27 @@
 
 LOCAL_PATH := $(call my-dir)
 
+MKNOD_FP1_CFLAGS :=
+
+ifneq ($(FP1_BOOT_TRACE),)
+    MKNOD_FP1_CFLAGS += -DFP1_BOOT_TRACE
+endif
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	mknod.c
 
-# The "mknod" command is needed for the init.*.rc files of the boot image (so it
-# is built as a static executable and included in the boot image itself).
+# The "mknod" command was needed for the init.*.rc files of the boot image (so it
+# is built as a static executable to be included in the boot image itself).
 # However, the boot image files are copied to the recovery image, and as the
 # "busybox" command built for the recovery image also contains a "mknod" command
 # their names would clash and the build would fail. Therefore, even if this
 # custom "mknod" command does not contain anything specific to the Fairphone 1,
 # it is called "mknod-fp1" just to prevent the clash of names.
+# The device nodes are now created by "modload-fp1" once their module is loaded,
+# so "mknod-fp1" is no longer added to the product, although it can still be
+# built on its own.
 LOCAL_MODULE := mknod-fp1
 LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT_SBIN)
 
@@ -35,3 +44,41 @@ LOCAL_STATIC_LIBRARIES := libc
 LOCAL_FORCE_STATIC_EXECUTABLE := true
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	modload.c \
+	nodes.c
+
+# Loads the kernel modules from the init.*.rc files of the boot image, so it is
+# built as a static executable too.
+LOCAL_MODULE := modload-fp1
+LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT_SBIN)
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+
+LOCAL_STATIC_LIBRARIES := libboottrace_fp1 libc
+
+LOCAL_CFLAGS += $(MKNOD_FP1_CFLAGS)
+
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+
+include $(BUILD_EXECUTABLE)
+
+# Host test of the scheduling of modload-fp1, which runs it against a recording
+# backend instead of loading the modules and creating the nodes.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	modload_test.c \
+	nodes.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+
+LOCAL_MODULE := modload-fp1_test
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
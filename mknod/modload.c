@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loader for the kernel modules, loading concurrently the modules that do not
+ * depend on each other, and creating the device nodes of each module as soon
+ * as it is loaded.
+ *
+ * The modules and their nodes are read from a manifest with lines like:
+ *
+ *   module <name> <path> [<dependency name>...]
+ *   node <module name> <path> <type> <major> <minor> <mode> <owner> <group>
+ *
+ * where the dependencies of a module must have been declared before it (so
+ * there can be no dependency cycles). Each node is created once its module is
+ * loaded, or its owner, group and mode are just set if it already exists.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * Each module is loaded once all its dependencies were loaded; if any of them
+ * failed, the module is not loaded. Modules already loaded are not an error.
+ *
+ * With "-n" (dry run) nothing is loaded nor created; the modules are "loaded"
+ * by waiting the milliseconds set in the MODLOAD_FP1_FAKE_DELAY_MS environment
+ * variable, so the scheduling can be checked on any Linux host.
+ *
+ * modload_test.c includes this file with MODLOAD_FP1_TEST defined to drive the
+ * scheduling through its own backend.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <boottrace_fp1.h>
+
+#include "nodes.h"
+
+#define MAX_MODULES 32
+#define MAX_DEPENDENCIES 8
+#define MAX_NODES 4
+#define MODULE_NAME_MAX 64
+
+#define MODULE_PENDING 0
+#define MODULE_LOADED 1
+#define MODULE_FAILED 2
+
+struct module {
+    char name[MODULE_NAME_MAX];
+    char path[PATH_MAX];
+
+    int dependencies[MAX_DEPENDENCIES];
+    int num_dependencies;
+
+    char nodes[MAX_NODES][NODE_LINE_MAX];
+    int node_line_numbers[MAX_NODES];
+    int num_nodes;
+
+    int state;
+    pthread_t thread;
+};
+
+/*
+ * Backend used to load the modules and create the nodes, so the scheduling can
+ * be exercised without loading anything.
+ */
+struct loader_backend {
+    int (*load_module)(const char *path);
+    int (*create_node)(const char *line, int line_number);
+};
+
+static struct module modules[MAX_MODULES];
+static int num_modules;
+
+static const struct loader_backend *backend;
+
+// Protects the state of the modules, and serializes the creation of the nodes.
+static pthread_mutex_t modules_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t modules_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Loads the module with finit_module, or with init_module if the kernel does
+ * not support the former (it was added in Linux 3.8). Returns 0 on success
+ * (also if the module was already loaded), or a negative error code.
+ */
+static int load_module_real(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    int ret = -1;
+    errno = ENOSYS;
+
+#ifdef __NR_finit_module
+    ret = syscall(__NR_finit_module, fd, "", 0);
+#endif
+
+    if (ret < 0 && errno == ENOSYS) {
+        struct stat stat;
+        if (fstat(fd, &stat) == 0) {
+            void *image = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (image != MAP_FAILED) {
+                ret = syscall(__NR_init_module, image, (unsigned long) stat.st_size, "");
+
+                int error = errno;
+                munmap(image, stat.st_size);
+                errno = error;
+            }
+        }
+    }
+
+    int error = errno;
+    close(fd);
+
+    if (ret < 0 && error != EEXIST) {
+        return -error;
+    }
+
+    return 0;
+}
+
+static int load_module_fake(const char *path) {
+    const char *delay = getenv("MODLOAD_FP1_FAKE_DELAY_MS");
+
+    if (delay) {
+        usleep(atoi(delay) * 1000);
+    }
+
+    return 0;
+}
+
+static int create_node_fake(const char *line, int line_number) {
+    log_kmsg("would create node %s\n", line);
+
+    return 0;
+}
+
+static const struct loader_backend real_backend = { load_module_real, create_node };
+static const struct loader_backend fake_backend = { load_module_fake, create_node_fake };
+
+static int find_module(const char *name) {
+    int i;
+    for (i = 0; i < num_modules; i++) {
+        if (!strcmp(modules[i].name, name)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int parse_module(char *arguments, int line_number) {
+    if (num_modules == MAX_MODULES) {
+        log_kmsg("line %d: too many modules\n", line_number);
+        return -1;
+    }
+
+    struct module *module = &modules[num_modules];
+    memset(module, 0, sizeof(*module));
+
+    char *save;
+    char *name = strtok_r(arguments, " \t", &save);
+    char *path = strtok_r(NULL, " \t", &save);
+    if (!name || !path || strlen(name) >= sizeof(module->name) || strlen(path) >= sizeof(module->path)) {
+        log_kmsg("line %d: invalid module\n", line_number);
+        return -1;
+    }
+
+    if (find_module(name) >= 0) {
+        log_kmsg("line %d: module %s declared twice\n", line_number, name);
+        return -1;
+    }
+
+    strcpy(module->name, name);
+    strcpy(module->path, path);
+
+    char *dependency;
+    while ((dependency = strtok_r(NULL, " \t", &save))) {
+        int index = find_module(dependency);
+        if (index < 0) {
+            log_kmsg("line %d: dependency %s of %s not declared before\n", line_number, dependency, name);
+            return -1;
+        }
+
+        if (module->num_dependencies == MAX_DEPENDENCIES) {
+            log_kmsg("line %d: too many dependencies\n", line_number);
+            return -1;
+        }
+
+        module->dependencies[module->num_dependencies++] = index;
+    }
+
+    num_modules++;
+
+    return 0;
+}
+
+static int parse_node(char *arguments, int line_number) {
+    char name[MODULE_NAME_MAX];
+    int name_length = strcspn(arguments, " \t");
+
+    if (name_length >= MODULE_NAME_MAX) {
+        log_kmsg("line %d: invalid node\n", line_number);
+        return -1;
+    }
+
+    memcpy(name, arguments, name_length);
+    name[name_length] = '\0';
+
+    int index = find_module(name);
+    if (index < 0) {
+        log_kmsg("line %d: module %s of node not declared before\n", line_number, name);
+        return -1;
+    }
+
+    struct module *module = &modules[index];
+    if (module->num_nodes == MAX_NODES) {
+        log_kmsg("line %d: too many nodes for %s\n", line_number, name);
+        return -1;
+    }
+
+    const char *node = arguments + name_length + strspn(arguments + name_length, " \t");
+    if (strlen(node) >= NODE_LINE_MAX) {
+        log_kmsg("line %d: node too long\n", line_number);
+        return -1;
+    }
+
+    strcpy(module->nodes[module->num_nodes], node);
+    module->node_line_numbers[module->num_nodes] = line_number;
+    module->num_nodes++;
+
+    return 0;
+}
+
+static int parse_manifest(const char *manifest_path) {
+    char line[NODE_LINE_MAX + MODULE_NAME_MAX + 8];
+    int line_number = 0;
+
+    FILE *manifest = fopen(manifest_path, "re");
+    if (!manifest) {
+        log_kmsg("unable to open manifest %s: %s\n", manifest_path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+
+    while (!ret && fgets(line, sizeof(line), manifest)) {
+        char *start = line + strspn(line, " \t");
+
+        line_number++;
+        line[strcspn(line, "\n")] = '\0';
+
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        if (!strncmp(start, "module ", 7)) {
+            ret = parse_module(start + 7, line_number);
+        } else if (!strncmp(start, "node ", 5)) {
+            ret = parse_node(start + 5, line_number);
+        } else {
+            log_kmsg("line %d: unknown entry: %s\n", line_number, start);
+            ret = -1;
+        }
+    }
+
+    fclose(manifest);
+
+    return ret;
+}
+
+/*
+ * Waits until all the dependencies of the module are loaded. Returns 0 if all
+ * of them were loaded, or -1 if any of them failed.
+ */
+static int wait_for_dependencies(const struct module *module) {
+    int ret = 0;
+
+    pthread_mutex_lock(&modules_mutex);
+
+    int i = 0;
+    while (i < module->num_dependencies) {
+        int state = modules[module->dependencies[i]].state;
+
+        if (state == MODULE_FAILED) {
+            ret = -1;
+            break;
+        }
+
+        if (state == MODULE_PENDING) {
+            pthread_cond_wait(&modules_cond, &modules_mutex);
+            continue;
+        }
+
+        i++;
+    }
+
+    pthread_mutex_unlock(&modules_mutex);
+
+    return ret;
+}
+
+static void *load_module_thread(void *data) {
+    struct module *module = data;
+    int state = MODULE_FAILED;
+
+    long long start_time_us = get_monotonic_time_us();
+
+    if (wait_for_dependencies(module)) {
+        log_kmsg("%s not loaded, as a dependency failed\n", module->name);
+    } else {
+        long long load_time_us = get_monotonic_time_us();
+
+        char step[BOOTTRACE_FP1_NAME_MAX];
+        snprintf(step, sizeof(step), "insmod %.32s", module->name);
+
+        BOOTTRACE_BEGIN(step);
+        int ret = backend->load_module(module->path);
+        BOOTTRACE_END(step);
+        if (ret < 0) {
+            log_kmsg("unable to load %s: %s\n", module->path, strerror(-ret));
+        } else {
+            long long now_us = get_monotonic_time_us();
+
+            log_kmsg("%s loaded in %lld us (waited %lld us for its dependencies)\n", module->name,
+                     now_us - load_time_us, load_time_us - start_time_us);
+
+            state = MODULE_LOADED;
+        }
+    }
+
+    pthread_mutex_lock(&modules_mutex);
+
+    if (state == MODULE_LOADED) {
+        int i;
+        for (i = 0; i < module->num_nodes; i++) {
+            backend->create_node(module->nodes[i], module->node_line_numbers[i]);
+        }
+    }
+
+    module->state = state;
+    pthread_cond_broadcast(&modules_cond);
+
+    pthread_mutex_unlock(&modules_mutex);
+
+    return NULL;
+}
+
+/*
+ * Loads all the modules, each one from its own thread. Returns the number of
+ * modules that were not loaded.
+ */
+static int load_modules() {
+    int i;
+    for (i = 0; i < num_modules; i++) {
+        if (pthread_create(&modules[i].thread, NULL, load_module_thread, &modules[i])) {
+            // Without a thread the module is loaded from the main thread;
+            // its dependencies already have their threads, so this does not
+            // deadlock.
+            load_module_thread(&modules[i]);
+            modules[i].thread = 0;
+        }
+    }
+
+    int failures = 0;
+    for (i = 0; i < num_modules; i++) {
+        if (modules[i].thread) {
+            pthread_join(modules[i].thread, NULL);
+        }
+
+        if (modules[i].state != MODULE_LOADED) {
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+#ifndef MODLOAD_FP1_TEST
+int main(int argc, char **argv) {
+    const char *manifest_path;
+
+    backend = &real_backend;
+
+    if (argc == 3 && !strcmp(argv[1], "-n")) {
+        backend = &fake_backend;
+        manifest_path = argv[2];
+    } else if (argc == 2) {
+        manifest_path = argv[1];
+    } else {
+        fprintf(stderr, "modload [-n] <manifest>\n");
+        return EXIT_FAILURE;
+    }
+
+    open_kmsg("modload-fp1");
+
+    if (parse_manifest(manifest_path)) {
+        return EXIT_FAILURE;
+    }
+
+    long long start_time_us = get_monotonic_time_us();
+
+    BOOTTRACE_BEGIN("modload-fp1");
+    int failures = load_modules();
+    BOOTTRACE_END("modload-fp1");
+
+    log_kmsg("%d modules, %d failed, in %lld us\n", num_modules, failures, get_monotonic_time_us() - start_time_us);
+
+    return failures ? EXIT_FAILURE : 0;
+}
+#endif
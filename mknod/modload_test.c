@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host test of the scheduling of modload.c.
+ *
+ * modload.c is included (without its main function) and run against a
+ * recording backend, which "loads" the modules by waiting a little and records
+ * when each load started and ended and when each node was created. The test
+ * checks from the recorded events that the modules are loaded after their
+ * dependencies, that independent modules are loaded concurrently, and that a
+ * failure prevents loading the modules that depend on the failed one.
+ *
+ * Usage: modload-fp1_test
+ */
+
+#define MODLOAD_FP1_TEST
+#include "modload.c"
+
+#define RECORDING_MAX_EVENTS 64
+#define RECORDING_DELAY_US 20000
+
+#define EVENT_LOAD_START 0
+#define EVENT_LOAD_END 1
+#define EVENT_NODE 2
+
+struct event {
+    int type;
+    char name[NODE_LINE_MAX];
+};
+
+static struct event events[RECORDING_MAX_EVENTS];
+static int num_events;
+static pthread_mutex_t events_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Path of the module that fails to load, if any.
+static const char *failing_path;
+
+static int failures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static void record_event(int type, const char *name) {
+    pthread_mutex_lock(&events_mutex);
+
+    if (num_events < RECORDING_MAX_EVENTS) {
+        events[num_events].type = type;
+        snprintf(events[num_events].name, sizeof(events[num_events].name), "%s", name);
+        num_events++;
+    }
+
+    pthread_mutex_unlock(&events_mutex);
+}
+
+static int load_module_recording(const char *path) {
+    record_event(EVENT_LOAD_START, path);
+    usleep(RECORDING_DELAY_US);
+    record_event(EVENT_LOAD_END, path);
+
+    if (failing_path && !strcmp(path, failing_path)) {
+        return -ENOENT;
+    }
+
+    return 0;
+}
+
+static int create_node_recording(const char *line, int line_number) {
+    record_event(EVENT_NODE, line);
+
+    return 0;
+}
+
+static const struct loader_backend recording_backend = { load_module_recording, create_node_recording };
+
+/*
+ * Returns the index of the given event, or -1 if it was not recorded.
+ */
+static int find_event(int type, const char *name) {
+    int i;
+    for (i = 0; i < num_events; i++) {
+        if (events[i].type == type && !strcmp(events[i].name, name)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void reset(const char *failing) {
+    num_modules = 0;
+    num_events = 0;
+    failing_path = failing;
+    backend = &recording_backend;
+}
+
+static int add_entry(const char *entry) {
+    char line[NODE_LINE_MAX + MODULE_NAME_MAX + 8];
+    snprintf(line, sizeof(line), "%s", entry);
+
+    if (!strncmp(line, "module ", 7)) {
+        return parse_module(line + 7, 1);
+    }
+
+    return parse_node(line + 5, 1);
+}
+
+/*
+ * "a" is loaded first, then "b" and "c" at the same time, and then "d", which
+ * depends on both.
+ */
+static void test_load_order() {
+    reset(NULL);
+
+    CHECK(add_entry("module a a.ko") == 0);
+    CHECK(add_entry("module b b.ko a") == 0);
+    CHECK(add_entry("module c c.ko a") == 0);
+    CHECK(add_entry("module d d.ko b c") == 0);
+    CHECK(add_entry("node a /dev/a c 10 1 0660 root root") == 0);
+    CHECK(add_entry("node d /dev/d c 10 4 0660 root root") == 0);
+
+    CHECK(load_modules() == 0);
+    CHECK(num_events == 10);
+
+    int a_end = find_event(EVENT_LOAD_END, "a.ko");
+    int a_node = find_event(EVENT_NODE, "/dev/a c 10 1 0660 root root");
+    int b_start = find_event(EVENT_LOAD_START, "b.ko");
+    int b_end = find_event(EVENT_LOAD_END, "b.ko");
+    int c_start = find_event(EVENT_LOAD_START, "c.ko");
+    int c_end = find_event(EVENT_LOAD_END, "c.ko");
+    int d_start = find_event(EVENT_LOAD_START, "d.ko");
+    int d_end = find_event(EVENT_LOAD_END, "d.ko");
+    int d_node = find_event(EVENT_NODE, "/dev/d c 10 4 0660 root root");
+
+    CHECK(find_event(EVENT_LOAD_START, "a.ko") == 0);
+
+    // The nodes are created as soon as their module is loaded, before the
+    // modules that depend on it are loaded.
+    CHECK(a_end >= 0 && a_end < a_node);
+    CHECK(a_node < b_start && a_node < c_start);
+
+    // "b" and "c" do not depend on each other.
+    CHECK(b_start >= 0 && b_start < c_end);
+    CHECK(c_start >= 0 && c_start < b_end);
+
+    CHECK(b_end >= 0 && b_end < d_start);
+    CHECK(c_end >= 0 && c_end < d_start);
+    CHECK(d_start < d_end && d_end < d_node);
+
+    int i;
+    for (i = 0; i < num_modules; i++) {
+        CHECK(modules[i].state == MODULE_LOADED);
+    }
+}
+
+/*
+ * "b" fails, so "c" and "e", which depend on it directly or indirectly, are
+ * not loaded, but "d" is.
+ */
+static void test_failure_propagation() {
+    reset("b.ko");
+
+    CHECK(add_entry("module a a.ko") == 0);
+    CHECK(add_entry("module b b.ko a") == 0);
+    CHECK(add_entry("module c c.ko b") == 0);
+    CHECK(add_entry("module d d.ko a") == 0);
+    CHECK(add_entry("module e e.ko c d") == 0);
+    CHECK(add_entry("node b /dev/b c 10 2 0660 root root") == 0);
+    CHECK(add_entry("node c /dev/c c 10 3 0660 root root") == 0);
+    CHECK(add_entry("node d /dev/d c 10 4 0660 root root") == 0);
+
+    CHECK(load_modules() == 3);
+
+    CHECK(modules[0].state == MODULE_LOADED);
+    CHECK(modules[1].state == MODULE_FAILED);
+    CHECK(modules[2].state == MODULE_FAILED);
+    CHECK(modules[3].state == MODULE_LOADED);
+    CHECK(modules[4].state == MODULE_FAILED);
+
+    CHECK(find_event(EVENT_LOAD_END, "b.ko") >= 0);
+    CHECK(find_event(EVENT_LOAD_START, "c.ko") < 0);
+    CHECK(find_event(EVENT_LOAD_START, "e.ko") < 0);
+    CHECK(find_event(EVENT_LOAD_END, "d.ko") >= 0);
+
+    CHECK(find_event(EVENT_NODE, "/dev/b c 10 2 0660 root root") < 0);
+    CHECK(find_event(EVENT_NODE, "/dev/c c 10 3 0660 root root") < 0);
+    CHECK(find_event(EVENT_NODE, "/dev/d c 10 4 0660 root root") >= 0);
+}
+
+static void test_node_too_long() {
+    reset(NULL);
+
+    char manifest_path[] = "/tmp/modload_test.XXXXXX";
+    int fd = mkstemp(manifest_path);
+    CHECK(fd >= 0);
+
+    FILE *manifest = fdopen(fd, "w");
+    fprintf(manifest, "module a a.ko\nnode a /dev/");
+    int i;
+    for (i = 0; i < NODE_LINE_MAX; i++) {
+        fputc('x', manifest);
+    }
+    fprintf(manifest, " c 10 1 0660 root root\n");
+    fclose(manifest);
+
+    CHECK(parse_manifest(manifest_path) < 0);
+    CHECK(num_modules == 1 && modules[0].num_nodes == 0);
+
+    unlink(manifest_path);
+}
+
+int main() {
+    test_load_order();
+    test_failure_propagation();
+    test_node_too_long();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    printf("All checks passed\n");
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Creation of the device nodes of the kernel modules loaded by modload.c.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "nodes.h"
+
+static int kmsg_fd = -1;
+static const char *kmsg_tag = "";
+
+void open_kmsg(const char *tag) {
+    kmsg_tag = tag;
+    kmsg_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+}
+
+void log_kmsg(const char *format, ...) {
+    char message[NODE_LINE_MAX + 64];
+    va_list args;
+
+    int length = snprintf(message, sizeof(message), "<6>%s: ", kmsg_tag);
+
+    va_start(args, format);
+    length += vsnprintf(message + length, sizeof(message) - length, format, args);
+    va_end(args);
+
+    if (length >= (int) sizeof(message)) {
+        length = sizeof(message) - 1;
+    }
+
+    if (kmsg_fd < 0 || write(kmsg_fd, message, length) < 0) {
+        // Without the priority prefix.
+        fputs(message + 3, stderr);
+    }
+}
+
+long long get_monotonic_time_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int parse_id(const char *name, int is_group, unsigned int *id) {
+    char *end;
+    unsigned long value = strtoul(name, &end, 10);
+    if (*name && !*end) {
+        *id = value;
+        return 0;
+    }
+
+    if (is_group) {
+        struct group *group = getgrnam(name);
+        if (group) {
+            *id = group->gr_gid;
+            return 0;
+        }
+    } else {
+        struct passwd *passwd = getpwnam(name);
+        if (passwd) {
+            *id = passwd->pw_uid;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Directory of the last node created, kept open as all the nodes are expected
+ * to be in the same directory (typically "/dev").
+ */
+static char dir_path[PATH_MAX];
+static int dir_fd = -1;
+
+static int open_dir(const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    size_t dir_length;
+
+    if (!slash) {
+        *name = path;
+        return AT_FDCWD;
+    }
+
+    *name = slash + 1;
+    dir_length = slash == path ? 1 : (size_t) (slash - path);
+
+    if (dir_length >= sizeof(dir_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (dir_fd >= 0 && strlen(dir_path) == dir_length && !strncmp(dir_path, path, dir_length)) {
+        return dir_fd;
+    }
+
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+
+    memcpy(dir_path, path, dir_length);
+    dir_path[dir_length] = '\0';
+
+    dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        dir_path[0] = '\0';
+    }
+
+    return dir_fd;
+}
+
+int create_node(const char *line, int line_number) {
+    char path[NODE_LINE_MAX];
+    char type;
+    int major, minor;
+    unsigned int permissions;
+    char owner[64], group[64];
+    unsigned int uid, gid;
+    mode_t file_type;
+    dev_t device;
+    const char *name;
+    struct stat existing;
+    const char *result = "created";
+
+    long long start_time_us = get_monotonic_time_us();
+
+    if (sscanf(line, "%255s %c %d %d %o %63s %63s", path, &type, &major, &minor, &permissions, owner, group) != 7) {
+        log_kmsg("line %d: invalid node: %s\n", line_number, line);
+        return -1;
+    }
+
+    switch (type) {
+    case 'b':
+        file_type = S_IFBLK;
+        break;
+    case 'c':
+    case 'u':
+        file_type = S_IFCHR;
+        break;
+    case 'p':
+        file_type = S_IFIFO;
+        major = 0;
+        minor = 0;
+        break;
+    default:
+        log_kmsg("line %d: invalid node type '%c'\n", line_number, type);
+        return -1;
+    }
+
+    if (permissions & ~07777) {
+        log_kmsg("line %d: invalid mode %o\n", line_number, permissions);
+        return -1;
+    }
+
+    if (parse_id(owner, 0, &uid) || parse_id(group, 1, &gid)) {
+        log_kmsg("line %d: unknown owner '%s' or group '%s'\n", line_number, owner, group);
+        return -1;
+    }
+
+    device = makedev(major, minor);
+
+    int fd = open_dir(path, &name);
+    if (fd < 0 && fd != AT_FDCWD) {
+        log_kmsg("%s: unable to open directory: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (mknodat(fd, name, file_type | (permissions & 0777), device)) {
+        if (errno != EEXIST) {
+            log_kmsg("%s: unable to create node: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        if (fstatat(fd, name, &existing, AT_SYMLINK_NOFOLLOW)) {
+            log_kmsg("%s: unable to check existing node: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        if ((existing.st_mode & S_IFMT) != file_type || (file_type != S_IFIFO && existing.st_rdev != device)) {
+            log_kmsg("%s: exists but it is not the expected node\n", path);
+            return -1;
+        }
+
+        result = "already existed";
+    }
+
+    // The mode given to mknodat is affected by the umask, so it is always
+    // set explicitly too; it is set after the owner, as changing the owner
+    // clears the set-user-ID and set-group-ID bits.
+    if (fchownat(fd, name, uid, gid, AT_SYMLINK_NOFOLLOW) || fchmodat(fd, name, permissions, 0)) {
+        log_kmsg("%s: unable to set owner, group or mode: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    log_kmsg("%s %s (%s %d %d %04o %u %u) in %lld us\n", path, result,
+             type == 'p' ? "p" : (file_type == S_IFBLK ? "b" : "c"), major, minor,
+             permissions, uid, gid, get_monotonic_time_us() - start_time_us);
+
+    return 0;
+}
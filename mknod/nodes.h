@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Declares the creation of the device nodes of the kernel modules loaded by
+ * modload.c.
+ */
+#ifndef MKNOD_NODES_H
+#define MKNOD_NODES_H
+
+// Maximum length of a line describing a node.
+#define NODE_LINE_MAX 256
+
+/*
+ * Opens the kernel log, used by log_kmsg, with the given tag. If it can not be
+ * opened the messages are written to the standard error instead.
+ */
+void open_kmsg(const char *tag);
+
+void log_kmsg(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+long long get_monotonic_time_us();
+
+/*
+ * Creates the node described in the line ("<path> <type> <major> <minor>
+ * <mode> <owner> <group>"), or just sets its owner, group and mode if it
+ * already exists. Returns 0 on success, or -1 otherwise (after logging the
+ * error). It is not thread safe.
+ */
+int create_node(const char *line, int line_number);
+
+#endif
@@ -0,0 +1,27 @@
+# Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+LOCAL_PATH:= $(call my-dir)
+
+# Host command to compute the proprietary blobs needed from a ROM, from the
+# DT_NEEDED entries of the root blobs (see blob-roots.txt).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := blobdeps.c
+
+LOCAL_MODULE := blobdeps-fp1
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2016 Daniel Calviño Sánchez <danxuliu@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host command to compute the proprietary blobs needed from a ROM:
+ *
+ *   blobdeps-fp1 [-b <built product dir>] [-f <roots file>] [-l <listed blobs file>]
+ *                [-m [-o <mk file>]] <ROM root dir> [<root blob>...]
+ *
+ * The root blobs are the blobs needed on their own (executables, HAL modules
+ * and other libraries loaded with dlopen, firmware and configuration files...).
+ * They are given as paths relative to the ROM root dir, optionally renamed with
+ * "<path>:<installed path>" like in extract-files.sh, either as arguments or in
+ * the roots file (one per line; empty lines and lines starting with '#' are
+ * ignored).
+ *
+ * The DT_NEEDED entries of each ELF blob are read, and each needed library is
+ * looked for like the dynamic linker does, first in system/vendor/lib and then
+ * in system/lib. If it is found in the built product dir (for example,
+ * out/target/product/fp1) it is built from source, so it is not a blob;
+ * otherwise, if it is found in the ROM it is a blob, and its own dependencies
+ * are resolved too.
+ *
+ * The blobs needed are printed, each one after the blobs it depends on. With
+ * "-m" the PRODUCT_COPY_FILES for them are written like extract-files.sh does
+ * in proprietary/blobs.mk (and only if its contents changed), but to
+ * blobdeps.mk in the current directory, or to the file given with "-o", so the
+ * blobs.mk written by extract-files.sh is not overwritten. If a listed
+ * blobs file is given (for example, the output of "extract-files.sh --list"),
+ * the listed blobs that are not needed are reported.
+ *
+ * The exit status is 1 if any needed library was not found, or if the
+ * dependencies of any blob could not be resolved.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_BLOBS 1024
+#define MAX_NEEDED 128
+#define LINE_MAX_LENGTH 512
+
+#define DEFAULT_MK_PATH "blobdeps.mk"
+
+#define BLOB_PENDING 0
+#define BLOB_VISITING 1
+#define BLOB_DONE 2
+
+struct blob {
+    // Path in the ROM, and path in which it is installed.
+    char path[PATH_MAX];
+    char installed_path[PATH_MAX];
+
+    int state;
+};
+
+static const char* const library_dirs[] = {
+    "system/vendor/lib",
+    "system/lib",
+};
+
+static const char* rom_dir;
+static const char* built_dir;
+
+static struct blob blobs[MAX_BLOBS];
+static int num_blobs;
+
+// Indexes of the needed blobs, each one after the blobs it depends on.
+static int needed_blobs[MAX_BLOBS];
+static int num_needed_blobs;
+
+// Missing blobs and blobs whose dependencies could not be resolved.
+static int num_errors;
+
+/**
+ * Receives the names of the libraries needed by an ELF file, pointing into the
+ * mapped file.
+ */
+typedef void (*needed_callback)(const char* needed, void* data);
+
+/**
+ * Returns a pointer to the given range of the mapped file, or NULL if it is
+ * out of bounds.
+ */
+static const void* get_range(const void* file, size_t file_size, uint64_t offset, uint64_t size) {
+    if (offset > file_size || size > file_size - offset) {
+        return NULL;
+    }
+
+    return (const char*) file + offset;
+}
+
+/*
+ * Walks the headers of the mapped ELF file, in place, and calls the callback
+ * with each DT_NEEDED entry. Returns 0 on success, or -1 if the file is
+ * malformed. Defined for both ELF classes.
+ */
+#define DEFINE_FOR_EACH_NEEDED(bits)                                                                \
+static int for_each_needed_elf##bits(const void* file, size_t file_size,                           \
+                                     needed_callback callback, void* data) {                       \
+    const Elf##bits##_Ehdr* header = file;                                                         \
+                                                                                                   \
+    if (file_size < sizeof(*header) || header->e_phentsize != sizeof(Elf##bits##_Phdr)) {          \
+        return -1;                                                                                 \
+    }                                                                                              \
+                                                                                                   \
+    const Elf##bits##_Phdr* program_headers = get_range(file, file_size, header->e_phoff,          \
+            (uint64_t) header->e_phnum * sizeof(Elf##bits##_Phdr));                                \
+    if (!program_headers) {                                                                        \
+        return -1;                                                                                 \
+    }                                                                                              \
+                                                                                                   \
+    const Elf##bits##_Dyn* dynamic = NULL;                                                         \
+    size_t num_dynamic = 0;                                                                        \
+                                                                                                   \
+    int i;                                                                                         \
+    for (i = 0; i < header->e_phnum; i++) {                                                        \
+        if (program_headers[i].p_type == PT_DYNAMIC) {                                             \
+            dynamic = get_range(file, file_size, program_headers[i].p_offset,                      \
+                                program_headers[i].p_filesz);                                      \
+            num_dynamic = program_headers[i].p_filesz / sizeof(Elf##bits##_Dyn);                   \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    if (!dynamic) {                                                                                \
+        /* Statically linked. */                                                                   \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    uint64_t string_table_address = 0;                                                             \
+    uint64_t string_table_size = 0;                                                                \
+                                                                                                   \
+    size_t j;                                                                                      \
+    for (j = 0; j < num_dynamic && dynamic[j].d_tag != DT_NULL; j++) {                             \
+        if (dynamic[j].d_tag == DT_STRTAB) {                                                       \
+            string_table_address = dynamic[j].d_un.d_ptr;                                          \
+        } else if (dynamic[j].d_tag == DT_STRSZ) {                                                 \
+            string_table_size = dynamic[j].d_un.d_val;                                             \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    /* The string table is given by its address once loaded; find its offset */                    \
+    /* in the file through the segment that loads it. */                                           \
+    const char* string_table = NULL;                                                               \
+    for (i = 0; i < header->e_phnum && !string_table; i++) {                                       \
+        const Elf##bits##_Phdr* segment = &program_headers[i];                                     \
+                                                                                                   \
+        if (segment->p_type == PT_LOAD && string_table_address >= segment->p_vaddr &&              \
+                string_table_address - segment->p_vaddr < segment->p_filesz) {                     \
+            string_table = get_range(file, file_size,                                              \
+                                     string_table_address - segment->p_vaddr + segment->p_offset,  \
+                                     string_table_size);                                           \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    if (!string_table) {                                                                           \
+        return -1;                                                                                 \
+    }                                                                                              \
+                                                                                                   \
+    for (j = 0; j < num_dynamic && dynamic[j].d_tag != DT_NULL; j++) {                             \
+        if (dynamic[j].d_tag != DT_NEEDED) {                                                       \
+            continue;                                                                              \
+        }                                                                                          \
+                                                                                                   \
+        uint64_t name_offset = dynamic[j].d_un.d_val;                                              \
+        if (name_offset >= string_table_size ||                                                    \
+                !memchr(string_table + name_offset, '\0', string_table_size - name_offset)) {      \
+            return -1;                                                                             \
+        }                                                                                          \
+                                                                                                   \
+        callback(string_table + name_offset, data);                                                \
+    }                                                                                              \
+                                                                                                   \
+    return 0;                                                                                      \
+}
+
+DEFINE_FOR_EACH_NEEDED(32)
+DEFINE_FOR_EACH_NEEDED(64)
+
+/**
+ * Calls the callback with each library needed by the file. Files that are not
+ * ELF files (like firmware or configuration files) do not need any library.
+ * Returns 0 on success, or -1 if the file could not be read or it is a
+ * malformed ELF file.
+ */
+static int for_each_needed(const char* path, needed_callback callback, void* data) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    struct stat stat;
+    if (fstat(fd, &stat) < 0) {
+        fprintf(stderr, "Could not stat %s: %s\n", path, strerror(errno));
+        close(fd);
+
+        return -1;
+    }
+
+    if (stat.st_size < EI_NIDENT) {
+        close(fd);
+
+        return 0;
+    }
+
+    void* file = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    const unsigned char* ident = file;
+    int ret = 0;
+
+    if (memcmp(ident, ELFMAG, SELFMAG) == 0) {
+        if (ident[EI_DATA] != ELFDATA2LSB) {
+            // The Fairphone 1 and the hosts it is built on are little endian.
+            ret = -1;
+        } else if (ident[EI_CLASS] == ELFCLASS32) {
+            ret = for_each_needed_elf32(file, stat.st_size, callback, data);
+        } else if (ident[EI_CLASS] == ELFCLASS64) {
+            ret = for_each_needed_elf64(file, stat.st_size, callback, data);
+        } else {
+            ret = -1;
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "%s is not a valid ELF file\n", path);
+        }
+    }
+
+    munmap(file, stat.st_size);
+
+    return ret;
+}
+
+static int file_exists(const char* dir, const char* path) {
+    char full_path[PATH_MAX];
+
+    if (snprintf(full_path, sizeof(full_path), "%s/%s", dir, path) >= (int) sizeof(full_path)) {
+        return 0;
+    }
+
+    return access(full_path, F_OK) == 0;
+}
+
+static int find_blob(const char* path) {
+    int i;
+    for (i = 0; i < num_blobs; i++) {
+        if (!strcmp(blobs[i].path, path)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Returns the index of the blob with the given path, adding it if needed, or
+ * -1 if there are too many blobs.
+ */
+static int add_blob(const char* path, const char* installed_path) {
+    int index = find_blob(path);
+    if (index >= 0) {
+        return index;
+    }
+
+    if (num_blobs == MAX_BLOBS || strlen(path) >= PATH_MAX || strlen(installed_path) >= PATH_MAX) {
+        fprintf(stderr, "Too many blobs\n");
+
+        return -1;
+    }
+
+    struct blob* blob = &blobs[num_blobs];
+    strcpy(blob->path, path);
+    strcpy(blob->installed_path, installed_path);
+    blob->state = BLOB_PENDING;
+
+    return num_blobs++;
+}
+
+struct needed_data {
+    const char* path;
+
+    // Blobs needed; they are visited once the file has been walked and
+    // unmapped, so only one file is mapped at a time.
+    int needed[MAX_NEEDED];
+    int num_needed;
+
+    // Whether more than MAX_NEEDED blobs are needed.
+    int too_many_needed;
+};
+
+static void add_needed_library(const char* name, void* data) {
+    struct needed_data* needed_data = data;
+    char path[PATH_MAX];
+
+    size_t i;
+    for (i = 0; i < sizeof(library_dirs) / sizeof(library_dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", library_dirs[i], name);
+
+        if (built_dir && file_exists(built_dir, path)) {
+            return;
+        }
+    }
+
+    for (i = 0; i < sizeof(library_dirs) / sizeof(library_dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", library_dirs[i], name);
+
+        if (file_exists(rom_dir, path)) {
+            int index = add_blob(path, path);
+            if (index < 0) {
+                num_errors++;
+
+                return;
+            }
+
+            if (needed_data->num_needed == MAX_NEEDED) {
+                if (!needed_data->too_many_needed) {
+                    fprintf(stderr, "Too many libraries needed by %s\n", needed_data->path);
+                    needed_data->too_many_needed = 1;
+                    num_errors++;
+                }
+
+                return;
+            }
+
+            needed_data->needed[needed_data->num_needed++] = index;
+
+            return;
+        }
+    }
+
+    fprintf(stderr, "Missing %s, needed by %s\n", name, needed_data->path);
+
+    num_errors++;
+}
+
+/**
+ * Visits the blobs needed by the given blob and then adds it to the needed
+ * blobs, so each blob is added after the blobs it depends on.
+ */
+static void visit_blob(int index) {
+    if (blobs[index].state != BLOB_PENDING) {
+        // Either already added, or in a dependency cycle that is being
+        // visited.
+        return;
+    }
+
+    blobs[index].state = BLOB_VISITING;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", rom_dir, blobs[index].path);
+
+    struct needed_data needed_data;
+    needed_data.path = blobs[index].path;
+    needed_data.num_needed = 0;
+    needed_data.too_many_needed = 0;
+
+    if (for_each_needed(path, add_needed_library, &needed_data) < 0) {
+        num_errors++;
+    }
+
+    int i;
+    for (i = 0; i < needed_data.num_needed; i++) {
+        visit_blob(needed_data.needed[i]);
+    }
+
+    blobs[index].state = BLOB_DONE;
+    needed_blobs[num_needed_blobs++] = index;
+}
+
+/**
+ * Adds a root blob given as "<path>[:<installed path>]".
+ */
+static int add_root(char* root) {
+    char* installed_path = strchr(root, ':');
+    if (installed_path) {
+        *installed_path++ = '\0';
+    } else {
+        installed_path = root;
+    }
+
+    if (!file_exists(rom_dir, root)) {
+        fprintf(stderr, "Missing root blob %s\n", root);
+        num_errors++;
+
+        return 0;
+    }
+
+    return add_blob(root, installed_path) < 0 ? -1 : 0;
+}
+
+/**
+ * Calls the function with each line of the file that is not empty nor a
+ * comment, with the surrounding blanks removed.
+ */
+static int for_each_line(const char* path, int (*function)(char* line)) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+
+        return -1;
+    }
+
+    char line[LINE_MAX_LENGTH];
+    int ret = 0;
+
+    while (!ret && fgets(line, sizeof(line), file)) {
+        char* start = line + strspn(line, " \t");
+        start[strcspn(start, " \t\r\n")] = '\0';
+
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        ret = function(start);
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+static int report_if_unused(char* listed) {
+    char* separator = strchr(listed, ':');
+    if (separator) {
+        *separator = '\0';
+    }
+
+    int index = find_blob(listed);
+    if (index < 0 || blobs[index].state != BLOB_DONE) {
+        fprintf(stderr, "Unused %s\n", listed);
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the PRODUCT_COPY_FILES for the needed blobs, replacing the file only
+ * if its contents changed, so the build does not consider it modified.
+ */
+static int write_blobs_mk(const char* mk_path) {
+    char temporary_path[PATH_MAX];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", mk_path);
+
+    FILE* mk = fopen(temporary_path, "w");
+    if (!mk) {
+        fprintf(stderr, "Could not open %s: %s\n", temporary_path, strerror(errno));
+
+        return -1;
+    }
+
+    fprintf(mk, "PRODUCT_COPY_FILES +=");
+
+    int i;
+    for (i = 0; i < num_needed_blobs; i++) {
+        const char* installed_path = blobs[needed_blobs[i]].installed_path;
+
+        fprintf(mk, " \\\n\tvendor/fairphone/fp1/proprietary/%s:%s", installed_path, installed_path);
+    }
+
+    fprintf(mk, "\n");
+
+    if (fclose(mk) != 0) {
+        fprintf(stderr, "Could not write %s: %s\n", temporary_path, strerror(errno));
+        unlink(temporary_path);
+
+        return -1;
+    }
+
+    int changed = 1;
+
+    FILE* old_mk = fopen(mk_path, "r");
+    FILE* new_mk = fopen(temporary_path, "r");
+    if (old_mk && new_mk) {
+        int old_c;
+        int new_c;
+
+        do {
+            old_c = fgetc(old_mk);
+            new_c = fgetc(new_mk);
+        } while (old_c == new_c && old_c != EOF);
+
+        changed = old_c != new_c;
+    }
+
+    if (old_mk) {
+        fclose(old_mk);
+    }
+    if (new_mk) {
+        fclose(new_mk);
+    }
+
+    if (!changed) {
+        unlink(temporary_path);
+
+        return 0;
+    }
+
+    if (rename(temporary_path, mk_path) < 0) {
+        fprintf(stderr, "Could not write %s: %s\n", mk_path, strerror(errno));
+        unlink(temporary_path);
+
+        return -1;
+    }
+
+    fprintf(stderr, "%s updated\n", mk_path);
+
+    return 0;
+}
+
+static int print_usage() {
+    fprintf(stderr, "blobdeps-fp1 [-b <built product dir>] [-f <roots file>] [-l <listed blobs file>]\n"
+                    "             [-m [-o <mk file>]] <ROM root dir> [<root blob>...]\n");
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+    const char* roots_path = NULL;
+    const char* listed_path = NULL;
+    const char* mk_path = DEFAULT_MK_PATH;
+    int write_mk = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:f:l:mo:")) != -1) {
+        switch (option) {
+        case 'b':
+            built_dir = optarg;
+            break;
+        case 'f':
+            roots_path = optarg;
+            break;
+        case 'l':
+            listed_path = optarg;
+            break;
+        case 'm':
+            write_mk = 1;
+            break;
+        case 'o':
+            mk_path = optarg;
+            break;
+        default:
+            return print_usage();
+        }
+    }
+
+    if (optind >= argc) {
+        return print_usage();
+    }
+
+    rom_dir = argv[optind++];
+
+    if (roots_path && for_each_line(roots_path, add_root) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    for (; optind < argc; optind++) {
+        if (add_root(argv[optind]) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Only the roots have been added so far; the blobs added while visiting
+    // them are visited from their dependents.
+    int num_roots = num_blobs;
+
+    int i;
+    for (i = 0; i < num_roots; i++) {
+        visit_blob(i);
+    }
+
+    for (i = 0; i < num_needed_blobs; i++) {
+        const struct blob* blob = &blobs[needed_blobs[i]];
+
+        if (strcmp(blob->path, blob->installed_path)) {
+            printf("%s:%s\n", blob->path, blob->installed_path);
+        } else {
+            printf("%s\n", blob->path);
+        }
+    }
+
+    if (listed_path && for_each_line(listed_path, report_if_unused) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (write_mk && write_blobs_mk(mk_path) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    return num_errors ? 1 : 0;
+}